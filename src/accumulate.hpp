@@ -0,0 +1,254 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ACCUMULATE_HPP
+#define ACCUMULATE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <exception>
+
+//Independent accumulators per chunk, which lets the compiler vectorize the loop
+#define MPIRPC_ACCUMULATE_LANES 8
+//Ranges are only split between threads if each thread gets at least this many elements
+#define MPIRPC_ACCUMULATE_MIN_CHUNK 32768
+
+namespace mpirpc {
+
+/**
+ * True if Op is commutative, so that the elements of a range may be combined in any order. Specialize for other
+ * commutative operations to let accumulate() vectorize them.
+ */
+template<typename Op>
+struct is_commutative_op : std::false_type {};
+
+template<typename T> struct is_commutative_op<std::plus<T>> : std::true_type {};
+template<typename T> struct is_commutative_op<std::multiplies<T>> : std::true_type {};
+template<typename T> struct is_commutative_op<std::bit_and<T>> : std::true_type {};
+template<typename T> struct is_commutative_op<std::bit_or<T>> : std::true_type {};
+template<typename T> struct is_commutative_op<std::bit_xor<T>> : std::true_type {};
+
+namespace detail {
+
+template<typename T, typename It, typename BinaryOperation>
+T accumulateChunk(It first, It last, BinaryOperation& op, std::false_type)
+{
+    T acc = *first;
+    for (++first; first != last; ++first)
+        acc = op(acc, *first);
+    return acc;
+}
+
+template<typename T, typename It, typename BinaryOperation>
+T accumulateChunk(It first, It last, BinaryOperation& op, std::true_type)
+{
+    constexpr std::size_t L = MPIRPC_ACCUMULATE_LANES;
+    std::size_t n = last - first;
+    if (n < 2*L)
+        return accumulateChunk<T>(first, last, op, std::false_type());
+    T acc[L];
+    for (std::size_t j = 0; j < L; ++j)
+        acc[j] = first[j];
+    std::size_t i = L;
+    for (; i + L <= n; i += L)
+        for (std::size_t j = 0; j < L; ++j)
+            acc[j] = op(acc[j], first[i+j]);
+    for (std::size_t w = L/2; w > 0; w /= 2)
+        for (std::size_t j = 0; j < w; ++j)
+            acc[j] = op(acc[j], acc[j+w]);
+    for (; i < n; ++i)
+        acc[0] = op(acc[0], first[i]);
+    return acc[0];
+}
+
+/**
+ * Combine a non-empty, non-overlapping range with #op, using independent lanes where the order does not matter
+ */
+template<typename T, typename It, typename BinaryOperation>
+T accumulateChunk(It first, It last, BinaryOperation& op)
+{
+    using lanes = std::integral_constant<bool, std::is_arithmetic<T>::value && is_commutative_op<BinaryOperation>::value &&
+        std::is_same<typename std::iterator_traits<It>::iterator_category, std::random_access_iterator_tag>::value>;
+    return accumulateChunk<T>(first, last, op, lanes());
+}
+
+}
+
+namespace detail {
+
+/**
+ * The number of threads to split #n elements between, at most #threads
+ */
+inline std::ptrdiff_t chunkThreads(std::ptrdiff_t n, int threads)
+{
+    return std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(threads, n/MPIRPC_ACCUMULATE_MIN_CHUNK));
+}
+
+/**
+ * Split [0, #n) into #numThreads contiguous chunks and call #work(t, begin, end) for chunk t on its own thread.
+ * The first chunk is processed by the calling thread. The first exception thrown by #work is rethrown once all
+ * threads have finished.
+ */
+template<typename Work>
+void forEachChunk(std::ptrdiff_t n, std::ptrdiff_t numThreads, Work work)
+{
+    std::vector<std::exception_ptr> errors(numThreads);
+    std::vector<std::thread> workers;
+    std::ptrdiff_t chunk = n/numThreads;
+    auto run = [&](std::ptrdiff_t t) {
+        std::ptrdiff_t begin = t*chunk;
+        std::ptrdiff_t end = (t == numThreads - 1) ? n : begin + chunk;
+        try {
+            work(t, begin, end);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    for (std::ptrdiff_t t = 1; t < numThreads; ++t)
+        workers.emplace_back(run, t);
+    run(0);
+    for (std::thread& w : workers)
+        w.join();
+    for (std::exception_ptr& e : errors)
+        if (e)
+            std::rethrow_exception(e);
+}
+
+template<class InputIt, class T, class BinaryOperation>
+T accumulate(InputIt first, InputIt last, T init, BinaryOperation op, int, std::false_type)
+{
+    return std::accumulate(first, last, init, op);
+}
+
+template<class InputIt, class T, class BinaryOperation>
+T accumulate(InputIt first, InputIt last, T init, BinaryOperation op, int threads, std::true_type)
+{
+    std::ptrdiff_t n = std::distance(first, last);
+    if (n == 0)
+        return init;
+    std::ptrdiff_t numThreads = chunkThreads(n, threads);
+    if (numThreads == 1)
+        return std::accumulate(first, last, init, op);
+    std::vector<T> partials(numThreads);
+    forEachChunk(n, numThreads, [&](std::ptrdiff_t t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+        BinaryOperation localOp(op);
+        partials[t] = detail::accumulateChunk<T>(std::next(first, begin), std::next(first, end), localOp);
+    });
+    for (std::ptrdiff_t w = 1; w < numThreads; w *= 2)
+        for (std::ptrdiff_t t = 0; t + w < numThreads; t += 2*w)
+            partials[t] = op(partials[t], partials[t+w]);
+    return op(init, partials[0]);
+}
+
+template<class RandomIt, class T, class BinaryOperation>
+void scanChunk(RandomIt first, RandomIt last, T prefix, BinaryOperation& op, bool inclusive)
+{
+    for (; first != last; ++first) {
+        if (inclusive) {
+            prefix = op(prefix, *first);
+            *first = prefix;
+        } else {
+            T value = std::move(*first);
+            *first = prefix;
+            prefix = op(prefix, value);
+        }
+    }
+}
+
+template<class RandomIt, class T, class BinaryOperation>
+void scan(RandomIt first, RandomIt last, T init, BinaryOperation op, int threads, bool inclusive)
+{
+    std::ptrdiff_t n = last - first;
+    std::ptrdiff_t numThreads = chunkThreads(n, threads);
+    if (numThreads == 1) {
+        scanChunk(first, last, init, op, inclusive);
+        return;
+    }
+    std::vector<T> prefixes(numThreads);
+    forEachChunk(n, numThreads, [&](std::ptrdiff_t t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+        if (t == numThreads - 1)
+            return;
+        BinaryOperation localOp(op);
+        prefixes[t+1] = detail::accumulateChunk<T>(first + begin, first + end, localOp);
+    });
+    prefixes[0] = init;
+    for (std::ptrdiff_t t = 1; t < numThreads; ++t)
+        prefixes[t] = op(prefixes[t-1], prefixes[t]);
+    forEachChunk(n, numThreads, [&](std::ptrdiff_t t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+        BinaryOperation localOp(op);
+        scanChunk(first + begin, first + end, prefixes[t], localOp, inclusive);
+    });
+}
+
+}
+
+/**
+ * @brief Accumulate [#first, #last) into #init with #op using up to #threads threads
+ *
+ * Random access ranges are split into one contiguous chunk per thread. The partial results are then combined
+ * pairwise, in order, so #op must be associative, as required of any operation used in an MPI reduction. The
+ * elements of a chunk are additionally combined in independent lanes which the compiler can vectorize when T
+ * is arithmetic and #op is known to be commutative, which changes the rounding of floating point results.
+ * See: is_commutative_op.
+ *
+ * Ranges are only split when their elements are of type T, so that #op also combines partial results, and when
+ * each thread gets at least MPIRPC_ACCUMULATE_MIN_CHUNK elements. Other ranges, and all ranges when #threads is 1,
+ * are accumulated sequentially with std::accumulate, for which #op need not be associative.
+ */
+template<class InputIt, class T, class BinaryOperation>
+T accumulate(InputIt first, InputIt last, T init, BinaryOperation op, int threads)
+{
+    using splittable = std::integral_constant<bool, std::is_same<typename std::iterator_traits<InputIt>::value_type, T>::value &&
+        std::is_same<typename std::iterator_traits<InputIt>::iterator_category, std::random_access_iterator_tag>::value>;
+    return detail::accumulate(first, last, init, op, threads, splittable());
+}
+
+/**
+ * @brief Replace each element of [#first, #last) with the combination under #op of #init and the elements up to and
+ * including it, using up to #threads threads
+ *
+ * The totals of all but the last chunk are computed in parallel as in accumulate() and scanned. Each chunk is then
+ * scanned in parallel, starting from the total of the chunks before it. #op must be associative.
+ */
+template<class RandomIt, class T, class BinaryOperation>
+void inclusiveScan(RandomIt first, RandomIt last, T init, BinaryOperation op, int threads)
+{
+    detail::scan(first, last, init, op, threads, true);
+}
+
+/**
+ * @brief Replace each element of [#first, #last) with the combination under #op of #init and the elements before it,
+ * using up to #threads threads
+ * @see inclusiveScan()
+ */
+template<class RandomIt, class T, class BinaryOperation>
+void exclusiveScan(RandomIt first, RandomIt last, T init, BinaryOperation op, int threads)
+{
+    detail::scan(first, last, init, op, threads, false);
+}
+
+}
+
+#endif // ACCUMULATE_HPP
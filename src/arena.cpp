@@ -0,0 +1,136 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mpirpc {
+
+static thread_local ArgumentArena* currentArena = nullptr;
+
+ArgumentArena::Scope::Scope(ArgumentArena& arena)
+    : m_arena(arena), m_previous(currentArena), m_mark(arena.mark())
+{
+    currentArena = &arena;
+}
+
+ArgumentArena::Scope::~Scope()
+{
+    m_arena.release(m_mark);
+    currentArena = m_previous;
+}
+
+ArgumentArena::Suspend::Suspend()
+    : m_previous(currentArena)
+{
+    currentArena = nullptr;
+}
+
+ArgumentArena::Suspend::~Suspend()
+{
+    currentArena = m_previous;
+}
+
+ArgumentArena::ArgumentArena(std::size_t blockSize)
+    : m_blockSize(blockSize), m_block(0), m_offset(0), m_allocations(0)
+{
+}
+
+ArgumentArena::~ArgumentArena()
+{
+    release(Mark{0, 0, 0});
+}
+
+ArgumentArena* ArgumentArena::current()
+{
+    return currentArena;
+}
+
+void* ArgumentArena::allocate(std::size_t bytes, std::size_t alignment)
+{
+    ++m_allocations;
+    while (m_block < m_blocks.size()) {
+        if (void* p = bump(bytes, alignment))
+            return p;
+        if (m_block + 1 == m_blocks.size())
+            break;
+        ++m_block;
+        m_offset = 0;
+    }
+    //Blocks are allocated with the alignment of new, so only larger alignments need extra room
+    std::size_t size = std::max(m_blockSize, bytes + (alignment > alignof(std::max_align_t) ? alignment : 0));
+    m_block = m_blocks.empty() ? 0 : m_block + 1;
+    m_blocks.insert(m_blocks.begin() + m_block, Block{std::unique_ptr<char[]>(new char[size]), size});
+    m_offset = 0;
+    return bump(bytes, alignment);
+}
+
+void* ArgumentArena::bump(std::size_t bytes, std::size_t alignment)
+{
+    Block& block = m_blocks[m_block];
+    std::uintptr_t start = reinterpret_cast<std::uintptr_t>(block.data.get());
+    std::size_t offset = (start + m_offset + alignment - 1)/alignment*alignment - start;
+    if (offset + bytes > block.size)
+        return nullptr;
+    m_offset = offset + bytes;
+    return block.data.get() + offset;
+}
+
+bool ArgumentArena::owns(const void* p) const
+{
+    const char* c = static_cast<const char*>(p);
+    for (const Block& block : m_blocks) {
+        if (c >= block.data.get() && c < block.data.get() + block.size)
+            return true;
+    }
+    return false;
+}
+
+ArgumentArena::Mark ArgumentArena::mark() const
+{
+    return Mark{m_block, m_offset, m_destructors.size()};
+}
+
+void ArgumentArena::release(const Mark& mark)
+{
+    while (m_destructors.size() > mark.destructors) {
+        const Destructor& d = m_destructors.back();
+        d.destroy(d.object, d.count);
+        m_destructors.pop_back();
+    }
+    m_block = mark.block;
+    m_offset = mark.offset;
+    if (mark.block == 0 && mark.offset == 0 && capacity() > MPIRPC_ARENA_RETAIN_SIZE) {
+        m_blocks.erase(std::remove_if(m_blocks.begin(), m_blocks.end(), [this](const Block& b) {
+            return b.size > m_blockSize;
+        }), m_blocks.end());
+    }
+}
+
+std::size_t ArgumentArena::capacity() const
+{
+    std::size_t size = 0;
+    for (const Block& block : m_blocks)
+        size += block.size;
+    return size;
+}
+
+}
@@ -0,0 +1,240 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#   if __has_include(<memory_resource>)
+#       include <memory_resource>
+#       define MPIRPC_HAS_PMR 1
+#   endif
+#endif
+
+//Bytes per block of the argument arena. Larger allocations get a block of their own.
+#define MPIRPC_ARENA_BLOCK_SIZE (64*1024)
+//Blocks kept once the arena is empty again. Beyond this, blocks larger than the block size are freed.
+#define MPIRPC_ARENA_RETAIN_SIZE (16*1024*1024)
+
+namespace mpirpc {
+
+/**
+ * @brief A bump allocator for the arguments of received invocations
+ *
+ * While a Scope is active, the pointers, C strings and C arrays which operator>> creates for parameters are placed
+ * in the arena instead of being allocated individually. The Manager opens a Scope around each dispatched
+ * invocation. Closing it runs the destructors of the objects created in it and rewinds the arena, so nested
+ * invocations only release their own arguments. The blocks are kept for the next invocation.
+ *
+ * User types can allocate their transient storage from current() too. With C++17 the arena is a
+ * std::pmr::memory_resource, so it can back pmr containers.
+ */
+class ArgumentArena
+#ifdef MPIRPC_HAS_PMR
+    : public std::pmr::memory_resource
+#endif
+{
+public:
+    struct Mark
+    {
+        std::size_t block;
+        std::size_t offset;
+        std::size_t destructors;
+    };
+
+    /**
+     * @brief Makes #arena the current arena of this thread until destroyed, then releases what was allocated
+     */
+    class Scope
+    {
+    public:
+        Scope(ArgumentArena& arena);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    protected:
+        ArgumentArena& m_arena;
+        ArgumentArena* m_previous;
+        Mark m_mark;
+    };
+
+    /**
+     * @brief Makes no arena current until destroyed, so that values which outlive the current invocation, such
+     * as the return values of nested calls, are allocated individually
+     */
+    class Suspend
+    {
+    public:
+        Suspend();
+        ~Suspend();
+
+        Suspend(const Suspend&) = delete;
+        Suspend& operator=(const Suspend&) = delete;
+
+    protected:
+        ArgumentArena* m_previous;
+    };
+
+    ArgumentArena(std::size_t blockSize = MPIRPC_ARENA_BLOCK_SIZE);
+    ~ArgumentArena();
+
+    ArgumentArena(const ArgumentArena&) = delete;
+    ArgumentArena& operator=(const ArgumentArena&) = delete;
+
+    /**
+     * @return The arena of the innermost active Scope on this thread, or nullptr
+     */
+    static ArgumentArena* current();
+
+    void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * @brief Construct a value initialized T in the arena. Its destructor runs when the memory is released.
+     */
+    template<typename T>
+    T* create()
+    {
+        T* t = new (allocate(sizeof(T), alignof(T))) T();
+        addDestructor(t, 1);
+        return t;
+    }
+
+    /**
+     * @brief Construct #n value initialized T in the arena
+     */
+    template<typename T>
+    T* createArray(std::size_t n)
+    {
+        T* t = static_cast<T*>(allocate(n*sizeof(T), alignof(T)));
+        for (std::size_t i = 0; i < n; ++i)
+            new (t + i) T();
+        addDestructor(t, n);
+        return t;
+    }
+
+    /**
+     * @return Whether #p points into the arena's blocks
+     */
+    bool owns(const void* p) const;
+
+    Mark mark() const;
+
+    /**
+     * @brief Destroy the objects created since #mark and reuse their memory
+     */
+    void release(const Mark& mark);
+
+    std::size_t capacity() const;
+    unsigned long long allocations() const { return m_allocations; }
+
+protected:
+#ifdef MPIRPC_HAS_PMR
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override { return allocate(bytes, alignment); }
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+#endif
+
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    struct Destructor
+    {
+        void (*destroy)(void*, std::size_t);
+        void* object;
+        std::size_t count;
+    };
+
+    void* bump(std::size_t bytes, std::size_t alignment);
+
+    template<typename T>
+    static void destroy(void* p, std::size_t n)
+    {
+        for (std::size_t i = n; i > 0; --i)
+            static_cast<T*>(p)[i - 1].~T();
+    }
+
+    template<typename T, typename std::enable_if<std::is_trivially_destructible<T>::value>::type* = nullptr>
+    void addDestructor(T*, std::size_t) {}
+
+    template<typename T, typename std::enable_if<!std::is_trivially_destructible<T>::value>::type* = nullptr>
+    void addDestructor(T* t, std::size_t n)
+    {
+        m_destructors.push_back(Destructor{&destroy<T>, t, n});
+    }
+
+    std::size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    std::size_t m_block;
+    std::size_t m_offset;
+    std::vector<Destructor> m_destructors;
+    unsigned long long m_allocations;
+};
+
+/**
+ * @brief Allocate a parameter being unserialized, from the current ArgumentArena if there is one
+ */
+template<typename T>
+T* newArgument()
+{
+    if (ArgumentArena* arena = ArgumentArena::current())
+        return arena->create<T>();
+    return new T();
+}
+
+template<typename T>
+T* newArgumentArray(std::size_t n)
+{
+    if (ArgumentArena* arena = ArgumentArena::current())
+        return arena->createArray<T>(n);
+    return new T[n]();
+}
+
+/**
+ * @brief Free a parameter allocated with newArgument(). Parameters in the current arena are left to it.
+ */
+template<typename T>
+void deleteArgument(T* p)
+{
+    ArgumentArena* arena = ArgumentArena::current();
+    if (!arena || !arena->owns(p))
+        delete p;
+}
+
+template<typename T>
+void deleteArgumentArray(T* p)
+{
+    ArgumentArena* arena = ArgumentArena::current();
+    if (!arena || !arena->owns(p))
+        delete[] p;
+}
+
+}
+
+#endif // ARENA_HPP
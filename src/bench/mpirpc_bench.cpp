@@ -0,0 +1,320 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Benchmarks of the Manager's invocation paths. Run with at least two ranks:
+ *
+ *   mpirun -np 4 mpirpc_bench [--iterations N] [--max-functions N] [--max-objects N] [--csv FILE] [--json FILE]
+ *
+ * Rank 0 prints one CSV line per measurement and optionally writes the results to FILE as CSV or JSON.
+ */
+
+#include "../manager.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace mpirpc;
+
+namespace {
+
+struct Result
+{
+    std::string benchmark;
+    std::string parameter;
+    double value;
+    std::string unit;
+};
+
+struct Options
+{
+    Options() : iterations(1000), maxFunctions(10000), maxObjects(10000) {}
+
+    int iterations;
+    int maxFunctions;
+    int maxObjects;
+    std::string csv;
+    std::string json;
+};
+
+struct Counter
+{
+    Counter() : value(0) {}
+    int add(int x) { return value += x; }
+    int value;
+};
+
+template<int N>
+int target(int x) { return x + N; }
+
+std::vector<Result> results;
+
+void report(Manager* m, const std::string& benchmark, const std::string& parameter, double value, const std::string& unit)
+{
+    if (m->rank() != 0)
+        return;
+    results.push_back(Result{benchmark, parameter, value, unit});
+    std::cout << benchmark << "," << parameter << "," << value << "," << unit << std::endl;
+}
+
+/*
+ * Round trips of a payload of each size from rank 0 to rank 1 and back
+ */
+void pingPong(Manager* m, const Options& options, FunctionHandle echo)
+{
+    for (std::size_t bytes : {std::size_t(0), std::size_t(64), std::size_t(1024), std::size_t(16*1024), std::size_t(256*1024), std::size_t(1024*1024)}) {
+        int iterations = std::max<int>(10, std::min<std::size_t>(options.iterations, (64*1024*1024)/std::max<std::size_t>(bytes, 1)));
+        std::vector<double> payload(bytes/sizeof(double));
+        if (m->rank() == 0) {
+            m->invokeFunctionR<std::vector<double>>(1, echo, payload);
+            double start = MPI_Wtime();
+            for (int i = 0; i < iterations; ++i)
+                m->invokeFunctionR<std::vector<double>>(1, echo, payload);
+            double elapsed = MPI_Wtime() - start;
+            report(m, "pingpong", std::to_string(bytes), elapsed/iterations*1e6, "us");
+        }
+        m->sync();
+    }
+}
+
+/*
+ * Invocations without return values from rank 0 to rank 1
+ */
+void throughput(Manager* m, const Options& options, FunctionHandle sink, FunctionHandle received)
+{
+    for (std::size_t bytes : {std::size_t(64), std::size_t(4*1024), std::size_t(64*1024)}) {
+        int iterations = std::max<int>(10, std::min<std::size_t>(10*options.iterations, (256*1024*1024)/bytes));
+        std::vector<double> payload(bytes/sizeof(double));
+        if (m->rank() == 0) {
+            double start = MPI_Wtime();
+            for (int i = 0; i < iterations; ++i)
+                m->invokeFunction(1, sink, payload);
+            m->invokeFunctionR<long>(1, received); //Returned once rank 1 has run every invocation
+            double elapsed = MPI_Wtime() - start;
+            report(m, "throughput", std::to_string(bytes), iterations/elapsed, "calls/s");
+            report(m, "throughput", std::to_string(bytes), iterations*bytes/elapsed/1e6, "MB/s");
+        }
+        m->sync();
+    }
+}
+
+/*
+ * Every rank but 0 invokes functions on rank 0
+ */
+void fanIn(Manager* m, const Options& options, FunctionHandle sink)
+{
+    std::vector<double> payload(8);
+    int iterations = 10*options.iterations;
+    MPI_Barrier(m->comm());
+    double start = MPI_Wtime();
+    if (m->rank() != 0) {
+        for (int i = 0; i < iterations; ++i)
+            m->invokeFunction(0, sink, payload);
+    }
+    m->sync();
+    double elapsed = MPI_Wtime() - start;
+    report(m, "fanin", std::to_string(m->numProcs() - 1) + " senders", (m->numProcs() - 1)*double(iterations)/elapsed, "calls/s");
+}
+
+/*
+ * Every rank invokes functions on every other rank
+ */
+void allToAll(Manager* m, const Options& options, FunctionHandle sink)
+{
+    std::vector<double> payload(8);
+    int iterations = options.iterations;
+    MPI_Barrier(m->comm());
+    double start = MPI_Wtime();
+    for (int i = 0; i < iterations; ++i) {
+        for (int rank = 0; rank < m->numProcs(); ++rank) {
+            if (rank != m->rank())
+                m->invokeFunction(rank, sink, payload);
+        }
+    }
+    m->sync();
+    double elapsed = MPI_Wtime() - start;
+    double calls = double(iterations)*m->numProcs()*(m->numProcs() - 1);
+    report(m, "alltoall", std::to_string(m->numProcs()) + " ranks", calls/elapsed, "calls/s");
+}
+
+template<int N>
+void lookupStep(Manager* m, const Options& options, int functions, std::vector<FunctionHandle>& fillers)
+{
+    while (static_cast<int>(fillers.size()) < functions - 1)
+        fillers.push_back(m->registerLambda([](int) {}));
+    //Registered last, so searches by pointer visit every filler first
+    FunctionHandle handle = m->registerFunction<decltype(&target<N>), &target<N>>();
+    int lookups = std::max(10, 100000/functions);
+    double start = MPI_Wtime();
+    FunctionHandle found = 0;
+    for (int i = 0; i < lookups; ++i)
+        found += m->getfunctionHandle(&target<N>);
+    double scan = (MPI_Wtime() - start)/lookups;
+    start = MPI_Wtime();
+    for (int i = 0; i < lookups; ++i)
+        found += m->getFunctionHandle<decltype(&target<N>), &target<N>>();
+    double hash = (MPI_Wtime() - start)/lookups;
+    if (found == 0)
+        std::cerr << "lookup failed" << std::endl;
+    report(m, "lookup_pointer", std::to_string(functions), scan*1e9, "ns");
+    report(m, "lookup_typeid", std::to_string(functions), hash*1e9, "ns");
+    //Rank 1 must have registered the handle before rank 0 invokes it
+    m->sync();
+    if (m->rank() == 0) {
+        double start = MPI_Wtime();
+        for (int i = 0; i < options.iterations; ++i)
+            m->invokeFunctionR<int>(1, handle, i);
+        double byHandle = MPI_Wtime() - start;
+        start = MPI_Wtime();
+        for (int i = 0; i < options.iterations; ++i)
+            m->invokeFunctionR(1, &target<N>, m->getfunctionHandle(&target<N>), i);
+        double byPointer = MPI_Wtime() - start;
+        report(m, "call_handle", std::to_string(functions), options.iterations/byHandle, "calls/s");
+        report(m, "call_pointer", std::to_string(functions), options.iterations/byPointer, "calls/s");
+    }
+    m->sync();
+}
+
+/*
+ * Function handle and function pointer lookups with 10 to 10^4 registered functions
+ */
+void lookup(Manager* m, const Options& options)
+{
+    std::vector<FunctionHandle> fillers;
+    if (options.maxFunctions >= 10)
+        lookupStep<0>(m, options, 10, fillers);
+    if (options.maxFunctions >= 100)
+        lookupStep<1>(m, options, 100, fillers);
+    if (options.maxFunctions >= 1000)
+        lookupStep<2>(m, options, 1000, fillers);
+    if (options.maxFunctions >= 10000)
+        lookupStep<3>(m, options, 10000, fillers);
+}
+
+/*
+ * Member function calls on rank 1 while every rank has registered up to 10^4 objects
+ */
+void memberCalls(Manager* m, const Options& options)
+{
+    m->registerType<Counter>();
+    FunctionHandle add = m->registerFunction<decltype(&Counter::add), &Counter::add>();
+    std::vector<Counter> counters(options.maxObjects);
+    int registered = 0;
+    for (int objects = 10; objects <= options.maxObjects; objects *= 10) {
+        for (; registered < objects; ++registered)
+            m->registerObject(&counters[registered]);
+        m->sync();
+        if (m->rank() == 0) {
+            ObjectWrapperBase* last = nullptr;
+            for (ObjectWrapperBase* a : m->getObjectsOfType<Counter>(1)) {
+                if (!last || a->id() > last->id())
+                    last = a;
+            }
+            double start = MPI_Wtime();
+            for (int i = 0; i < options.iterations; ++i)
+                m->invokeFunctionR(last, &Counter::add, add, 1);
+            double elapsed = MPI_Wtime() - start;
+            report(m, "member_call", std::to_string(objects), options.iterations/elapsed, "calls/s");
+        }
+        m->sync();
+    }
+}
+
+void writeCsv(const std::string& path)
+{
+    std::ofstream out(path);
+    out << "benchmark,parameter,value,unit\n";
+    for (const Result& r : results)
+        out << r.benchmark << "," << r.parameter << "," << r.value << "," << r.unit << "\n";
+}
+
+void writeJson(const std::string& path, int numProcs)
+{
+    std::ofstream out(path);
+    out << "{\"ranks\":" << numProcs << ",\"results\":[";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? "," : "") << "\n{\"benchmark\":\"" << r.benchmark << "\",\"parameter\":\"" << r.parameter
+            << "\",\"value\":" << r.value << ",\"unit\":\"" << r.unit << "\"}";
+    }
+    out << "\n]}\n";
+}
+
+Options parseOptions(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--iterations"))
+            options.iterations = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--max-functions"))
+            options.maxFunctions = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--max-objects"))
+            options.maxObjects = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--csv"))
+            options.csv = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--json"))
+            options.json = argv[i + 1];
+    }
+    return options;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    Options options = parseOptions(argc, argv);
+    Manager* m = new Manager();
+    if (m->numProcs() < 2) {
+        std::cerr << "mpirpc_bench needs at least two ranks" << std::endl;
+        delete m;
+        MPI_Finalize();
+        return 1;
+    }
+
+    long count = 0;
+    FunctionHandle echo = m->registerLambda([](const std::vector<double>& v) { return v; });
+    FunctionHandle sink = m->registerLambda([&count](const std::vector<double>&) { ++count; });
+    FunctionHandle received = m->registerLambda([&count]() { return count; });
+
+    if (m->rank() == 0)
+        std::cout << "benchmark,parameter,value,unit" << std::endl;
+    pingPong(m, options, echo);
+    throughput(m, options, sink, received);
+    fanIn(m, options, sink);
+    allToAll(m, options, sink);
+    lookup(m, options);
+    memberCalls(m, options);
+
+    if (m->rank() == 0) {
+        if (!options.csv.empty())
+            writeCsv(options.csv);
+        if (!options.json.empty())
+            writeJson(options.json, m->numProcs());
+    }
+    m->shutdown();
+    delete m;
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Encode and decode throughput of ParameterStream. Needs no MPI:
+ *
+ *   stream_bench [--time SECONDS] [--csv FILE]
+ *
+ * Each case is encoded into a reused buffer and decoded from it for at least the given time. The output has one
+ * CSV line per case and direction with the operations and bytes per second and the heap allocations per operation.
+ * Cases marked "(arena)" decode inside an ArgumentArena::Scope, as the Manager does for received invocations.
+ */
+
+#include "../parameterstream.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+unsigned long long allocations = 0;
+
+//Out of line, so that GCC does not see the replaced operators pair new with free() and warn (-Wmismatched-new-delete)
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void* countedAlloc(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void countedFree(void* p) noexcept
+{
+    std::free(p);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    countedFree(p);
+}
+
+using namespace mpirpc;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement
+{
+    double opsPerSecond;
+    double bytesPerSecond;
+    double allocationsPerOp;
+};
+
+double minTime = 0.2;
+std::ostringstream csv;
+
+/*
+ * Repeat #op until #minTime has passed. #op returns the number of bytes it encoded or decoded.
+ */
+template<typename Op>
+Measurement measure(Op op)
+{
+    op(); //warm up, e.g. to grow the reused buffer
+    unsigned long long ops = 0;
+    std::size_t bytes = 0;
+    unsigned long long allocationsBefore = allocations;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    do {
+        for (int i = 0; i < 16; ++i) {
+            bytes += op();
+            ++ops;
+        }
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minTime);
+    return Measurement{ops/elapsed, bytes/elapsed, double(allocations - allocationsBefore)/ops};
+}
+
+void report(const std::string& name, std::size_t size, const char* direction, const Measurement& m)
+{
+    std::ostringstream line;
+    line << name << "," << size << "," << direction << "," << m.opsPerSecond << "," << m.bytesPerSecond/1e6 << "," << m.allocationsPerOp << "\n";
+    std::cout << line.str() << std::flush;
+    csv << line.str();
+}
+
+/*
+ * Encode with #encode into a reused buffer and decode that buffer again with #decode, in #arena if it is set
+ */
+template<typename Encode, typename Decode>
+void run(const std::string& name, std::size_t size, Encode encode, Decode decode, ArgumentArena* arena = nullptr)
+{
+    std::vector<char> buffer;
+    report(name, size, "encode", measure([&]() {
+        buffer.clear();
+        ParameterStream stream(&buffer);
+        encode(stream);
+        return buffer.size();
+    }));
+    report(name, size, "decode", measure([&]() {
+        ParameterStream stream(&buffer);
+        if (arena) {
+            ArgumentArena::Scope scope(*arena);
+            decode(stream);
+        } else {
+            decode(stream);
+        }
+        return buffer.size();
+    }));
+}
+
+template<typename T>
+void runValue(const std::string& name, std::size_t size, const T& value)
+{
+    run(name, size, [&](ParameterStream& s) { s << value; }, [](ParameterStream& s) { T t; s >> t; });
+}
+
+template<typename T>
+void runPrimitive(const std::string& name, T value)
+{
+    const std::size_t count = 1024;
+    run(name, count, [&](ParameterStream& s) {
+        for (std::size_t i = 0; i < count; ++i)
+            s << value;
+    }, [&](ParameterStream& s) {
+        T t;
+        for (std::size_t i = 0; i < count; ++i)
+            s >> t;
+    });
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string csvPath;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--time"))
+            minTime = std::atof(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--csv"))
+            csvPath = argv[i + 1];
+    }
+
+    std::cout << "case,size,direction,ops/s,MB/s,allocations/op" << std::endl;
+    csv << "case,size,direction,ops/s,MB/s,allocations/op\n";
+
+    runPrimitive<int32_t>("int32", 42);
+    runPrimitive<uint64_t>("uint64", 42);
+    runPrimitive<double>("double", 4.2);
+    runPrimitive<bool>("bool", true);
+
+    ArgumentArena arena;
+    for (std::size_t size : {std::size_t(8), std::size_t(256), std::size_t(64*1024)}) {
+        runValue("std::string", size, std::string(size, 'x'));
+        std::string s(size - 1, 'x');
+        const char* p = s.c_str();
+        auto encode = [&](ParameterStream& stream) { stream << p; };
+        auto decode = [](ParameterStream& stream) { char* c; stream >> c; deleteArgumentArray(c); };
+        run("char*", size, encode, decode);
+        run("char* (arena)", size, encode, decode, &arena);
+    }
+
+    for (std::size_t size : {std::size_t(16), std::size_t(1024), std::size_t(64*1024)}) {
+        runValue("std::vector<double>", size, std::vector<double>(size, 1.5));
+        runValue("std::vector<int32_t>", size, std::vector<int32_t>(size, 7));
+        std::vector<std::string> strings(size, std::string(16, 's'));
+        if (size <= 1024)
+            runValue("std::vector<std::string>", size, strings);
+        std::vector<double> array(size, 2.5);
+        CArrayWrapper<double> wrapper(array.data(), size);
+        auto encode = [&](ParameterStream& stream) { stream << wrapper; };
+        auto decode = [](ParameterStream& stream) { CArrayWrapper<double> w; stream >> w; deleteArgumentArray(w.data()); };
+        run("CArrayWrapper<double>", size, encode, decode);
+        run("CArrayWrapper<double> (arena)", size, encode, decode, &arena);
+    }
+
+    for (std::size_t size : {std::size_t(16), std::size_t(1024)}) {
+        std::map<int, double> map;
+        for (std::size_t i = 0; i < size; ++i)
+            map[i] = i*0.5;
+        runValue("std::map<int,double>", size, map);
+    }
+
+    {
+        double d = 3.5;
+        std::string str(64, 'p');
+        PointerParameter<double> pd(&d);
+        PointerParameter<std::string> ps(&str);
+        auto decodeDouble = [](ParameterStream& s) { PointerParameter<double> p; s >> p; deleteArgument(p.pointer); };
+        auto decodeString = [](ParameterStream& s) { PointerParameter<std::string> p; s >> p; deleteArgument(p.pointer); };
+        run("PointerParameter<double>", 1, [&](ParameterStream& s) { s << pd; }, decodeDouble);
+        run("PointerParameter<double> (arena)", 1, [&](ParameterStream& s) { s << pd; }, decodeDouble, &arena);
+        run("PointerParameter<std::string>", 64, [&](ParameterStream& s) { s << ps; }, decodeString);
+        run("PointerParameter<std::string> (arena)", 64, [&](ParameterStream& s) { s << ps; }, decodeString, &arena);
+    }
+
+    if (!csvPath.empty()) {
+        std::ofstream out(csvPath);
+        out << csv.str();
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "codec.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_END_LITERALS 8 //matches are not started this close to the end
+
+namespace mpirpc {
+
+static inline uint32_t read32(const unsigned char* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void writeLength(std::vector<char>& out, std::size_t length)
+{
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+static void writeSequence(std::vector<char>& out, const unsigned char* literals, std::size_t literalLength, std::size_t offset, std::size_t matchLength)
+{
+    std::size_t matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    unsigned char token = static_cast<unsigned char>((std::min<std::size_t>(literalLength, 15) << 4) | std::min<std::size_t>(matchCode, 15));
+    out.push_back(static_cast<char>(token));
+    if (literalLength >= 15)
+        writeLength(out, literalLength - 15);
+    out.insert(out.end(), literals, literals + literalLength);
+    if (matchLength == 0)
+        return;
+    uint16_t off = static_cast<uint16_t>(offset);
+    out.insert(out.end(), reinterpret_cast<const char*>(&off), reinterpret_cast<const char*>(&off) + sizeof(off));
+    if (matchCode >= 15)
+        writeLength(out, matchCode - 15);
+}
+
+static inline std::size_t readLength(const unsigned char*& ip, const unsigned char* end)
+{
+    std::size_t length = 0;
+    unsigned char b;
+    do {
+        if (ip == end)
+            throw std::runtime_error("LzCodec: truncated input");
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return length;
+}
+
+LzCodec::LzCodec() : m_table(1 << LZ_HASH_BITS)
+{
+}
+
+void LzCodec::compress(const char* data, std::size_t length, std::vector<char>& out)
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    //Positions are stored +1 so that 0 means empty
+    std::fill(m_table.begin(), m_table.end(), 0);
+    std::size_t anchor = 0;
+    std::size_t ip = 0;
+    while (ip + LZ_END_LITERALS <= length) {
+        uint32_t seq = read32(in + ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        std::size_t ref = m_table[h];
+        m_table[h] = static_cast<uint32_t>(ip + 1);
+        if (ref && ip - (ref - 1) <= LZ_MAX_OFFSET && read32(in + ref - 1) == seq) {
+            std::size_t r = ref - 1;
+            std::size_t matchLength = LZ_MIN_MATCH;
+            while (ip + matchLength < length && in[r + matchLength] == in[ip + matchLength])
+                ++matchLength;
+            writeSequence(out, in + anchor, ip - anchor, ip - r, matchLength);
+            ip += matchLength;
+            anchor = ip;
+        } else {
+            ++ip;
+        }
+    }
+    writeSequence(out, in + anchor, length - anchor, 0, 0);
+}
+
+void LzCodec::decompress(const char* data, std::size_t length, std::vector<char>& out, std::size_t originalLength)
+{
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = ip + length;
+    std::size_t base = out.size();
+    std::size_t op = base;
+    std::size_t limit = base + originalLength;
+    out.resize(limit);
+    while (ip < end) {
+        unsigned char token = *ip++;
+        std::size_t literalLength = token >> 4;
+        if (literalLength == 15)
+            literalLength += readLength(ip, end);
+        if (literalLength > static_cast<std::size_t>(end - ip) || op + literalLength > limit)
+            throw std::runtime_error("LzCodec: corrupt input");
+        std::memcpy(&out[op], ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+        if (ip == end)
+            break;
+        if (end - ip < 2)
+            throw std::runtime_error("LzCodec: truncated input");
+        uint16_t offset;
+        std::memcpy(&offset, ip, sizeof(offset));
+        ip += sizeof(offset);
+        std::size_t matchLength = token & 15;
+        if (matchLength == 15)
+            matchLength += readLength(ip, end);
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - base || op + matchLength > limit)
+            throw std::runtime_error("LzCodec: corrupt input");
+        //Byte by byte, since the match may overlap the bytes it produces
+        char* o = &out[0];
+        for (std::size_t i = 0; i < matchLength; ++i, ++op)
+            o[op] = o[op - offset];
+    }
+    if (op != limit)
+        throw std::runtime_error("LzCodec: length mismatch");
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define MPIRPC_CODEC_LZ 1
+#define MPIRPC_CODEC_THRESHOLD 4096
+
+namespace mpirpc {
+
+/**
+ * @brief Counters showing whether compression with a codec pays off
+ */
+struct CodecStats
+{
+    CodecStats() : compressed(0), skipped(0), decompressed(0), bytesIn(0), bytesOut(0), bytesReceived(0), bytesDecompressed(0),
+        compressTime(0), decompressTime(0) {}
+
+    unsigned long long compressed;        ///< Messages sent compressed
+    unsigned long long skipped;           ///< Messages sent uncompressed because compression did not reduce their size
+    unsigned long long decompressed;      ///< Messages received compressed
+    unsigned long long bytesIn;           ///< Bytes given to compress(), including skipped messages
+    unsigned long long bytesOut;          ///< Bytes sent, including skipped messages
+    unsigned long long bytesReceived;     ///< Bytes of the compressed messages received
+    unsigned long long bytesDecompressed; ///< Bytes of the compressed messages received, once decompressed
+    double compressTime;                  ///< Seconds spent in compress()
+    double decompressTime;                ///< Seconds spent in decompress()
+};
+
+/**
+ * @brief The Codec class
+ *
+ * A byte codec applied to the payload of invocation and return messages after serialization. Each codec
+ * has an id which identifies it on the wire, so the same codecs must be registered on all ranks.
+ */
+class Codec
+{
+public:
+    virtual ~Codec() {}
+
+    virtual uint8_t id() const = 0;
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Compress #length bytes from #data, appending the result to #out.
+     */
+    virtual void compress(const char* data, std::size_t length, std::vector<char>& out) = 0;
+
+    /**
+     * @brief Decompress #length bytes from #data, appending the #originalLength decompressed bytes to #out.
+     */
+    virtual void decompress(const char* data, std::size_t length, std::vector<char>& out, std::size_t originalLength) = 0;
+
+    CodecStats& stats() { return m_stats; }
+    const CodecStats& stats() const { return m_stats; }
+
+protected:
+    CodecStats m_stats;
+};
+
+/**
+ * @brief The LzCodec class
+ *
+ * A fast LZ77 byte codec in the style of LZ4. The output is a series of sequences, each made of a token
+ * byte, literals and a back reference:
+ * [token: literal length << 4 | (match length - 4)][extra literal length][literals][uint16_t offset][extra match length]
+ * Lengths of 15 in the token are extended by following bytes which are added until one is less than 255.
+ * The final sequence has literals only.
+ */
+class LzCodec : public Codec
+{
+public:
+    LzCodec();
+
+    uint8_t id() const override { return MPIRPC_CODEC_LZ; }
+    const char* name() const override { return "lz"; }
+
+    void compress(const char* data, std::size_t length, std::vector<char>& out) override;
+    void decompress(const char* data, std::size_t length, std::vector<char>& out, std::size_t originalLength) override;
+
+protected:
+    std::vector<uint32_t> m_table;
+};
+
+}
+
+#endif // CODEC_HPP
@@ -20,10 +20,15 @@
 #ifndef COMMON_HPP
 #define COMMON_HPP
 
+#include<algorithm>
 #include<cstddef>
+#include<cstring>
 #include<type_traits>
 #include<utility>
 #include<iostream>
+#include<memory>
+#include<string>
+#include<vector>
 
 #ifndef NDEBUG
 #   define ASSERT(condition, message) \
@@ -71,6 +76,18 @@ using FunctionHandle = unsigned long long;
 using TypeId = unsigned long long;
 using ObjectId = unsigned long long;
 
+/**
+ * Marks a trivially copyable struct T as a POD parameter. POD parameters are streamed as raw bytes instead of
+ * field by field and, when invoked through a Manager, arrays of them are sent straight from the caller's memory
+ * using the MPI datatype registered with Manager::registerPodType<T>().
+ *
+ * Specialize to std::true_type, for example with MPIRPC_POD_TYPE(T) at global scope.
+ */
+template<typename T> struct is_pod_parameter : std::false_type {};
+
+#define MPIRPC_POD_TYPE(T) \
+    namespace mpirpc { template<> struct is_pod_parameter<T> : std::true_type {}; }
+
 template<typename T> struct remove_all_const : std::remove_const<T> {};
 
 template<typename T> struct remove_all_const<T*> {
@@ -106,12 +123,124 @@ public:
 
     operator T*() { return m_data; }
     operator T*&() { return m_data; }
-    operator T*&&() { std::cout << "moved pointer" << std::endl; return std::move(m_data); }
+    operator T*&&() { return std::move(m_data); }
 protected:
     T* m_data;
     std::size_t m_size;
 };
 
+/**
+ * @brief A read only array parameter which avoids copying the array out of the receive buffer.
+ *
+ * ArrayView<T> is serialized like a std::vector<T>, so a remote function can take an ArrayView<T> while callers
+ * pass a std::vector<T>. When unserialized, it points at the elements in the stream's buffer if they are there and
+ * aligned for T, and only copies them otherwise, such as when the invocation arrives in several chunks. Received
+ * invocations keep their buffer until the function returns, so the view must not be kept past that, nor be used as
+ * a return type.
+ *
+ * T must be an arithmetic type or a POD parameter. Arrays of POD parameters are sent as attachments, so they are
+ * always received into storage owned by the view.
+ */
+template<typename T>
+class ArrayView
+{
+public:
+    ArrayView(const T* data = nullptr, std::size_t size = 0) : m_data(data), m_size(size) {}
+    ArrayView(const std::vector<T>& vector) : m_data(vector.data()), m_size(vector.size()) {}
+
+    const T* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T& operator[](std::size_t n) const { return m_data[n]; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+    std::vector<T> toVector() const { return std::vector<T>(begin(), end()); }
+
+    /**
+     * @brief Point at a new array of #size elements, owned by this view and its copies, and return it to be filled
+     */
+    T* allocate(std::size_t size)
+    {
+        m_storage = std::make_shared<std::vector<T>>(size);
+        m_data = m_storage->data();
+        m_size = size;
+        return m_storage->data();
+    }
+
+    /**
+     * @return Whether the elements are stored by the view rather than aliasing other memory
+     */
+    bool ownsData() const { return m_storage && m_data == m_storage->data(); }
+
+protected:
+    const T* m_data;
+    std::size_t m_size;
+    std::shared_ptr<std::vector<T>> m_storage;
+};
+
+/**
+ * @brief A read only string parameter which avoids copying the string out of the receive buffer.
+ *
+ * StringView is serialized like a std::string, which callers can pass in its place. Like ArrayView, it points into
+ * the stream's buffer where possible and is not null terminated.
+ */
+class StringView
+{
+public:
+    StringView() : m_data(nullptr), m_size(0) {}
+    StringView(const char* data, std::size_t size) : m_data(data), m_size(size) {}
+    StringView(const char* s) : m_data(s), m_size(std::strlen(s)) {}
+    StringView(const std::string& s) : m_data(s.data()), m_size(s.size()) {}
+
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    char operator[](std::size_t n) const { return m_data[n]; }
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    std::string str() const { return std::string(m_data, m_size); }
+
+    bool operator==(const StringView& other) const
+    {
+        return m_size == other.m_size && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+
+    /**
+     * @brief Point at a copy of #s owned by this view and its copies
+     */
+    void assign(std::string&& s)
+    {
+        m_storage = std::make_shared<std::string>(std::move(s));
+        m_data = m_storage->data();
+        m_size = m_storage->size();
+    }
+
+    bool ownsData() const { return m_storage && m_data == m_storage->data(); }
+
+protected:
+    const char* m_data;
+    std::size_t m_size;
+    std::shared_ptr<std::string> m_storage;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const StringView& s)
+{
+    return out.write(s.data(), s.size());
+}
+
+template<typename T> struct is_view_parameter : std::false_type {};
+template<typename T> struct is_view_parameter<ArrayView<T>> : std::true_type {};
+template<> struct is_view_parameter<StringView> : std::true_type {};
+
+/**
+ * True if a T is passed to a parameter of type FT which is a view of it. Remote calls then serialize the T itself
+ * and local calls construct the view by value, as binding a reference to a converted view would leave it dangling.
+ */
+template<typename FT, typename T, typename V = typename std::decay<FT>::type>
+struct is_view_conversion
+    : std::integral_constant<bool, is_view_parameter<V>::value && !std::is_same<V, typename std::decay<T>::type>::value> {};
+
 /*template<typename T, std::size_t N>
 struct CArrayWrapper
 {
@@ -154,20 +283,26 @@ struct forward_parameter_type_helper<FArg, CArrayWrapper<T>>
     using type = typename std::conditional<std::is_same<base_type, FArg>::value,base_type,typename std::conditional<std::is_same<base_type&,FArg>::value,base_type&,base_type&&>::type>::type;
 };
 
-template<typename FT, typename T>
+template<typename FT, typename T, typename std::enable_if<!is_view_conversion<FT,T>::value>::type* = nullptr>
 inline constexpr auto forward_parameter_type(typename std::remove_reference<T>::type& t) noexcept
     -> typename forward_parameter_type_helper<FT, T>::type&&
 {
     return static_cast<typename forward_parameter_type_helper<FT, T>::type&&>(t);
 }
 
-template<typename FT, typename T>
+template<typename FT, typename T, typename std::enable_if<!is_view_conversion<FT,T>::value>::type* = nullptr>
 inline constexpr auto forward_parameter_type(typename std::remove_reference<T>::type&& t) noexcept
     -> typename forward_parameter_type_helper<FT, T>::type&&
 {
     return static_cast<typename forward_parameter_type_helper<FT, T>::type&&>(t);
 }
 
+template<typename FT, typename T, typename std::enable_if<is_view_conversion<FT,T>::value>::type* = nullptr>
+inline constexpr const typename std::remove_reference<T>::type& forward_parameter_type(const typename std::remove_reference<T>::type& t) noexcept
+{
+    return t;
+}
+
 /*template<typename FArg, typename Arg, typename T = typename std::remove_reference<FArg>::type>
 struct forward_parameter_cleanup_helper
 {
@@ -214,18 +349,27 @@ inline constexpr auto forward_parameter_cleanup(typename std::remove_reference<T
     return static_cast<typename forward_parameter_type_helper<FT, T>::type>(t);
 }
 
-template<typename FT, typename T, typename R = typename remove_all_const<FT>::type>
+template<typename FT, typename T, typename R = typename remove_all_const<FT>::type,
+         typename std::enable_if<!is_view_conversion<FT,T>::value>::type* = nullptr>
 inline constexpr R&& forward_parameter_type_local(typename std::remove_reference<T>::type& t) noexcept
 {
     return static_cast<R&&>(t);
 }
 
-template<typename FT, typename T, typename R = typename remove_all_const<FT>::type>
+template<typename FT, typename T, typename R = typename remove_all_const<FT>::type,
+         typename std::enable_if<!is_view_conversion<FT,T>::value>::type* = nullptr>
 inline constexpr R&& forward_parameter_type_local(typename std::remove_reference<T>::type&& t) noexcept
 {
     return static_cast<R&&>(t);
 }
 
+template<typename FT, typename T, typename V = typename std::decay<FT>::type,
+         typename std::enable_if<is_view_conversion<FT,T>::value>::type* = nullptr>
+inline V forward_parameter_type_local(const typename std::remove_reference<T>::type& t)
+{
+    return V(t);
+}
+
 }
 
 #endif // COMMON_HPP
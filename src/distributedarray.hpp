@@ -0,0 +1,229 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DISTRIBUTEDARRAY_HPP
+#define DISTRIBUTEDARRAY_HPP
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+namespace mpirpc {
+
+/**
+ * @brief An array of #size elements block-distributed over a communicator and accessed with one-sided MPI operations
+ *
+ * Rank r owns the elements [r*blockSize(), (r+1)*blockSize()), stored in an MPI window allocated with
+ * MPI_Win_allocate. Elements are read and written with MPI_Get and MPI_Put under a shared lock held for the
+ * lifetime of the array, so remote accesses do not involve the owner's CPU.
+ *
+ * get() and put() complete before returning. iget() and iput() only start the transfer, and the buffers passed
+ * to them must remain valid until the next sync(). Puts are visible to the owner once it has synchronized with the
+ * writer after the writer's sync(), for example with barrier().
+ *
+ * The local block can be accessed directly through begin() and end().
+ *
+ * Constructing and destroying a DistributedArray are collective over the communicator.
+ * See: Manager::distributedArray()
+ */
+template<typename T>
+class DistributedArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "DistributedArray: T must be trivially copyable");
+
+public:
+    /**
+     * @param type The MPI datatype of T
+     */
+    DistributedArray(MPI_Comm comm, std::size_t size, MPI_Datatype type)
+        : m_comm(comm), m_type(type), m_size(size)
+    {
+        MPI_Comm_rank(m_comm, &m_rank);
+        MPI_Comm_size(m_comm, &m_numProcs);
+        m_blockSize = (m_size + m_numProcs - 1)/m_numProcs;
+        m_localOffset = std::min(m_size, m_rank*m_blockSize);
+        m_localSize = std::min(m_size - m_localOffset, m_blockSize);
+        MPI_Win_allocate(m_localSize*sizeof(T), sizeof(T), MPI_INFO_NULL, m_comm, &m_base, &m_win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, m_win);
+    }
+
+    DistributedArray(const DistributedArray&) = delete;
+    DistributedArray& operator=(const DistributedArray&) = delete;
+
+    ~DistributedArray()
+    {
+        MPI_Win_unlock_all(m_win);
+        MPI_Win_free(&m_win);
+    }
+
+    std::size_t size() const { return m_size; }
+
+    /**
+     * @brief The number of elements owned by each rank, except possibly the last ranks
+     */
+    std::size_t blockSize() const { return m_blockSize; }
+
+    /**
+     * @brief The rank which owns element #index
+     */
+    int owner(std::size_t index) const { return index/m_blockSize; }
+
+    /**
+     * @brief The global index of the first element owned by this rank
+     */
+    std::size_t localOffset() const { return m_localOffset; }
+    std::size_t localSize() const { return m_localSize; }
+
+    T* begin() { return m_base; }
+    T* end() { return m_base + m_localSize; }
+    const T* begin() const { return m_base; }
+    const T* end() const { return m_base + m_localSize; }
+
+    /**
+     * @brief Read element #index
+     * @throws std::out_of_range if #index is not less than size()
+     */
+    T get(std::size_t index)
+    {
+        T value;
+        get(index, 1, &value);
+        return value;
+    }
+
+    /**
+     * @brief Write #value to element #index
+     * @throws std::out_of_range if #index is not less than size()
+     */
+    void put(std::size_t index, const T& value)
+    {
+        put(index, 1, &value);
+    }
+
+    /**
+     * @brief Read the #count elements starting at #first into #out
+     * @throws std::out_of_range if the range extends past size()
+     */
+    void get(std::size_t first, std::size_t count, T* out)
+    {
+        iget(first, count, out);
+        complete(first, count);
+    }
+
+    /**
+     * @brief Write the #count elements at #in to the elements starting at #first
+     * @throws std::out_of_range if the range extends past size()
+     */
+    void put(std::size_t first, std::size_t count, const T* in)
+    {
+        iput(first, count, in);
+        complete(first, count);
+    }
+
+    /**
+     * @brief Start reading the #count elements starting at #first into #out. The data is valid after sync().
+     * @throws std::out_of_range if the range extends past size()
+     */
+    void iget(std::size_t first, std::size_t count, T* out)
+    {
+        forEachBlock(first, count, [&](int rank, MPI_Aint disp, std::size_t offset, std::size_t n) {
+            MPI_Get(out + offset, n, m_type, rank, disp, n, m_type, m_win);
+        });
+    }
+
+    /**
+     * @brief Start writing the #count elements at #in to the elements starting at #first. #in must not be
+     * modified before sync().
+     * @throws std::out_of_range if the range extends past size()
+     */
+    void iput(std::size_t first, std::size_t count, const T* in)
+    {
+        forEachBlock(first, count, [&](int rank, MPI_Aint disp, std::size_t offset, std::size_t n) {
+            MPI_Put(in + offset, n, m_type, rank, disp, n, m_type, m_win);
+        });
+    }
+
+    /**
+     * @brief Complete all operations started by this rank and make the local block consistent with the
+     * window, so remote puts which have been synchronized with are visible through begin().
+     */
+    void sync()
+    {
+        MPI_Win_flush_all(m_win);
+        MPI_Win_sync(m_win);
+    }
+
+    /**
+     * @brief sync() on every rank, so that all puts are visible everywhere. Collective over the communicator.
+     *
+     * Invocations are not serviced while waiting. If other ranks may still be invoking functions on this
+     * rank, call sync(), Manager::sync() and sync() instead.
+     */
+    void barrier()
+    {
+        sync();
+        MPI_Barrier(m_comm);
+        MPI_Win_sync(m_win);
+    }
+
+protected:
+    template<typename F>
+    void forEachBlock(std::size_t first, std::size_t count, F f)
+    {
+        if (first > m_size || count > m_size - first)
+            throw std::out_of_range("DistributedArray: range out of bounds");
+        std::size_t offset = 0;
+        while (offset < count) {
+            std::size_t index = first + offset;
+            int rank = owner(index);
+            std::size_t disp = index - rank*m_blockSize;
+            std::size_t n = std::min(count - offset, m_blockSize - disp);
+            f(rank, static_cast<MPI_Aint>(disp), offset, n);
+            offset += n;
+        }
+    }
+
+    /**
+     * Wait for the operations on the owners of the #count elements starting at #first
+     */
+    void complete(std::size_t first, std::size_t count)
+    {
+        if (count == 0)
+            return;
+        int last = owner(first + count - 1);
+        for (int rank = owner(first); rank <= last; ++rank)
+            MPI_Win_flush(rank, m_win);
+    }
+
+    MPI_Comm m_comm;
+    MPI_Win m_win;
+    MPI_Datatype m_type;
+    T* m_base;
+    std::size_t m_size;
+    std::size_t m_blockSize;
+    std::size_t m_localOffset;
+    std::size_t m_localSize;
+    int m_rank;
+    int m_numProcs;
+};
+
+}
+
+#endif // DISTRIBUTEDARRAY_HPP
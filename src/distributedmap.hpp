@@ -0,0 +1,363 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DISTRIBUTEDMAP_HPP
+#define DISTRIBUTEDMAP_HPP
+
+#include "manager.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+//Operations buffered for one owner before they are sent
+#define MPIRPC_MAP_BATCH_SIZE 1024
+
+namespace mpirpc {
+
+/**
+ * @brief The result of a DistributedMap::lookup()
+ *
+ * Waiting for the result sends any buffered operations and makes progress through the Manager, so invocations from
+ * other ranks continue to be serviced.
+ */
+template<typename V>
+class LookupFuture
+{
+public:
+    using Progress = std::function<void()>;
+
+    struct State
+    {
+        State() : ready(false), found(false) {}
+        bool ready;
+        bool found;
+        V value;
+    };
+
+    LookupFuture() {}
+    LookupFuture(std::shared_ptr<State> state, Progress progress) : m_state(state), m_progress(progress) {}
+
+    /**
+     * @brief False if default constructed or get() has been called
+     */
+    bool valid() const { return static_cast<bool>(m_state); }
+
+    /**
+     * @brief Test for completion without blocking
+     */
+    bool ready() const { return m_state->ready; }
+
+    /**
+     * @brief Make progress until the owner has replied
+     * @throws ShutdownException if the Manager is shut down first
+     */
+    void wait() const
+    {
+        while (!m_state->ready)
+            m_progress();
+    }
+
+    /**
+     * @brief Wait for the reply and check if the key was present
+     */
+    bool found() const
+    {
+        wait();
+        return m_state->found;
+    }
+
+    /**
+     * @brief Wait for and take the value
+     * @throws std::out_of_range if the key was not present
+     */
+    V get()
+    {
+        wait();
+        if (!m_state->found)
+            throw std::out_of_range("DistributedMap: key not found");
+        V value = std::move(m_state->value);
+        m_state.reset();
+        return value;
+    }
+
+protected:
+    std::shared_ptr<State> m_state;
+    Progress m_progress;
+};
+
+/**
+ * @brief A hash map partitioned over the ranks of a Manager
+ *
+ * Each key is owned by one rank, chosen by hashing the key. Operations on keys owned by this rank are applied
+ * immediately. Operations on other keys are buffered per owner and sent as a single invocation when #batchSize
+ * operations are buffered for that owner, on flush(), or when a lookup is waited for. Each owner applies a batch
+ * in order and sends the results of its lookups back in one reply, so operations from one rank are applied in the
+ * order in which they were issued.
+ *
+ * update() merges a value into the existing one with the combiner. Updates of a key which are buffered one after the
+ * other are merged before sending, so repeatedly updated keys cost one operation per batch.
+ *
+ * Constructing a DistributedMap registers functions with the Manager, so maps must be constructed in the same order
+ * on every rank and must outlive any traffic for them.
+ */
+template<typename K, typename V, class Hash = std::hash<K>>
+class DistributedMap
+{
+public:
+    using Combiner = std::function<V(const V&, const V&)>;
+
+    /**
+     * @param combiner Merges an update into the existing value. By default an update replaces the value.
+     * @param batchSize The number of operations buffered for an owner before they are sent
+     */
+    DistributedMap(Manager* manager, Combiner combiner = Combiner(), std::size_t batchSize = MPIRPC_MAP_BATCH_SIZE)
+        : m_manager(manager), m_combiner(combiner), m_batchSize(batchSize), m_buffers(manager->numProcs()), m_nextBatch(0)
+    {
+        if (!m_combiner)
+            m_combiner = [](const V&, const V& v) { return v; };
+        m_applyHandle = m_manager->registerLambda([this](int source, uint64_t batch, const std::vector<uint8_t>& ops,
+                                                         const std::vector<K>& keys, const std::vector<V>& values) {
+            applyBatch(source, batch, ops, keys, values);
+        });
+        m_replyHandle = m_manager->registerLambda([this](uint64_t batch, const std::vector<uint8_t>& found, const std::vector<V>& values) {
+            receiveReply(batch, found, values);
+        });
+        //Batches are applied in the order they were sent, whatever their size
+        m_manager->setPriority(m_applyHandle, Priority::Normal);
+        m_manager->setPriority(m_replyHandle, Priority::Normal);
+    }
+
+    DistributedMap(const DistributedMap&) = delete;
+    DistributedMap& operator=(const DistributedMap&) = delete;
+
+    /**
+     * @brief The rank which owns #key
+     */
+    int owner(const K& key) const
+    {
+        uint64_t h = m_hash(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h % m_buffers.size();
+    }
+
+    /**
+     * @brief Set the value of #key, replacing any existing value
+     */
+    void insert(const K& key, const V& value)
+    {
+        int rank = owner(key);
+        if (rank == m_manager->rank()) {
+            m_local[key] = value;
+            return;
+        }
+        Buffer& buffer = m_buffers[rank];
+        buffer.pendingUpdates.erase(key);
+        buffer.push(Insert, key, value);
+        sendIfFull(rank);
+    }
+
+    /**
+     * @brief Merge #value into the value of #key with the combiner, or insert it if #key is not present
+     */
+    void update(const K& key, const V& value)
+    {
+        int rank = owner(key);
+        if (rank == m_manager->rank()) {
+            applyUpdate(key, value);
+            return;
+        }
+        Buffer& buffer = m_buffers[rank];
+        auto pending = buffer.pendingUpdates.find(key);
+        if (pending != buffer.pendingUpdates.end()) {
+            buffer.values[pending->second] = m_combiner(buffer.values[pending->second], value);
+            return;
+        }
+        buffer.pendingUpdates[key] = buffer.keys.size();
+        buffer.push(Update, key, value);
+        sendIfFull(rank);
+    }
+
+    /**
+     * @brief Look up the value of #key
+     */
+    LookupFuture<V> lookup(const K& key)
+    {
+        auto state = std::make_shared<typename LookupFuture<V>::State>();
+        int rank = owner(key);
+        if (rank == m_manager->rank()) {
+            auto it = m_local.find(key);
+            state->ready = true;
+            state->found = it != m_local.end();
+            if (state->found)
+                state->value = it->second;
+        } else {
+            Buffer& buffer = m_buffers[rank];
+            buffer.pendingUpdates.erase(key);
+            buffer.push(Lookup, key, V());
+            buffer.lookups.push_back(state);
+            sendIfFull(rank);
+        }
+        return LookupFuture<V>(state, [this]() { progress(); });
+    }
+
+    /**
+     * @brief Send the buffered operations for every owner
+     */
+    void flush()
+    {
+        for (std::size_t rank = 0; rank < m_buffers.size(); ++rank)
+            send(rank);
+    }
+
+    /**
+     * @brief Flush and wait until the operations of every rank have been applied. Collective over the Manager's
+     * communicator. Lookups may still be waiting for their replies.
+     */
+    void sync()
+    {
+        flush();
+        m_manager->sync();
+    }
+
+    /**
+     * @brief The entries owned by this rank
+     */
+    const std::unordered_map<K, V, Hash>& local() const { return m_local; }
+
+protected:
+    enum Operation : uint8_t
+    {
+        Insert,
+        Update,
+        Lookup
+    };
+
+    struct Buffer
+    {
+        void push(Operation op, const K& key, const V& value)
+        {
+            ops.push_back(op);
+            keys.push_back(key);
+            values.push_back(value);
+        }
+
+        std::vector<uint8_t> ops;
+        std::vector<K> keys;
+        std::vector<V> values;
+        std::vector<std::shared_ptr<typename LookupFuture<V>::State>> lookups;
+        std::unordered_map<K, std::size_t, Hash> pendingUpdates; //The index of the update of each key which can still be merged into
+    };
+
+    void sendIfFull(int rank)
+    {
+        if (m_buffers[rank].ops.size() >= m_batchSize)
+            send(rank);
+    }
+
+    void send(int rank)
+    {
+        if (m_buffers[rank].ops.empty())
+            return;
+        //Sending may run other invocations, which can buffer new operations for the same owner
+        Buffer out = std::move(m_buffers[rank]);
+        m_buffers[rank] = Buffer();
+        uint64_t batch = 0;
+        if (!out.lookups.empty()) {
+            batch = ++m_nextBatch;
+            m_pendingLookups[batch] = std::move(out.lookups);
+        }
+        m_manager->invokeFunction(rank, m_applyHandle, m_manager->rank(), batch, out.ops, out.keys, out.values);
+    }
+
+    void progress()
+    {
+        flush();
+        if (!m_manager->checkMessages())
+            throw ShutdownException();
+    }
+
+    void applyUpdate(const K& key, const V& value)
+    {
+        auto it = m_local.find(key);
+        if (it == m_local.end())
+            m_local.emplace(key, value);
+        else
+            it->second = m_combiner(it->second, value);
+    }
+
+    void applyBatch(int source, uint64_t batch, const std::vector<uint8_t>& ops, const std::vector<K>& keys, const std::vector<V>& values)
+    {
+        std::vector<uint8_t> found;
+        std::vector<V> results;
+        for (std::size_t i = 0; i < ops.size(); ++i) {
+            switch (ops[i]) {
+            case Insert:
+                m_local[keys[i]] = values[i];
+                break;
+            case Update:
+                applyUpdate(keys[i], values[i]);
+                break;
+            case Lookup: {
+                auto it = m_local.find(keys[i]);
+                found.push_back(it != m_local.end());
+                results.push_back(it != m_local.end() ? it->second : V());
+                break;
+            }
+            }
+        }
+        if (batch)
+            m_manager->invokeFunction(source, m_replyHandle, batch, found, results);
+    }
+
+    void receiveReply(uint64_t batch, const std::vector<uint8_t>& found, const std::vector<V>& values)
+    {
+        auto it = m_pendingLookups.find(batch);
+        if (it == m_pendingLookups.end())
+            return;
+        for (std::size_t i = 0; i < it->second.size(); ++i) {
+            auto& state = it->second[i];
+            state->found = found[i];
+            if (state->found)
+                state->value = values[i];
+            state->ready = true;
+        }
+        m_pendingLookups.erase(it);
+    }
+
+    Manager* m_manager;
+    Combiner m_combiner;
+    Hash m_hash;
+    std::size_t m_batchSize;
+    std::unordered_map<K, V, Hash> m_local;
+    std::vector<Buffer> m_buffers;
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<typename LookupFuture<V>::State>>> m_pendingLookups;
+    uint64_t m_nextBatch;
+    FunctionHandle m_applyHandle;
+    FunctionHandle m_replyHandle;
+};
+
+}
+
+#endif // DISTRIBUTEDMAP_HPP
@@ -0,0 +1,77 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "invocationheader.hpp"
+
+namespace mpirpc {
+
+constexpr std::size_t InvocationHeader::maxSize;
+
+void writeVarint(ParameterStream& out, uint64_t value)
+{
+    char buffer[MPIRPC_VARINT_MAX_SIZE];
+    std::size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = static_cast<char>(value);
+    out.writeBytes(buffer, length);
+}
+
+uint64_t readVarint(ParameterStream& in)
+{
+    uint64_t value = 0;
+    uint8_t byte;
+    int shift = 0;
+    do {
+        in >> byte;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 64);
+    return value;
+}
+
+ParameterStream& operator<<(ParameterStream& out, const InvocationHeader& header)
+{
+    out << static_cast<uint8_t>(header.flags | (MPIRPC_HEADER_VERSION << MPIRPC_HEADER_VERSION_SHIFT));
+    writeVarint(out, header.functionHandle);
+    if (header.flags & MPIRPC_FLAG_MEMBER) {
+        writeVarint(out, header.typeId);
+        writeVarint(out, header.objectId);
+    }
+    return out;
+}
+
+ParameterStream& operator>>(ParameterStream& in, InvocationHeader& header)
+{
+    uint8_t flags;
+    in >> flags;
+    if ((flags >> MPIRPC_HEADER_VERSION_SHIFT) != MPIRPC_HEADER_VERSION)
+        throw UnsupportedHeaderVersionException();
+    header.flags = flags & ((1 << MPIRPC_HEADER_VERSION_SHIFT) - 1);
+    header.functionHandle = readVarint(in);
+    if (header.flags & MPIRPC_FLAG_MEMBER) {
+        header.typeId = readVarint(in);
+        header.objectId = readVarint(in);
+    }
+    return in;
+}
+
+}
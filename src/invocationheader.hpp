@@ -0,0 +1,85 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef INVOCATIONHEADER_HPP
+#define INVOCATIONHEADER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include "common.hpp"
+#include "parameterstream.hpp"
+
+//Bits of the flags byte in invocation and return headers
+#define MPIRPC_FLAG_RETURN 0x01
+#define MPIRPC_FLAG_STREAMED 0x02
+#define MPIRPC_FLAG_COMPRESSED 0x04
+#define MPIRPC_FLAG_MEMBER 0x08
+#define MPIRPC_FLAG_CREDIT 0x10 //The sender is owed a flow control credit once the invocation has run
+
+#define MPIRPC_HEADER_VERSION 1
+#define MPIRPC_HEADER_VERSION_SHIFT 6
+#define MPIRPC_VARINT_MAX_SIZE 10
+
+namespace mpirpc {
+
+/**
+ * @brief The InvocationHeader struct
+ *
+ * The header at the start of every invocation message:
+ * [uint8_t flags][varint function handle] followed, when MPIRPC_FLAG_MEMBER is set, by [varint type id][varint object id].
+ *
+ * The flags byte always comes first so that it can be inspected and patched without decoding the rest of the
+ * header. Its top two bits hold MPIRPC_HEADER_VERSION. IDs are unsigned LEB128 varints, so the small IDs assigned
+ * by the Manager take a single byte each. As the header describes itself, several invocations can be packed
+ * one after the other in a single message.
+ */
+struct InvocationHeader
+{
+    InvocationHeader() : flags(0), functionHandle(0), typeId(0), objectId(0) {}
+
+    static constexpr std::size_t maxSize = 1 + 3*MPIRPC_VARINT_MAX_SIZE;
+
+    uint8_t flags; ///< MPIRPC_FLAG_* bits, without the version
+    FunctionHandle functionHandle;
+    TypeId typeId;
+    ObjectId objectId;
+};
+
+struct UnsupportedHeaderVersionException : std::exception
+{
+    const char* what() const noexcept override
+    {
+        return "Unsupported invocation header version\n";
+    }
+};
+
+void writeVarint(ParameterStream& out, uint64_t value);
+uint64_t readVarint(ParameterStream& in);
+
+ParameterStream& operator<<(ParameterStream& out, const InvocationHeader& header);
+
+/**
+ * Throws UnsupportedHeaderVersionException if the header was written with a different version.
+ */
+ParameterStream& operator>>(ParameterStream& in, InvocationHeader& header);
+
+}
+
+#endif // INVOCATIONHEADER_HPP
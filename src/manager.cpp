@@ -20,13 +20,18 @@
 #include "manager.hpp"
 #include "common.hpp"
 #include <mpi.h>
+#include <chrono>
 
 #define BUFFER_SIZE 10*1024*1024
 
 namespace mpirpc
 {
 
-Manager::Manager(MPI_Comm comm) : m_comm(comm), m_nextTypeId(0), m_count(0), m_shutdown(false)
+Manager::Manager(MPI_Comm comm, Transport transport)
+    : m_comm(comm), m_nextTypeId(0), m_count(0), m_shutdown(false), m_rmaQueue(nullptr),
+      m_callDepth(0), m_streamThreshold(0), m_streamChunkSize(MPIRPC_STREAM_CHUNK_SIZE), m_streamWindow(MPIRPC_STREAM_WINDOW),
+      m_bulkThreshold(0), m_flowMessages(0), m_flowBytes(0), m_reduceSegmentSize(0), m_reduceWindow(MPIRPC_REDUCE_WINDOW), m_accumulateThreads(1),
+      m_returnsOwed(0), m_compressionCodec(nullptr), m_compressionThreshold(0)
 {
     MPI_Comm_rank(m_comm, &m_rank);
     MPI_Comm_size(comm, &m_numProcs);
@@ -41,11 +46,22 @@ Manager::Manager(MPI_Comm comm) : m_comm(comm), m_nextTypeId(0), m_count(0), m_s
     MPI_Type_commit(&MpiObjectInfo);
     void *buffer = malloc(BUFFER_SIZE);
     MPI_Buffer_attach(buffer, BUFFER_SIZE);
+    if (transport == Transport::OneSided)
+        m_rmaQueue = new RmaQueue(m_comm);
+    MPI_Comm_dup(m_comm, &m_streamComm); //keeps stream chunks out of the way of the main message loop
+    MPI_Comm_dup(m_comm, &m_laneComms[static_cast<int>(Priority::High)]);
+    m_laneComms[static_cast<int>(Priority::Normal)] = m_comm;
+    MPI_Comm_dup(m_comm, &m_laneComms[static_cast<int>(Priority::Bulk)]);
+    m_laneBudgets[static_cast<int>(Priority::High)] = 0;
+    m_laneBudgets[static_cast<int>(Priority::Normal)] = 0;
+    m_laneBudgets[static_cast<int>(Priority::Bulk)] = MPIRPC_BULK_LANE_BUDGET;
+    registerCodec(new LzCodec());
     MPI_Barrier(m_comm);
 }
 
 Manager::~Manager()
 {
+    writeTrace();
     MPI_Type_free(&MpiObjectInfo);
     for (auto i : m_mpiMessages)
         delete i.second;
@@ -55,6 +71,164 @@ Manager::~Manager()
         delete i.second;
     for (auto i : m_registeredObjects)
         delete i;
+    for (auto i : m_replicatedObjects)
+        delete i;
+    delete m_rmaQueue;
+    MPI_Comm_free(&m_streamComm);
+    MPI_Comm_free(&m_laneComms[static_cast<int>(Priority::High)]);
+    MPI_Comm_free(&m_laneComms[static_cast<int>(Priority::Bulk)]);
+    for (auto i : m_codecs)
+        delete i.second;
+    for (auto i : m_podTypes)
+        MPI_Type_free(&i.second);
+    //Waits for buffered sends, and lets a later Manager attach its own buffer
+    void *buffer;
+    int size;
+    MPI_Buffer_detach(&buffer, &size);
+    free(buffer);
+}
+
+MPI_Datatype Manager::podType(std::type_index type) const
+{
+    auto it = m_podTypes.find(type);
+    if (it == m_podTypes.end())
+        throw UnregisteredPodTypeException();
+    return it->second;
+}
+
+void Manager::beginAttachments(ParameterStream& stream, int rank, std::vector<MPI_Request>& requests)
+{
+    stream.setAttachmentSink([this, rank, &requests](const void* data, std::size_t count, std::type_index type) {
+        MPI_Request req;
+        MPI_Issend(const_cast<void*>(data), count, podType(type), rank, MPIRPC_TAG_ATTACHMENT, m_streamComm, &req);
+        requests.push_back(req);
+    });
+}
+
+void Manager::waitForAttachments(std::vector<MPI_Request>& requests)
+{
+    int done = requests.empty();
+    while (!done) {
+        MPI_Testall(requests.size(), requests.data(), &done, MPI_STATUSES_IGNORE);
+        if (!done && !checkMessages()) {
+            for (MPI_Request& req : requests) {
+                if (req != MPI_REQUEST_NULL) {
+                    MPI_Cancel(&req);
+                    MPI_Request_free(&req);
+                }
+            }
+            break;
+        }
+    }
+    requests.clear();
+}
+
+void Manager::registerCodec(Codec* codec)
+{
+    Codec*& c = m_codecs[codec->id()];
+    if (c == codec)
+        return;
+    if (c && c == m_compressionCodec)
+        m_compressionCodec = codec;
+    delete c;
+    c = codec;
+}
+
+void Manager::setCompression(uint8_t codecId, std::size_t threshold)
+{
+    m_compressionCodec = codecId ? m_codecs.at(codecId) : nullptr;
+    m_compressionThreshold = threshold;
+}
+
+void Manager::setReduceSegmentation(std::size_t segmentSize, int window)
+{
+    m_reduceSegmentSize = segmentSize;
+    m_reduceWindow = window;
+}
+
+void Manager::setAccumulateThreads(int threads)
+{
+    m_accumulateThreads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::vector<int> Manager::displacements(const std::vector<int>& counts)
+{
+    std::vector<int> displs(counts.size(), 0);
+    for (std::size_t i = 1; i < counts.size(); ++i)
+        displs[i] = displs[i-1] + counts[i-1];
+    return displs;
+}
+
+void Manager::setResultCache(std::size_t capacity)
+{
+    m_resultCache.setCapacity(capacity);
+}
+
+void Manager::invalidateResults(FunctionHandle functionHandle, int rank)
+{
+    m_resultCache.invalidate(functionHandle, rank);
+}
+
+const ResultCacheStats& Manager::resultCacheStats() const
+{
+    return m_resultCache.stats();
+}
+
+const CodecStats& Manager::codecStats(uint8_t codecId) const
+{
+    return m_codecs.at(codecId)->stats();
+}
+
+std::vector<char>* Manager::compressMessage(std::vector<char>* data, std::size_t headerLength)
+{
+    if (!m_compressionCodec || data->size() < m_compressionThreshold)
+        return data;
+    CodecStats& stats = m_compressionCodec->stats();
+    uint64_t payloadLength = data->size() - headerLength;
+    std::vector<char>* compressed = new std::vector<char>(data->begin(), data->begin() + headerLength);
+    compressed->reserve(data->size());
+    ParameterStream stream(compressed);
+    stream << m_compressionCodec->id() << payloadLength;
+    auto start = std::chrono::steady_clock::now();
+    m_compressionCodec->compress(data->data() + headerLength, payloadLength, *compressed);
+    stats.compressTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.bytesIn += data->size();
+    if (compressed->size() >= data->size()) {
+        ++stats.skipped;
+        stats.bytesOut += data->size();
+        delete compressed;
+        return data;
+    }
+    ++stats.compressed;
+    stats.bytesOut += compressed->size();
+    (*compressed)[0] |= MPIRPC_FLAG_COMPRESSED;
+    delete data;
+    return compressed;
+}
+
+void Manager::decompressMessage(std::vector<char>* data, std::size_t headerLength)
+{
+    ParameterStream stream(data);
+    stream.seek(headerLength);
+    uint8_t codecId;
+    uint64_t payloadLength;
+    stream >> codecId >> payloadLength;
+    Codec* codec = m_codecs.at(codecId);
+    std::vector<char> decompressed(data->begin(), data->begin() + headerLength);
+    auto start = std::chrono::steady_clock::now();
+    codec->decompress(data->data() + stream.pos(), data->size() - stream.pos(), decompressed, payloadLength);
+    codec->stats().decompressTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++codec->stats().decompressed;
+    codec->stats().bytesReceived += data->size();
+    codec->stats().bytesDecompressed += decompressed.size();
+    data->swap(decompressed);
+}
+
+void Manager::setStreaming(std::size_t threshold, std::size_t chunkSize, int window)
+{
+    m_streamThreshold = threshold;
+    m_streamChunkSize = chunkSize;
+    m_streamWindow = window;
 }
 
 int Manager::rank() const
@@ -79,14 +253,399 @@ void Manager::notifyNewObject(TypeId type, ObjectId id)
 }
 
 void Manager::sendRawMessage(int rank, const std::vector<char> *data, int tag)
+{
+    sendRawMessage(rank, data, tag, m_comm);
+}
+
+void Manager::sendRawMessage(int rank, const std::vector<char> *data, int tag, MPI_Comm comm)
 {
     if (checkSends() && !m_shutdown) {
         MPI_Request req;
-        MPI_Issend((void*) data->data(), data->size(), MPI_CHAR, rank, tag, m_comm, &req);
+        MPI_Issend((void*) data->data(), data->size(), MPI_CHAR, rank, tag, comm, &req);
         m_mpiMessages[req] = data;
     }
 }
 
+void Manager::sendInvocationMessage(int rank, std::vector<char> *data, int tag, Priority priority)
+{
+    TraceScope trace(m_tracer, "send", "peer", rank);
+    if (m_flowMessages > 0 || m_flowBytes > 0) {
+        if (!acquireFlowCredit(rank, data->size())) {
+            delete data;
+            return;
+        }
+        (*data)[0] |= MPIRPC_FLAG_CREDIT;
+    }
+    if (!m_rmaQueue) {
+        sendRawMessage(rank, data, tag, m_laneComms[static_cast<int>(priority)]);
+        return;
+    }
+    if (checkSends() && !m_shutdown) {
+        if (m_rmaQueue->fits(data->size())) {
+            //Make progress while the target's ring is full so that two ranks filling each other's rings cannot deadlock
+            while (!m_rmaQueue->tryPush(rank, data->data(), data->size(), tag)) {
+                if (!checkMessages())
+                    break;
+            }
+            delete data;
+        } else {
+            while (!m_rmaQueue->tryPushRedirect(rank, tag)) {
+                if (!checkMessages())
+                    break;
+            }
+            sendRawMessage(rank, data, MPIRPC_TAG_RMA_OVERFLOW);
+        }
+    }
+}
+
+bool Manager::processRmaMessages()
+{
+    bool processed = false;
+    int source, tag;
+    std::vector<char>* buffer;
+    std::size_t length;
+    while (!m_shutdown && m_rmaQueue->poll(source, tag, buffer, length)) {
+        processed = true;
+        if (tag == RmaQueue::RedirectTag) {
+            //The sender posts the two-sided send immediately after publishing the redirect record
+            MPI_Status status;
+            int len;
+            tag = static_cast<int>(length);
+            MPI_Probe(source, MPIRPC_TAG_RMA_OVERFLOW, m_comm, &status);
+            MPI_Get_count(&status, MPI_CHAR, &len);
+            buffer = new std::vector<char>(len);
+            MPI_Recv(buffer->data(), len, MPI_CHAR, source, MPIRPC_TAG_RMA_OVERFLOW, m_comm, MPI_STATUS_IGNORE);
+        }
+        m_count++;
+        dispatchInvocation(source, tag, buffer);
+    }
+    return processed;
+}
+
+void Manager::beginOutgoingStream(ParameterStream& stream, OutgoingStream& state)
+{
+    //Credit waits nested inside handlers or return waits could form a cycle with the peer, so only stream
+    //invocations from the top level and return values from handlers which are not nested
+    int depth = (state.tag == MPIRPC_TAG_RETURN) ? 1 : 0;
+    if (m_streamThreshold == 0 || state.rank == m_rank || m_callDepth != depth || m_outgoingStreams.count(state.rank))
+        return;
+    //The first chunk must contain the whole header
+    std::size_t threshold = std::max(m_streamThreshold, InvocationHeader::maxSize);
+    stream.setSink([this, &state](ParameterStream& s) { flushOutgoingStream(s, state); }, threshold);
+}
+
+void Manager::flushOutgoingStream(ParameterStream& stream, OutgoingStream& state)
+{
+    std::vector<char>* chunk = new std::vector<char>();
+    chunk->swap(*stream.dataVector());
+    if (state.started) {
+        sendStreamChunk(state.rank, chunk, false);
+        return;
+    }
+    state.started = true;
+    (*chunk)[0] |= MPIRPC_FLAG_STREAMED;
+    m_outgoingStreams.insert(state.rank);
+    stream.setChunkSize(m_streamChunkSize);
+    if (state.tag == MPIRPC_TAG_RETURN)
+        sendReturn(state.rank, chunk);
+    else
+        sendInvocationMessage(state.rank, chunk, state.tag);
+}
+
+bool Manager::endOutgoingStream(ParameterStream& stream, OutgoingStream& state)
+{
+    if (!state.started)
+        return false;
+    sendStreamChunk(state.rank, stream.dataVector(), true);
+    m_outgoingStreams.erase(state.rank);
+    runDeferredInvocations();
+    return true;
+}
+
+void Manager::sendStreamChunk(int rank, std::vector<char>* chunk, bool last)
+{
+    chunk->push_back(last ? 1 : 0);
+    int& credits = streamCredits(rank);
+    while (credits <= 0) {
+        if (!checkMessages()) {
+            delete chunk;
+            return;
+        }
+    }
+    --credits;
+    MPI_Request req;
+    MPI_Issend((void*) chunk->data(), chunk->size(), MPI_CHAR, rank, MPIRPC_TAG_STREAM_CHUNK, m_streamComm, &req);
+    m_mpiMessages[req] = chunk;
+}
+
+void Manager::beginIncomingStream(ParameterStream& stream, IncomingStream& state)
+{
+    state.done = false;
+    stream.setSource([this, &state](ParameterStream& s) { return receiveStreamChunk(s, state); });
+}
+
+bool Manager::receiveStreamChunk(ParameterStream& stream, IncomingStream& state)
+{
+    if (state.done)
+        return false;
+    MPI_Status status;
+    int len;
+    MPI_Probe(state.rank, MPIRPC_TAG_STREAM_CHUNK, m_streamComm, &status);
+    MPI_Get_count(&status, MPI_CHAR, &len);
+    std::vector<char>* data = stream.dataVector();
+    std::size_t size = data->size();
+    data->resize(size + len);
+    MPI_Recv(data->data() + size, len, MPI_CHAR, state.rank, MPIRPC_TAG_STREAM_CHUNK, m_streamComm, MPI_STATUS_IGNORE);
+    state.done = data->back() != 0;
+    data->pop_back();
+    int credit = 1;
+    MPI_Bsend(&credit, 1, MPI_INT, state.rank, MPIRPC_TAG_STREAM_CREDIT, m_streamComm);
+    return true;
+}
+
+void Manager::endIncomingStream(ParameterStream& stream, IncomingStream& state)
+{
+    while (!state.done) {
+        stream.dataVector()->clear();
+        stream.seek(0);
+        receiveStreamChunk(stream, state);
+    }
+}
+
+void Manager::beginReturnStream(ParameterStream& stream, IncomingStream& state)
+{
+    uint8_t flags;
+    stream >> flags;
+    if (flags & MPIRPC_FLAG_COMPRESSED)
+        decompressMessage(stream.dataVector(), stream.pos());
+    if (flags & MPIRPC_FLAG_STREAMED)
+        beginIncomingStream(stream, state);
+}
+
+int& Manager::streamCredits(int rank)
+{
+    auto it = m_streamCredits.find(rank);
+    if (it == m_streamCredits.end())
+        it = m_streamCredits.emplace(rank, m_streamWindow).first;
+    return it->second;
+}
+
+void Manager::processStreamCredits()
+{
+    int flag = 1;
+    while (flag) {
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPIRPC_TAG_STREAM_CREDIT, m_streamComm, &flag, &status);
+        if (flag) {
+            int credit;
+            MPI_Recv(&credit, 1, MPI_INT, status.MPI_SOURCE, MPIRPC_TAG_STREAM_CREDIT, m_streamComm, MPI_STATUS_IGNORE);
+            streamCredits(status.MPI_SOURCE) += credit;
+        }
+    }
+}
+
+void Manager::setPriority(FunctionHandle functionHandle, Priority priority)
+{
+    m_priorities[functionHandle] = priority;
+}
+
+void Manager::setBulkThreshold(std::size_t threshold)
+{
+    m_bulkThreshold = threshold;
+}
+
+void Manager::setLaneBudget(Priority lane, int budget)
+{
+    m_laneBudgets[static_cast<int>(lane)] = budget;
+}
+
+Priority Manager::lane(FunctionHandle functionHandle, std::size_t size) const
+{
+    auto it = m_priorities.find(functionHandle);
+    if (it != m_priorities.end())
+        return it->second;
+    if (m_bulkThreshold > 0 && size >= m_bulkThreshold)
+        return Priority::Bulk;
+    return Priority::Normal;
+}
+
+void Manager::processLane(Priority lane)
+{
+    MPI_Comm comm = m_laneComms[static_cast<int>(lane)];
+    int budget = m_laneBudgets[static_cast<int>(lane)];
+    for (int run = 0; !m_shutdown && (budget == 0 || run < budget); ++run) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+        if (!flag)
+            return;
+        if (status.MPI_TAG == MPIRPC_TAG_INVOKE)
+            receivedInvocationCommand(std::move(status), comm);
+        else
+            receivedMemberInvocationCommand(std::move(status), comm);
+    }
+}
+
+Metrics& Manager::metrics()
+{
+    return m_metrics;
+}
+
+const Metrics& Manager::metrics() const
+{
+    return m_metrics;
+}
+
+bool Manager::writeMetrics(const std::string& path) const
+{
+    return m_metrics.writeJson(path, m_rank);
+}
+
+void Manager::recordSend(FunctionHandle functionHandle, int rank, std::size_t bytes, double serializeTime)
+{
+    CallMetrics& metrics = m_metrics.sent(functionHandle, rank);
+    ++metrics.calls;
+    metrics.bytesOut += bytes;
+    metrics.serializeTime += serializeTime;
+}
+
+void Manager::recordExecution(FunctionHandle functionHandle, int source, std::size_t bytesIn, std::size_t bytesOut)
+{
+    double unmarshal, execution;
+    Metrics::endExecution(unmarshal, execution);
+    CallMetrics& metrics = m_metrics.executed(functionHandle, source);
+    ++metrics.calls;
+    metrics.bytesIn += bytesIn;
+    metrics.bytesOut += bytesOut;
+    metrics.deserializeTime += unmarshal;
+    metrics.latency.add(execution);
+}
+
+void Manager::enableTracing(const std::string& path, std::size_t capacity)
+{
+    m_tracePath = path;
+    m_tracer.setClockOffset(estimateClockOffset());
+    m_tracer.enable(capacity);
+}
+
+bool Manager::writeTrace() const
+{
+    if (m_tracePath.empty())
+        return false;
+    return m_tracer.writeJson(m_tracePath + "." + std::to_string(m_rank) + ".json", m_rank);
+}
+
+Tracer& Manager::tracer()
+{
+    return m_tracer;
+}
+
+const ArgumentArena& Manager::argumentArena() const
+{
+    return m_argumentArena;
+}
+
+int64_t Manager::estimateClockOffset()
+{
+    int64_t offset = 0;
+    MPI_Barrier(m_streamComm);
+    if (m_rank == 0) {
+        for (int rank = 1; rank < m_numProcs; ++rank) {
+            for (int i = 0; i < MPIRPC_CLOCK_SYNC_ROUNDS; ++i) {
+                uint64_t t;
+                MPI_Recv(&t, 1, MPI_UINT64_T, rank, MPIRPC_TAG_CLOCK_SYNC, m_streamComm, MPI_STATUS_IGNORE);
+                t = Tracer::now();
+                MPI_Send(&t, 1, MPI_UINT64_T, rank, MPIRPC_TAG_CLOCK_SYNC, m_streamComm);
+            }
+        }
+    } else {
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < MPIRPC_CLOCK_SYNC_ROUNDS; ++i) {
+            uint64_t sent = Tracer::now();
+            uint64_t remote;
+            MPI_Send(&sent, 1, MPI_UINT64_T, 0, MPIRPC_TAG_CLOCK_SYNC, m_streamComm);
+            MPI_Recv(&remote, 1, MPI_UINT64_T, 0, MPIRPC_TAG_CLOCK_SYNC, m_streamComm, MPI_STATUS_IGNORE);
+            uint64_t received = Tracer::now();
+            //Assume the reply was timestamped half way through the round trip
+            if (received - sent < best) {
+                best = received - sent;
+                offset = static_cast<int64_t>(remote) - static_cast<int64_t>(sent + best/2);
+            }
+        }
+    }
+    return offset;
+}
+
+void Manager::setFlowControl(int maxMessages, std::size_t maxBytes)
+{
+    m_flowMessages = maxMessages;
+    m_flowBytes = maxBytes;
+}
+
+FlowControlStats Manager::flowControlStats(int rank) const
+{
+    auto it = m_flowControl.find(rank);
+    return it == m_flowControl.end() ? FlowControlStats() : it->second;
+}
+
+bool Manager::acquireFlowCredit(int rank, std::size_t size)
+{
+    FlowControlStats& stats = m_flowControl[rank];
+    auto overQuota = [&]() {
+        return stats.outstandingMessages > 0
+            && ((m_flowMessages > 0 && stats.outstandingMessages >= static_cast<unsigned long long>(m_flowMessages))
+                || (m_flowBytes > 0 && stats.outstandingBytes + size > m_flowBytes));
+    };
+    if (overQuota()) {
+        ++stats.stalls;
+        auto start = std::chrono::steady_clock::now();
+        //Keep servicing invocations while waiting, so that ranks waiting for each other's credits still run each other's invocations
+        while (overQuota()) {
+            if (!checkMessages())
+                return false;
+        }
+        stats.stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    ++stats.messages;
+    stats.bytes += size;
+    ++stats.outstandingMessages;
+    stats.outstandingBytes += size;
+    stats.peakMessages = std::max(stats.peakMessages, stats.outstandingMessages);
+    stats.peakBytes = std::max(stats.peakBytes, stats.outstandingBytes);
+    return true;
+}
+
+void Manager::returnFlowCredit(int source, std::size_t size)
+{
+    auto& owed = m_flowCreditsOwed[source];
+    ++owed.first;
+    owed.second += size;
+}
+
+void Manager::processFlowCredits()
+{
+    for (auto& owed : m_flowCreditsOwed) {
+        uint64_t credit[2] = {owed.second.first, owed.second.second};
+        std::vector<char>* data = new std::vector<char>(reinterpret_cast<char*>(credit), reinterpret_cast<char*>(credit) + sizeof(credit));
+        MPI_Request req;
+        MPI_Issend((void*) data->data(), data->size(), MPI_CHAR, owed.first, MPIRPC_TAG_FLOW_CREDIT, m_streamComm, &req);
+        m_mpiMessages[req] = data;
+    }
+    m_flowCreditsOwed.clear();
+    int flag = 1;
+    while (flag) {
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPIRPC_TAG_FLOW_CREDIT, m_streamComm, &flag, &status);
+        if (flag) {
+            uint64_t credit[2];
+            MPI_Recv(credit, sizeof(credit), MPI_CHAR, status.MPI_SOURCE, MPIRPC_TAG_FLOW_CREDIT, m_streamComm, MPI_STATUS_IGNORE);
+            FlowControlStats& stats = m_flowControl[status.MPI_SOURCE];
+            stats.outstandingMessages -= credit[0];
+            stats.outstandingBytes -= credit[1];
+        }
+    }
+}
+
 void Manager::sendRawMessageToAll(const std::vector<char>* data, int tag)
 {
     for (int i = 0; i < m_numProcs; ++i) {
@@ -137,8 +696,17 @@ bool Manager::checkMessages() {
     if (m_shutdown)
         return false;
     checkSends();
+    MPIRPC_METRIC(m_metrics.sampleQueueDepth(queueSize()));
+    processStreamCredits();
+    processFlowCredits();
+    processReductions();
+    runDeferredInvocations();
+    if (m_rmaQueue)
+        processRmaMessages();
+    processLane(Priority::High);
     int flag = 1;
-    while (flag) {
+    int budget = m_laneBudgets[static_cast<int>(Priority::Normal)];
+    for (int run = 0; flag && !m_shutdown && (budget == 0 || run < budget);) {
         MPI_Status status;
         MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, m_comm, &flag, &status);
         if (flag) {
@@ -152,22 +720,110 @@ bool Manager::checkMessages() {
                     registerRemoteObject();
                     break;
                 case MPIRPC_TAG_INVOKE:
-                    receivedInvocationCommand(std::move(status));
+                    receivedInvocationCommand(std::move(status), m_comm);
+                    ++run;
                     break;
                 case MPIRPC_TAG_INVOKE_MEMBER:
-                    receivedMemberInvocationCommand(std::move(status));
+                    receivedMemberInvocationCommand(std::move(status), m_comm);
+                    ++run;
                     break;
                 case MPIRPC_TAG_RETURN:
+                    //Leave the Bulk lane until the waiting caller has taken its return value
                     return true;
+                case MPIRPC_TAG_RMA_OVERFLOW:
+                    //Only received in ring order. If the redirect record was already consumed by a caller further up the stack, leave it.
+                    if (!m_rmaQueue || !processRmaMessages())
+                        return true;
+                    break;
                 default:
                     UserMessageHandler func = m_userMessageHandlers.at(status.MPI_TAG);
                     func(std::move(status));
             }
         }
     }
+    processLane(Priority::Bulk);
     return true;
 }
 
+void Manager::progressReduction()
+{
+    if (!checkMessages())
+        throw ShutdownException();
+}
+
+void Manager::waitForReduction(MPI_Request& req)
+{
+    int flag = 0;
+    MPI_Test(&req, &flag, MPI_STATUS_IGNORE);
+    while (!flag) {
+        progressReduction();
+        MPI_Test(&req, &flag, MPI_STATUS_IGNORE);
+    }
+}
+
+void Manager::processReductions()
+{
+    auto done = std::remove_if(m_pendingReductions.begin(), m_pendingReductions.end(),
+                               [](const std::shared_ptr<PendingReduce>& p) { return p->test(); });
+    m_pendingReductions.erase(done, m_pendingReductions.end());
+}
+
+void Manager::registerReplicaHandlers(ReplicatedObjectBase* replicated)
+{
+    replicated->m_mutateHandle = registerLambda([this, replicated](int origin, uint64_t sequence, FunctionHandle functionHandle, const std::vector<uint8_t>& arguments) {
+        applyReplicaMutation(replicated, ReplicatedObjectBase::Delta{origin, sequence, functionHandle, arguments});
+    });
+    replicated->m_deltaHandle = registerLambda([this, replicated](uint64_t version, int origin, uint64_t sequence, FunctionHandle functionHandle, const std::vector<uint8_t>& arguments) {
+        receiveReplicaDelta(replicated, version, ReplicatedObjectBase::Delta{origin, sequence, functionHandle, arguments});
+    });
+    //Mutations and deltas are applied in the order they were sent, whatever their size
+    setPriority(replicated->m_mutateHandle, Priority::Normal);
+    setPriority(replicated->m_deltaHandle, Priority::Normal);
+    m_replicatedObjects.push_back(replicated);
+}
+
+void Manager::submitReplicaMutation(ReplicatedObjectBase* replicated, FunctionHandle functionHandle, std::vector<uint8_t>&& arguments)
+{
+    uint64_t sequence = ++replicated->m_submitted;
+    if (replicated->m_primary == m_rank)
+        applyReplicaMutation(replicated, ReplicatedObjectBase::Delta{m_rank, sequence, functionHandle, std::move(arguments)});
+    else
+        invokeFunction(replicated->m_primary, replicated->m_mutateHandle, m_rank, sequence, functionHandle, arguments);
+}
+
+void Manager::applyReplicaMutation(ReplicatedObjectBase* replicated, ReplicatedObjectBase::Delta&& delta)
+{
+    uint64_t version = replicated->m_version + 1;
+    applyReplicaDelta(replicated, version, delta);
+    for (int i = 0; i < m_numProcs; ++i)
+        if (i != m_rank)
+            invokeFunction(i, replicated->m_deltaHandle, version, delta.origin, delta.sequence, delta.functionHandle, delta.arguments);
+}
+
+void Manager::receiveReplicaDelta(ReplicatedObjectBase* replicated, uint64_t version, ReplicatedObjectBase::Delta&& delta)
+{
+    if (version != replicated->m_version + 1) {
+        replicated->m_pendingDeltas.emplace(version, std::move(delta));
+        return;
+    }
+    applyReplicaDelta(replicated, version, delta);
+    auto next = replicated->m_pendingDeltas.begin();
+    while (next != replicated->m_pendingDeltas.end() && next->first == replicated->m_version + 1) {
+        applyReplicaDelta(replicated, next->first, next->second);
+        next = replicated->m_pendingDeltas.erase(next);
+    }
+}
+
+void Manager::applyReplicaDelta(ReplicatedObjectBase* replicated, uint64_t version, const ReplicatedObjectBase::Delta& delta)
+{
+    std::vector<char> buffer(delta.arguments.begin(), delta.arguments.end());
+    ParameterStream stream(&buffer);
+    m_registeredFunctions.at(delta.functionHandle)->execute(stream, nullptr, replicated->m_object);
+    replicated->m_version = version;
+    if (delta.origin == m_rank)
+        replicated->m_ownApplied = delta.sequence;
+}
+
 void Manager::registerRemoteObject()
 {
     ObjectInfo info;
@@ -177,6 +833,7 @@ void Manager::registerRemoteObject()
 }
 
 void Manager::sync() {
+    TraceScope trace(m_tracer, "sync");
     while (queueSize() > 0) { checkMessages(); } //block until this rank's queue is processed
     MPI_Request req;
     int flag;
@@ -188,6 +845,123 @@ void Manager::sync() {
     } while (!flag); //wait until all other ranks queues have been processed
 }
 
+std::map<int, std::vector<char>> Manager::scatterInvocations(FunctionHandle functionHandle, const std::map<int, std::vector<char>>& payloads, bool gatherResults)
+{
+    TraceScope trace(m_tracer, "scatter", "function", functionHandle);
+    auto it = m_registeredFunctions.find(functionHandle);
+    if (it == m_registeredFunctions.end())
+        throw UnregisteredFunctionException();
+    FunctionBase* f = it->second;
+    int targets = payloads.size();
+    int maxTargets;
+    MPI_Request req;
+    MPI_Iallreduce(&targets, &maxTargets, 1, MPI_INT, MPI_MAX, m_comm, &req);
+    waitProcessing(req);
+    bool sparse = maxTargets*MPIRPC_SCATTER_SPARSE_FRACTION <= m_numProcs;
+    std::map<int, std::vector<char>> received = exchangePayloads(payloads, sparse);
+    std::map<int, std::vector<char>> results;
+    for (auto& i : received) {
+        ParameterStream stream(&i.second);
+        std::vector<char>* result = gatherResults ? &results[i.first] : nullptr;
+        ParameterStream resultStream(result);
+        TraceScope execute(m_tracer, "execute", "function", functionHandle);
+        ArgumentArena::Scope arena(m_argumentArena);
+        ++m_callDepth;
+        f->execute(stream, result ? &resultStream : nullptr, nullptr);
+        --m_callDepth;
+    }
+    if (!gatherResults)
+        return results;
+    return exchangePayloads(results, sparse);
+}
+
+std::map<int, std::vector<char>> Manager::exchangePayloads(const std::map<int, std::vector<char>>& payloads, bool sparse)
+{
+    return sparse ? exchangeSparse(payloads) : exchangeDense(payloads);
+}
+
+std::map<int, std::vector<char>> Manager::exchangeDense(const std::map<int, std::vector<char>>& payloads)
+{
+    std::vector<int> sendCounts(m_numProcs, 0), sendDispls(m_numProcs, 0);
+    std::vector<int> recvCounts(m_numProcs), recvDispls(m_numProcs, 0);
+    std::vector<char> sendBuffer;
+    for (const auto& i : payloads) {
+        sendDispls[i.first] = sendBuffer.size();
+        sendCounts[i.first] = i.second.size();
+        sendBuffer.insert(sendBuffer.end(), i.second.begin(), i.second.end());
+    }
+    MPI_Request req;
+    MPI_Ialltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, m_comm, &req);
+    waitProcessing(req);
+    //Sending an empty payload and sending none are told apart by the sender having a payload for the rank
+    std::vector<int> sent(m_numProcs, 0), hasPayload(m_numProcs);
+    for (const auto& i : payloads)
+        sent[i.first] = 1;
+    MPI_Ialltoall(sent.data(), 1, MPI_INT, hasPayload.data(), 1, MPI_INT, m_comm, &req);
+    waitProcessing(req);
+    int total = 0;
+    for (int i = 0; i < m_numProcs; ++i) {
+        recvDispls[i] = total;
+        total += recvCounts[i];
+    }
+    std::vector<char> recvBuffer(total);
+    MPI_Ialltoallv(sendBuffer.data(), sendCounts.data(), sendDispls.data(), MPI_CHAR,
+                   recvBuffer.data(), recvCounts.data(), recvDispls.data(), MPI_CHAR, m_comm, &req);
+    waitProcessing(req);
+    std::map<int, std::vector<char>> received;
+    for (int i = 0; i < m_numProcs; ++i) {
+        if (hasPayload[i])
+            received[i].assign(recvBuffer.begin() + recvDispls[i], recvBuffer.begin() + recvDispls[i] + recvCounts[i]);
+    }
+    return received;
+}
+
+std::map<int, std::vector<char>> Manager::exchangeSparse(const std::map<int, std::vector<char>>& payloads)
+{
+    //Synchronous sends complete once matched, so when all of this rank's sends are done and every rank has
+    //reached the barrier, every payload has been received
+    std::vector<MPI_Request> sends;
+    for (const auto& i : payloads) {
+        sends.emplace_back();
+        MPI_Issend(const_cast<char*>(i.second.data()), i.second.size(), MPI_CHAR, i.first, MPIRPC_TAG_SCATTER, m_streamComm, &sends.back());
+    }
+    std::map<int, std::vector<char>> received;
+    MPI_Request barrier = MPI_REQUEST_NULL;
+    bool done = false;
+    while (!done) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPIRPC_TAG_SCATTER, m_streamComm, &flag, &status);
+        if (flag) {
+            int len;
+            MPI_Get_count(&status, MPI_CHAR, &len);
+            std::vector<char>& payload = received[status.MPI_SOURCE];
+            payload.resize(len);
+            MPI_Recv(payload.data(), len, MPI_CHAR, status.MPI_SOURCE, MPIRPC_TAG_SCATTER, m_streamComm, MPI_STATUS_IGNORE);
+        }
+        if (barrier == MPI_REQUEST_NULL) {
+            MPI_Testall(sends.size(), sends.data(), &flag, MPI_STATUSES_IGNORE);
+            if (flag)
+                MPI_Ibarrier(m_streamComm, &barrier);
+        } else {
+            MPI_Test(&barrier, &flag, MPI_STATUS_IGNORE);
+            done = flag;
+        }
+        checkMessages();
+    }
+    return received;
+}
+
+void Manager::waitProcessing(MPI_Request& request)
+{
+    int flag = 0;
+    MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+    while (!flag) {
+        checkMessages();
+        MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+    }
+}
+
 void Manager::registerRemoteObject(int rank, TypeId type, ObjectId id)
 {
     ObjectWrapper<void> *a = new ObjectWrapper<void>();
@@ -224,43 +998,166 @@ void Manager::handleShutdown()
     m_shutdown = true;
 }
 
-void Manager::receivedInvocationCommand(MPI_Status&& status)
+void Manager::receivedInvocationCommand(MPI_Status&& status, MPI_Comm comm)
 {
     m_count++;
     int len;
     MPI_Get_count(&status, MPI_CHAR, &len);
     if (len != MPI_UNDEFINED) {
         std::vector<char>* buffer = new std::vector<char>(len);
-        ParameterStream stream(buffer);
         MPI_Status recvStatus;
-        MPI_Recv(stream.data(), len, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, m_comm, &recvStatus);
-        FunctionHandle functionHandle;
-        bool getReturn;
-        stream >> functionHandle >> getReturn;
-        FunctionBase *f = m_registeredFunctions[functionHandle];
-        f->execute(stream, recvStatus.MPI_SOURCE, this, getReturn);
-        delete buffer;
+        m_tracer.begin("receive", "peer", status.MPI_SOURCE);
+        MPI_Recv(buffer->data(), len, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &recvStatus);
+        m_tracer.end("receive");
+        dispatchInvocation(recvStatus.MPI_SOURCE, MPIRPC_TAG_INVOKE, buffer);
     }
 }
 
-void Manager::receivedMemberInvocationCommand(MPI_Status&& status) {
+void Manager::receivedMemberInvocationCommand(MPI_Status&& status, MPI_Comm comm) {
     m_count++;
     int len;
     MPI_Get_count(&status, MPI_CHAR, &len);
     if (len != MPI_UNDEFINED) {
         std::vector<char>* buffer = new std::vector<char>(len);
-        ParameterStream stream(buffer);
         MPI_Status recvStatus;
-        MPI_Recv(stream.data(), len, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, m_comm, &recvStatus);
-        FunctionHandle functionHandle;
-        ObjectId objectId;
-        TypeId typeId;
-        bool getReturn;
-        stream >> typeId >> objectId >> functionHandle >> getReturn;
-        FunctionBase *f = m_registeredFunctions[functionHandle];
-        f->execute(stream, recvStatus.MPI_SOURCE, this, getReturn, getObjectWrapper(m_rank, typeId, objectId)->object());
-        delete buffer;
+        m_tracer.begin("receive", "peer", status.MPI_SOURCE);
+        MPI_Recv(buffer->data(), len, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &recvStatus);
+        m_tracer.end("receive");
+        dispatchInvocation(recvStatus.MPI_SOURCE, MPIRPC_TAG_INVOKE_MEMBER, buffer);
+    }
+}
+
+void Manager::dispatchInvocation(int source, int tag, std::vector<char>* buffer)
+{
+    TraceScope trace(m_tracer, "dispatch", "peer", source);
+    bool defer = false;
+    for (const DeferredInvocation& d : m_deferredInvocations) {
+        if (d.source == source) {
+            defer = true;
+            break;
+        }
+    }
+    if (!defer && !m_outgoingStreams.empty() && source > m_rank)
+        defer = (*buffer)[0] & MPIRPC_FLAG_STREAMED;
+    if (defer) {
+        m_deferredInvocations.push_back(DeferredInvocation{source, tag, buffer});
+        return;
+    }
+    if (tag == MPIRPC_TAG_INVOKE)
+        executeInvocation(source, buffer);
+    else
+        executeMemberInvocation(source, buffer);
+}
+
+void Manager::runDeferredInvocations()
+{
+    while (m_outgoingStreams.empty() && !m_deferredInvocations.empty()) {
+        DeferredInvocation d = m_deferredInvocations.front();
+        m_deferredInvocations.pop_front();
+        if (d.tag == MPIRPC_TAG_INVOKE)
+            executeInvocation(d.source, d.buffer);
+        else
+            executeMemberInvocation(d.source, d.buffer);
+    }
+}
+
+void Manager::executeInvocation(int source, std::vector<char>* buffer)
+{
+    std::size_t size = buffer->size();
+    ParameterStream stream(buffer);
+    InvocationHeader header;
+    stream >> header;
+    if (header.flags & MPIRPC_FLAG_COMPRESSED)
+        decompressMessage(buffer, stream.pos());
+    FunctionBase *f = m_registeredFunctions[header.functionHandle];
+    executeFunction(f, source, header.flags, stream, nullptr);
+    delete buffer;
+    if (header.flags & MPIRPC_FLAG_CREDIT)
+        returnFlowCredit(source, size);
+}
+
+void Manager::executeMemberInvocation(int source, std::vector<char>* buffer)
+{
+    std::size_t size = buffer->size();
+    ParameterStream stream(buffer);
+    InvocationHeader header;
+    stream >> header;
+    if (header.flags & MPIRPC_FLAG_COMPRESSED)
+        decompressMessage(buffer, stream.pos());
+    FunctionBase *f = m_registeredFunctions[header.functionHandle];
+    void *object = getObjectWrapper(m_rank, header.typeId, header.objectId)->object();
+    executeFunction(f, source, header.flags, stream, object);
+    delete buffer;
+    if (header.flags & MPIRPC_FLAG_CREDIT)
+        returnFlowCredit(source, size);
+}
+
+void Manager::executeFunction(FunctionBase* f, int source, uint8_t flags, ParameterStream& stream, void* object)
+{
+    TraceScope trace(m_tracer, "execute", "function", f->id());
+    ArgumentArena::Scope arena(m_argumentArena);
+    ++m_callDepth;
+    stream.setAttachmentSource([this, source](void* data, std::size_t count, std::type_index type) {
+        MPI_Recv(data, count, podType(type), source, MPIRPC_TAG_ATTACHMENT, m_streamComm, MPI_STATUS_IGNORE);
+    });
+    IncomingStream incoming(source);
+    if (flags & MPIRPC_FLAG_STREAMED)
+        beginIncomingStream(stream, incoming);
+    MPIRPC_METRIC(std::size_t bytesIn = stream.dataVector()->size());
+    MPIRPC_METRIC(std::size_t bytesOut = 0);
+    MPIRPC_METRIC(Metrics::beginExecution());
+    if (flags & MPIRPC_FLAG_RETURN) {
+        std::vector<char>* returnBuffer = new std::vector<char>();
+        ParameterStream returnStream(returnBuffer);
+        OutgoingStream outgoing(source, MPIRPC_TAG_RETURN);
+        beginOutgoingStream(returnStream, outgoing);
+        returnStream << static_cast<uint8_t>(0);
+        ++m_returnsOwed;
+        f->execute(stream, &returnStream, object);
+        --m_returnsOwed;
+        MPIRPC_METRIC(bytesOut = returnBuffer->size());
+        endIncomingStream(stream, incoming);
+        if (!endOutgoingStream(returnStream, outgoing))
+            sendReturn(source, compressMessage(returnBuffer, 1));
+    } else {
+        f->execute(stream, nullptr, object);
+        endIncomingStream(stream, incoming);
     }
+    MPIRPC_METRIC(recordExecution(f->id(), source, bytesIn, bytesOut));
+    --m_callDepth;
+}
+
+void Manager::sendReturn(int rank, std::vector<char>* buffer)
+{
+    TraceScope trace(m_tracer, "reply", "peer", rank);
+    //Not a blocking send: two ranks may be returning values to each other from nested invocations
+    sendRawMessage(rank, buffer, MPIRPC_TAG_RETURN);
+}
+
+std::vector<char>* Manager::receiveReturn(int rank, const bool* done)
+{
+    MPI_Status status;
+    int len;
+    int flag = 0;
+    bool shutdown = false;
+    TraceScope trace(m_tracer, "wait", "peer", rank);
+    ++m_callDepth;
+    ++m_returnWaits[rank];
+    while (!flag && !shutdown && !(done && *done)) {
+        shutdown = !checkMessages();
+        if (!(done && *done))
+            MPI_Iprobe(rank, MPIRPC_TAG_RETURN, m_comm, &flag, &status);
+    }
+    --m_returnWaits[rank];
+    --m_callDepth;
+    if (shutdown || !flag)
+        return nullptr;
+    MPI_Get_count(&status, MPI_CHAR, &len);
+    if (len == MPI_UNDEFINED)
+        return nullptr;
+    std::vector<char>* buffer = new std::vector<char>(len);
+    MPI_Recv((void*) buffer->data(), len, MPI_CHAR, rank, MPIRPC_TAG_RETURN, m_comm, &status);
+    return buffer;
 }
 
 MPI_Comm Manager::comm() const
@@ -322,7 +1219,7 @@ int Manager::numProcs() const
 
 size_t Manager::queueSize() const
 {
-    return m_mpiObjectMessages.size() + m_mpiMessages.size();
+    return m_mpiObjectMessages.size() + m_mpiMessages.size() + m_deferredInvocations.size();
 }
 
 ObjectWrapperBase* Manager::getObjectWrapper(int rank, TypeId tid, ObjectId oid) const {
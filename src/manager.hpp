@@ -41,6 +41,8 @@
 #include <exception>
 #include <algorithm>
 #include <thread>
+#include <numeric>
+#include <deque>
 
 #include <mpi.h>
 
@@ -50,6 +52,18 @@
 #include "common.hpp"
 #include "parameterstream.hpp"
 #include "mpitype.hpp"
+#include "rmaqueue.hpp"
+#include "codec.hpp"
+#include "invocationheader.hpp"
+#include "reducefuture.hpp"
+#include "reduce.hpp"
+#include "accumulate.hpp"
+#include "distributedarray.hpp"
+#include "replicated.hpp"
+#include "resultcache.hpp"
+#include "metrics.hpp"
+#include "arena.hpp"
+#include "tracer.hpp"
 
 #define ERR_ASSERT     1
 #define ERR_MAX_ACTORS 2
@@ -61,6 +75,30 @@
 #define MPIRPC_TAG_INVOKE 3
 #define MPIRPC_TAG_INVOKE_MEMBER 4
 #define MPIRPC_TAG_RETURN 5
+#define MPIRPC_TAG_RMA_OVERFLOW 6
+
+//Tags used on the stream communicator
+#define MPIRPC_TAG_STREAM_CHUNK 1
+#define MPIRPC_TAG_STREAM_CREDIT 2
+#define MPIRPC_TAG_ATTACHMENT 3
+#define MPIRPC_TAG_FLOW_CREDIT 4
+#define MPIRPC_TAG_CLOCK_SYNC 5
+#define MPIRPC_TAG_SCATTER 6
+
+#define MPIRPC_STREAM_CHUNK_SIZE (1024*1024)
+#define MPIRPC_STREAM_WINDOW 4
+
+#define MPIRPC_REDUCE_SEGMENT_SIZE (4*1024*1024)
+#define MPIRPC_REDUCE_WINDOW 4
+
+#define MPIRPC_FLOW_CONTROL_BYTES (64*1024*1024)
+
+#define MPIRPC_BULK_LANE_BUDGET 1
+
+#define MPIRPC_CLOCK_SYNC_ROUNDS 16
+
+//Scatters use a sparse exchange when no rank targets more than 1/MPIRPC_SCATTER_SPARSE_FRACTION of the ranks
+#define MPIRPC_SCATTER_SPARSE_FRACTION 8
 
 #define CALL_MEMBER_FN(object,ptr) ((object).*(ptr))
 
@@ -82,6 +120,66 @@ struct UnregisteredObjectException : std::exception
     }
 };
 
+struct UnregisteredPodTypeException : std::exception
+{
+    const char* what() const noexcept override
+    {
+        return "Unregistered POD Type\n";
+    }
+};
+
+struct ShutdownException : std::exception
+{
+    const char* what() const noexcept override
+    {
+        return "Manager shut down before a return value was received\n";
+    }
+};
+
+/**
+ * @brief The transport used for function invocations
+ *
+ * TwoSided sends each invocation with MPI_Issend and matches it with MPI_Iprobe/MPI_Recv.
+ * OneSided writes invocations directly into per-source ring buffers exposed by each rank
+ * through an MPI window. See: RmaQueue.
+ */
+enum class Transport
+{
+    TwoSided,
+    OneSided
+};
+
+/**
+ * @brief The lanes which two-sided invocations travel on
+ *
+ * Each lane has its own communicator. High lane invocations are run first on every pass of Manager::checkMessages(),
+ * then those on the Normal lane, which also carries return values and control messages, then those on the Bulk
+ * lane. Invocations from one rank to another are run in the order they were sent only within a lane.
+ * See: Manager::setPriority()
+ */
+enum class Priority
+{
+    High,
+    Normal,
+    Bulk
+};
+
+/**
+ * @brief The flow control state and counters for the invocations sent to one destination
+ */
+struct FlowControlStats
+{
+    FlowControlStats() : outstandingMessages(0), outstandingBytes(0), peakMessages(0), peakBytes(0), messages(0), bytes(0), stalls(0), stallTime(0) {}
+
+    unsigned long long outstandingMessages; ///< Invocations sent which the destination has not yet run
+    unsigned long long outstandingBytes;    ///< The size of those invocations
+    unsigned long long peakMessages;        ///< The most invocations outstanding at once
+    unsigned long long peakBytes;           ///< The most bytes outstanding at once
+    unsigned long long messages;            ///< Invocations sent under flow control
+    unsigned long long bytes;               ///< Bytes sent under flow control
+    unsigned long long stalls;              ///< Sends which had to wait for credits
+    double stallTime;                       ///< Seconds spent waiting for credits
+};
 
 /**
  * @brief The Manager class
@@ -107,6 +205,33 @@ class Manager
         TypeId id;
     };
 
+    /**
+     * State of a message being sent in chunks. The first chunk is sent as a normal message with
+     * MPIRPC_FLAG_STREAMED set in its leading flags byte. The remaining chunks follow on the
+     * stream communicator, the last one being marked as such.
+     */
+    struct OutgoingStream {
+        OutgoingStream(int r, int t) : rank(r), tag(t), started(false) {}
+        int rank;
+        int tag;
+        bool started;
+    };
+
+    /**
+     * State of a chunked message being received from #rank
+     */
+    struct IncomingStream {
+        IncomingStream(int r) : rank(r), done(true) {}
+        int rank;
+        bool done;
+    };
+
+    struct DeferredInvocation {
+        int source;
+        int tag;
+        std::vector<char>* buffer;
+    };
+
     /**
      * @brief The FunctionBase class
      *
@@ -131,12 +256,11 @@ class Manager
         /**
          * @brief execute Execute the function
          * @param params The serialized function parameters
-         * @param senderRank The rank requesting this function be invoked
-         * @param manager The Manager, when sending back the function return value
-         * @param getReturn Only send the function return value back to the sending rank when requested, as the return value may not be needed.
+         * @param result When not null, the function's return value is serialized directly into this stream.
+         * Only request the return value when it is needed, as it may be large.
          * @param object When the function is a member function, use object as the <i>this</i> pointer.
          */
-        virtual void execute(ParameterStream& params, int senderRank, Manager *manager, bool getReturn = false, void* object = 0) = 0;
+        virtual void execute(ParameterStream& params, ParameterStream* result = nullptr, void* object = 0) = 0;
 
         FunctionHandle id() const { return m_id; }
         GenericFunctionPointer pointer() const { return m_pointer; }
@@ -181,7 +305,7 @@ class Manager
 
         Function(R(*f)(Args...)) : FunctionBase(), func(f) { m_pointer = reinterpret_cast<void(*)()>(f); }
 
-        virtual void execute(ParameterStream& params, int senderRank, Manager *manager, bool getReturn = false, void* object = 0) override
+        virtual void execute(ParameterStream& params, ParameterStream* result = nullptr, void* object = 0) override
         {
             /*
              * func(convertData<Args>(data)...) does not work here
@@ -191,10 +315,10 @@ class Manager
              * parameters. Parameter packs are expanded as comma separated,
              * but the commas cannot be used as comma operators.
              */
-            assert(manager);
             OrderedCall<FunctionType> call{func, unmarshal<typename remove_all_const<Args>::type>(params)...};
-            if (getReturn)
-                manager->functionReturn(senderRank, call());
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
+            if (result)
+                *result << call();
             else
                 call();
         }
@@ -214,9 +338,10 @@ class Manager
 
         Function(FunctionType f) : FunctionBase(), func(f) { m_pointer = reinterpret_cast<void(*)()>(f); }
 
-        virtual void execute(ParameterStream& params, int senderRank, Manager *manager, bool getReturn = false, void* object = 0) override
+        virtual void execute(ParameterStream& params, ParameterStream* result = nullptr, void* object = 0) override
         {
             OrderedCall<FunctionType> call{func, unmarshal<typename remove_all_const<Args>::type>(params)...};
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
             call();
         }
 
@@ -235,13 +360,13 @@ class Manager
 
         Function(FunctionType f) : FunctionBase(), func(f) {}
 
-        virtual void execute(ParameterStream& params, int senderRank, Manager *manager, bool getReturn = false, void* object = 0) override
+        virtual void execute(ParameterStream& params, ParameterStream* result = nullptr, void* object = 0) override
         {
             assert(object);
-            assert(manager);
             OrderedCall<FunctionType> call{func, static_cast<Class*>(object), unmarshal<typename remove_all_const<Args>::type>(params)...};
-            if (getReturn)
-                manager->functionReturn(senderRank, call());
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
+            if (result)
+                *result << call();
             else
                 call();
         }
@@ -260,10 +385,11 @@ class Manager
 
         Function(void(Class::*f)(Args...)) : FunctionBase(), func(f) { }
 
-        virtual void execute(ParameterStream& params, int senderRank, Manager *manager, bool getReturn = false, void* object = 0) override
+        virtual void execute(ParameterStream& params, ParameterStream* result = nullptr, void* object = 0) override
         {
             assert(object);
             OrderedCall<FunctionType> call{func, static_cast<Class*>(object), unmarshal<typename remove_all_const<Args>::type>(params)...};
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
             call();
         }
 
@@ -282,13 +408,13 @@ class Manager
 
         Function(FunctionType& f) : FunctionBase(), func(f) {}
 
-        virtual void execute(ParameterStream &params, int senderRank, Manager *manager, bool getReturn, void *object = 0) override
+        virtual void execute(ParameterStream &params, ParameterStream* result = nullptr, void *object = 0) override
         {
-            assert(manager);
             OrderedCall<FunctionType> call{func, unmarshal<typename remove_all_const<Args>::type>(params)...};
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
 
-            if (getReturn)
-                manager->functionReturn(senderRank, call());
+            if (result)
+                *result << call();
             else
                 call();
         }
@@ -308,9 +434,10 @@ class Manager
 
         Function(FunctionType& f) : FunctionBase(), func(f) {}
 
-        virtual void execute(ParameterStream &params, int senderRank, Manager *manager, bool getReturn, void *object = 0) override
+        virtual void execute(ParameterStream &params, ParameterStream* result = nullptr, void *object = 0) override
         {
             OrderedCall<FunctionType> call{func, unmarshal<typename remove_all_const<Args>::type>(params)...};
+            MPIRPC_METRIC(Metrics::markUnmarshalled());
             call();
         }
 
@@ -321,7 +448,13 @@ public:
     //using UserMessageHandler = void(*)(MPI_Status&&);
     typedef void(*UserMessageHandler)(MPI_Status&&);
 
-    Manager(MPI_Comm comm = MPI_COMM_WORLD);
+    /**
+     * @brief Construct a Manager. This is collective over #comm.
+     * @param comm The communicator
+     * @param transport The transport used for function invocations. Replies, object
+     * registration and user messages are always sent with two-sided communication.
+     */
+    Manager(MPI_Comm comm = MPI_COMM_WORLD, Transport transport = Transport::TwoSided);
 
     /**
      * Register a type with the Manager. This assigns a unique ID to the type.
@@ -339,6 +472,56 @@ public:
         return id;
     }
 
+    /**
+     * @brief Register the layout of the trivially copyable struct T as a committed MPI datatype.
+     *
+     * Pass a pointer to each member of T, for example registerPodType(&MyType::a, &MyType::b). Members may be
+     * of any type supported by mpiType<T>(), including arrays. The datatype is resized to sizeof(T), so padding is skipped but arrays of T
+     * keep their stride.
+     *
+     * Once registered, arrays of T marked with MPIRPC_POD_TYPE(T) are sent from the caller's memory without
+     * being packed, and T can be used with reduce(), allreduce() and accumulate() along with a user MPI_Op.
+     * Must be called on every rank that sends or receives T.
+     *
+     * @return The committed datatype, which is owned by the Manager
+     */
+    template<typename T, typename... Fields>
+    MPI_Datatype registerPodType(Fields T::*... fields)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "POD types must be trivially copyable");
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        const T& t = reinterpret_cast<const T&>(storage);
+        const char* base = reinterpret_cast<const char*>(&t);
+        int blocklengths[] = {(static_cast<void>(fields), 1)...};
+        MPI_Aint offsets[] = {static_cast<MPI_Aint>(reinterpret_cast<const char*>(&(t.*fields)) - base)...};
+        MPI_Datatype types[] = {mpiType<Fields>()...};
+        MPI_Datatype structType, type;
+        MPI_Type_create_struct(sizeof...(Fields), blocklengths, offsets, types, &structType);
+        MPI_Type_create_resized(structType, 0, sizeof(T), &type);
+        MPI_Type_free(&structType);
+        MPI_Type_commit(&type);
+        auto it = m_podTypes.find(std::type_index(typeid(T)));
+        if (it != m_podTypes.end()) {
+            MPI_Type_free(&it->second);
+            it->second = type;
+        } else {
+            m_podTypes.emplace(std::type_index(typeid(T)), type);
+        }
+        return type;
+    }
+
+    /**
+     * @brief Get the datatype registered for T with registerPodType()
+     * @throws UnregisteredPodTypeException
+     */
+    template<typename T>
+    MPI_Datatype podType() const
+    {
+        return podType(std::type_index(typeid(T)));
+    }
+
+    MPI_Datatype podType(std::type_index type) const;
+
     /**
      * Get the type of a previously registered type.
      */
@@ -352,12 +535,13 @@ public:
 
     /**
      * @brief Register a lambda with the Manager
+     * @param pure See registerFunction()
      * @return The handle for the lambda
      */
     template<typename Lambda>
-    FunctionHandle registerLambda(Lambda&& l)
+    FunctionHandle registerLambda(Lambda&& l, bool pure = false)
     {
-        return registerFunction(static_cast<typename LambdaTraits<Lambda>::lambda_stdfunction>(l));
+        return registerFunction(static_cast<typename LambdaTraits<Lambda>::lambda_stdfunction>(l), pure);
     }
 
     /**
@@ -365,14 +549,19 @@ public:
      *
      * @brief Register a function or member function with the Manager
      * @param f A function pointer to the function to register
+     * @param pure True if the result of the function depends only on its arguments. The results of calls to pure
+     * functions through invokeFunctionR() are cached, see setResultCache(), and identical calls waiting for
+     * their results share them. Must be the same on every rank.
      * @return The handle associated with function #f
      */
     template<typename F, F f>
-    FunctionHandle registerFunction()
+    FunctionHandle registerFunction(bool pure = false)
     {
         FunctionBase *b = new Function<F>(f);
         m_registeredFunctions[b->id()] = b;
         m_registeredFunctionTIs[std::type_index(typeid(FunctionId<F,f>))] = b->id();
+        if (pure)
+            m_pureFunctions.insert(b->id());
         return b->id();
     }
 
@@ -380,10 +569,12 @@ public:
      * This run-time version is incompatible with fast (hash table) function ID lookups
      */
     template<typename F>
-    FunctionHandle registerFunction(F f)
+    FunctionHandle registerFunction(F f, bool pure = false)
     {
         FunctionBase *b = new Function<F>(f);
         m_registeredFunctions[b->id()] = b;
+        if (pure)
+            m_pureFunctions.insert(b->id());
         return b->id();
     }
 
@@ -468,6 +659,57 @@ public:
         return wrapper;
     }
 
+    /**
+     * @brief Replicate #object from #primary to every rank. Collective over the communicator.
+     *
+     * The primary's object is serialized with its ParameterStream operators and broadcast into #object on the
+     * other ranks, so Class must provide them. Reads are then served from the local copy. Mutations are made with
+     * invokeReplicated() and reach the replicas as deltas. Must be called in the same order on every rank.
+     *
+     * @return The replication state of the object, owned by the Manager
+     */
+    template<class Class>
+    ReplicatedObject<Class>* registerReplicatedObject(Class* object, int primary = 0)
+    {
+        std::vector<char> buffer;
+        if (m_rank == primary) {
+            ParameterStream stream(&buffer);
+            stream << *object;
+        }
+        unsigned long long size = buffer.size();
+        MPI_Bcast(&size, 1, MPI_UNSIGNED_LONG_LONG, primary, m_comm);
+        buffer.resize(size);
+        MPI_Bcast(buffer.data(), size, MPI_CHAR, primary, m_comm);
+        if (m_rank != primary) {
+            ParameterStream stream(&buffer);
+            stream >> *object;
+        }
+        ReplicatedObject<Class>* replicated = new ReplicatedObject<Class>(object, primary, [this]() {
+            if (!checkMessages())
+                throw ShutdownException();
+        });
+        registerReplicaHandlers(replicated);
+        return replicated;
+    }
+
+    /**
+     * @brief Invoke the member function #f, which mutates the object, on every copy of #replicated
+     *
+     * The call is sent to the primary, which applies it, numbers it with the next version and sends it on to the
+     * replicas. Only the member function handle and the serialized arguments are sent. The local copy changes when
+     * the call is applied here, see ReplicatedObjectBase::waitForOwnWrites(). Calls made from one rank are applied
+     * in order. Return values are discarded.
+     *
+     * @param functionHandle The handle of #f, or 0 to look it up
+     */
+    template<class Class, typename R, typename... FArgs, typename... Args>
+    void invokeReplicated(ReplicatedObject<Class>* replicated, R(Class::*f)(FArgs...), FunctionHandle functionHandle, Args&&... args)
+    {
+        if (functionHandle == 0)
+            functionHandle = memberFunctionHandle(f);
+        submitReplicaMutation(replicated, functionHandle, marshalArguments(forward_parameter_type<FArgs,Args>(args)...));
+    }
+
     /**
      * @brief invoke a function on rank #rank
      *
@@ -485,6 +727,9 @@ public:
      * Using virtual function pointer: 133,369 per second
      * Using function pointer: 136,878 per second
      *
+     * The call_handle, call_pointer and lookup_pointer results of the mpirpc_bench target reproduce these
+     * measurements for 10 to 10^4 registered functions.
+     *
      * @param rank The MPI rank to invoke the function on
      * @param f The function pointer to invoke. This function pointer must be registered with the Manager. See: Manager::registerFunction.
      * @param functionHandle The function handle for the registered function, f. If this value is 0, the function handle is searched for in the function map.
@@ -504,15 +749,13 @@ public:
             {
                 for (const auto &i : m_registeredFunctions) {
                     if (i.second->pointer() == reinterpret_cast<void(*)()>(f)) {
-                        sendFunctionInvocation(rank, i.first, true, forward_parameter_type<FArgs,Args>(args)...);
-                        return processReturn<R>(rank);
+                        return callFunction<R>(rank, i.first, forward_parameter_type<FArgs,Args>(args)...);
                     }
                 }
             }
             else
             {
-                sendFunctionInvocation(rank, functionHandle, true, forward_parameter_type<FArgs,Args>(args)...);
-                return processReturn<R>(rank);
+                return callFunction<R>(rank, functionHandle, forward_parameter_type<FArgs,Args>(args)...);
             }
             throw UnregisteredFunctionException();
         }
@@ -555,8 +798,7 @@ public:
     template<typename R, typename... Args>
     R invokeFunctionR(int rank, FunctionHandle functionHandle, Args&&... args)
     {
-        sendFunctionInvocation(rank, functionHandle, true, std::forward<Args>(args)...);
-        return processReturn<R>(rank);
+        return callFunction<R>(rank, functionHandle, std::forward<Args>(args)...);
     }
 
     /**
@@ -671,6 +913,260 @@ public:
         sendMemberFunctionInvocation(a, functionHandle, false, std::forward<Args>(args)...);
     }
 
+    /**
+     * @brief Invoke a function on rank #rank and unserialize its return value into #result
+     *
+     * Unlike Manager::invokeFunctionR(), the storage already owned by #result is reused. For example, a
+     * std::vector keeps its capacity across repeated calls.
+     *
+     * @see Manager::invokeFunction()
+     */
+    template<typename R, typename... Args>
+    void invokeFunctionInto(R& result, int rank, FunctionHandle functionHandle, Args&&... args)
+    {
+        sendFunctionInvocation(rank, functionHandle, true, std::forward<Args>(args)...);
+        processReturnInto(rank, result);
+    }
+
+    /**
+     * @see Manager::invokeFunctionInto()
+     */
+    template<typename R, typename... Args>
+    void invokeFunctionInto(R& result, ObjectWrapperBase *a, FunctionHandle functionHandle, Args&&... args)
+    {
+        sendMemberFunctionInvocation(a, functionHandle, true, std::forward<Args>(args)...);
+        processReturnInto(a->rank(), result);
+    }
+
+    /**
+     * @brief Invoke a function returning a sequence, such as a std::vector<T>, and decode the elements
+     * straight into the caller's buffer.
+     * @param out The output buffer
+     * @param capacity The number of elements #out can hold. std::length_error is thrown if the result is larger.
+     * @return The number of elements written to #out
+     */
+    template<typename T, typename... Args>
+    std::size_t invokeFunctionIntoArray(T* out, std::size_t capacity, int rank, FunctionHandle functionHandle, Args&&... args)
+    {
+        sendFunctionInvocation(rank, functionHandle, true, std::forward<Args>(args)...);
+        return processReturnIntoArray(rank, out, capacity);
+    }
+
+    /**
+     * @brief Invoke the function #functionHandle once on each rank in #perRankArgs with that rank's arguments.
+     * Collective over the Manager's communicator: every rank calls invokeScatter() with the same handle, each
+     * with the invocations it makes, which may be none.
+     *
+     * Instead of a message per rank, the serialized arguments of all ranks are exchanged at once: with one
+     * MPI_Alltoallv, or, when no rank targets more than 1/MPIRPC_SCATTER_SPARSE_FRACTION of the ranks, with
+     * sends to the targets only, completed by a non-blocking barrier. Each rank then executes the invocations
+     * it received in the order of the sending ranks. Messages are processed while waiting, as in sync().
+     *
+     * Arguments are serialized without attachments, so POD parameters are copied into the payload.
+     */
+    template<typename... Args>
+    void invokeScatter(FunctionHandle functionHandle, const std::map<int, std::tuple<Args...>>& perRankArgs)
+    {
+        scatterInvocations(functionHandle, marshalScatter(perRankArgs), false);
+    }
+
+    /**
+     * @brief As invokeScatter(), and gather the return value of each invocation back in one more exchange
+     * @return The return values by the rank which returned them
+     */
+    template<typename R, typename... Args>
+    std::map<int, R> invokeScatterR(FunctionHandle functionHandle, const std::map<int, std::tuple<Args...>>& perRankArgs)
+    {
+        std::map<int, std::vector<char>> results = scatterInvocations(functionHandle, marshalScatter(perRankArgs), true);
+        std::map<int, R> ret;
+        ArgumentArena::Suspend arena;
+        for (auto& result : results) {
+            ParameterStream stream(&result.second);
+            ret.emplace(result.first, unmarshal<R>(stream));
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Send invocations and return values whose serialized size exceeds #threshold bytes in chunks.
+     *
+     * The chunks are sent as they are serialized and the receiver unserializes while later chunks are
+     * still in flight, so neither side needs to hold the whole message. At most #window chunks may be
+     * unacknowledged per destination. Messages to this rank and to a rank which this rank is already
+     * streaming to are never chunked. To avoid ranks waiting on each other for credits, invocations are
+     * only streamed when made outside of invoked functions and return waits, and return values only when
+     * the invoked function was not itself run from within a nested wait. Other messages are sent whole.
+     *
+     * @param threshold The size at which streaming begins. 0 disables streaming, which is the default.
+     * @param chunkSize The size of each chunk after the first
+     * @param window The number of chunks which may be in flight per destination
+     */
+    void setStreaming(std::size_t threshold, std::size_t chunkSize = MPIRPC_STREAM_CHUNK_SIZE, int window = MPIRPC_STREAM_WINDOW);
+
+    /**
+     * @brief Register a codec which messages can be compressed with. Ownership of #codec is taken.
+     *
+     * Codecs must be registered on every rank which may receive messages compressed with them. LzCodec
+     * is always registered.
+     */
+    void registerCodec(Codec* codec);
+
+    /**
+     * @brief Compress the arguments of invocations and return values of at least #threshold bytes with the
+     * codec #codecId.
+     *
+     * A message is sent uncompressed if compression does not make it smaller. Streamed messages are never
+     * compressed. Compression is disabled by default.
+     *
+     * @param codecId The id of a registered codec, or 0 to disable compression
+     * @param threshold The serialized size from which messages are compressed
+     */
+    void setCompression(uint8_t codecId, std::size_t threshold = MPIRPC_CODEC_THRESHOLD);
+
+    /**
+     * @brief Limit the invocations sent to each destination which it has not yet run to #maxMessages messages
+     * and #maxBytes bytes.
+     *
+     * Each invocation sent under flow control carries MPIRPC_FLAG_CREDIT. The destination returns a credit for
+     * it once it has been run, so both the send queue of this rank and the invocations waiting on the
+     * destination are bounded. A send which would exceed either limit makes progress, servicing invocations
+     * from other ranks, until enough credits have been returned. A single invocation larger than #maxBytes is
+     * sent once nothing else is outstanding. Only the sending rank needs to enable flow control. It is disabled
+     * by default. See: flowControlStats()
+     *
+     * @param maxMessages The number of invocations which may be outstanding per destination. 0 for no limit.
+     * @param maxBytes The number of bytes which may be outstanding per destination. 0 for no limit.
+     */
+    void setFlowControl(int maxMessages = MAX_MPI_QUEUE, std::size_t maxBytes = MPIRPC_FLOW_CONTROL_BYTES);
+
+    /**
+     * @brief The flow control state and counters for the invocations sent to #rank
+     */
+    FlowControlStats flowControlStats(int rank) const;
+
+    /**
+     * @brief Send the invocations of #functionHandle made from this rank on the lane for #priority
+     *
+     * Invocations of functions without a priority use the Normal lane, or the Bulk lane once they reach the
+     * bulk threshold. Invocations sent as streams always use the Normal lane. Priorities have no effect with the
+     * OneSided transport, whose rings deliver every invocation in order. See: Priority
+     */
+    void setPriority(FunctionHandle functionHandle, Priority priority);
+
+    /**
+     * @brief Send invocations of functions without a priority whose serialized size is at least #threshold bytes
+     * on the Bulk lane. 0, the default, disables this.
+     *
+     * Small and large invocations of such a function then travel on different lanes and may run out of order.
+     * Give functions whose invocations depend on each other a priority. The Manager does so for the functions
+     * it registers for replicated objects and distributed maps.
+     */
+    void setBulkThreshold(std::size_t threshold);
+
+    /**
+     * @brief The lane an invocation of #functionHandle of #size serialized bytes is sent on
+     */
+    Priority lane(FunctionHandle functionHandle, std::size_t size) const;
+
+    /**
+     * @brief Run at most #budget invocations from #lane on each pass of checkMessages(), so that a busy lane
+     * cannot hold back the lanes after it. 0 for no limit.
+     *
+     * By default only the Bulk lane is limited, to MPIRPC_BULK_LANE_BUDGET invocations.
+     */
+    void setLaneBudget(Priority lane, int budget);
+
+    /**
+     * @brief The invocation metrics of this rank. Only collected when MPIRPC is built with USE_METRICS defined,
+     * otherwise they stay empty.
+     */
+    Metrics& metrics();
+    const Metrics& metrics() const;
+
+    /**
+     * @brief Write metrics() as JSON to the file #path. See: Metrics::writeJson()
+     * @return False if the file could not be written
+     */
+    bool writeMetrics(const std::string& path) const;
+
+    /**
+     * @brief Record a timeline of sends, receives, dispatches, executions, replies, return waits and syncs.
+     * Collective over the Manager's communicator.
+     *
+     * The clock of every rank is compared with that of rank 0 by ping-pong, keeping the round with the shortest
+     * round trip, so the timelines of all ranks line up. When the Manager is destroyed, each rank writes its
+     * events to #path.<rank>.json in the Chrome trace event format, see Tracer.
+     *
+     * @param capacity The number of events kept per thread. Older events are overwritten.
+     */
+    void enableTracing(const std::string& path, std::size_t capacity = MPIRPC_TRACE_CAPACITY);
+
+    /**
+     * @brief Write the events recorded so far to the file given to enableTracing()
+     * @return False if tracing is disabled or the file could not be written
+     */
+    bool writeTrace() const;
+
+    Tracer& tracer();
+
+    /**
+     * @brief The arena holding the pointer, C string and C array arguments of the invocation being executed.
+     * Each dispatched invocation releases what it allocated there once the function returns.
+     */
+    const ArgumentArena& argumentArena() const;
+
+    /**
+     * @brief Split reductions into caller or input buffers which are larger than #segmentSize bytes into segments.
+     *
+     * Up to #window segments are reduced at once with non-blocking collectives, so the reduction of one segment
+     * overlaps with the communication of the next. Invocations are serviced while waiting. Must be set to the same
+     * values on every rank. Segmentation is disabled by default.
+     *
+     * @param segmentSize The size of each segment in bytes. 0 disables segmentation.
+     * @param window The number of segments in flight
+     */
+    void setReduceSegmentation(std::size_t segmentSize = MPIRPC_REDUCE_SEGMENT_SIZE, int window = MPIRPC_REDUCE_WINDOW);
+
+    /**
+     * @brief Use up to #threads threads for the local phase of accumulate(), iaccumulate(), and the scans of
+     * distributed vectors.
+     *
+     * The local range is split between the threads only if its elements have the type of the result and it is
+     * large enough, and the operation must then be associative, and commutative if declared so by
+     * is_commutative_op. With the default of 1 thread the range is accumulated in order with std::accumulate.
+     * See: mpirpc::accumulate().
+     *
+     * @param threads The number of threads, or 0 for std::thread::hardware_concurrency()
+     */
+    void setAccumulateThreads(int threads);
+
+    /**
+     * @brief Cache up to #capacity bytes of the arguments and results of calls to pure functions.
+     *
+     * The least recently used results are evicted first. Caching is disabled by default. Calls to pure functions
+     * which are waiting for identical calls are merged whether or not caching is enabled.
+     * See: registerFunction()
+     *
+     * @param capacity The capacity in bytes. 0 disables caching.
+     */
+    void setResultCache(std::size_t capacity = MPIRPC_RESULT_CACHE_SIZE);
+
+    /**
+     * @brief Forget the cached results of #functionHandle, or of every pure function if it is 0, on #rank, or on
+     * every rank if it is negative. Results of calls still waiting are not cached.
+     */
+    void invalidateResults(FunctionHandle functionHandle = 0, int rank = -1);
+
+    /**
+     * @brief The counters of the cache of pure function results
+     */
+    const ResultCacheStats& resultCacheStats() const;
+
+    /**
+     * @brief The compression counters of codec #codecId
+     */
+    const CodecStats& codecStats(uint8_t codecId) const;
+
     /**
      * @brief Get the MPI rank of this process
      * @return The MPI rank of this process
@@ -767,86 +1263,432 @@ public:
         return getObjectsOfType(getTypeId<Class>());
     }
 
+    /**
+     * @brief The datatype, and how many of it make up a T, used to reduce T with #op.
+     *
+     * Arrays are reduced as their elements with predefined operations, which only accept predefined datatypes, and
+     * whole with user-defined operations, such as those created with makeOp().
+     */
+    template<typename T>
+    std::pair<MPI_Datatype, int> reduceType(MPI_Op op) const
+    {
+        using E = MpiElementType<T>;
+        if (isPredefinedOp(op))
+            return std::make_pair(datatype<typename E::type>(), static_cast<int>(E::count));
+        return std::make_pair(datatype<T>(), 1);
+    }
+
+    /**
+     * @brief The MPI datatype for T: mpiType<T>() if MpiTypeTraits knows T, otherwise the datatype registered
+     * with registerPodType().
+     */
+    template<typename T, typename std::enable_if<MpiTypeTraits<T>::supported>::type* = nullptr>
+    MPI_Datatype datatype() const
+    {
+        return mpiType<T>();
+    }
+
+    template<typename T, typename std::enable_if<!MpiTypeTraits<T>::supported>::type* = nullptr>
+    MPI_Datatype datatype() const
+    {
+        return podType<T>();
+    }
+
     template<typename T>
     std::vector<T> reduce(std::vector<T>& vec, MPI_Op op, int root)
     {
+        auto type = reduceType<T>(op);
         int vecsize = vec.size();
         std::vector<T> res(vecsize);
-        MPI_Reduce(vec.data(), res.data(), vecsize, mpiType<T>(), op, root, m_comm);
+        MPI_Reduce(vec.data(), res.data(), vecsize*type.second, type.first, op, root, m_comm);
         return res;
     }
 
     template<typename T>
     std::vector<T> allreduce(std::vector<T>& vec,  MPI_Op op)
     {
+        auto type = reduceType<T>(op);
         int vecsize = vec.size();
         std::vector<T> res(vecsize);
-        MPI_Allreduce(vec.data(), res.data(), vecsize, mpiType<T>(), op, m_comm);
+        MPI_Allreduce(vec.data(), res.data(), vecsize*type.second, type.first, op, m_comm);
         return res;
     }
 
     template<typename T>
     T* reduce(T* first, T* last, MPI_Op mpiOp, int root)
     {
+        auto type = reduceType<T>(mpiOp);
         std::size_t size = last-first;
         T* res = new T[size];
-        MPI_Reduce(first, res, size, mpiType<T>(), mpiOp, root, m_comm);
+        MPI_Reduce(first, res, size*type.second, type.first, mpiOp, root, m_comm);
         return res;
     }
 
     template<typename T>
     T* allreduce(T* first, T* last, MPI_Op mpiOp)
     {
+        auto type = reduceType<T>(mpiOp);
         std::size_t size = last-first;
         T* res = new T[size];
-        MPI_Allreduce(first, res, size, mpiType<T>(), mpiOp, m_comm);
+        MPI_Allreduce(first, res, size*type.second, type.first, mpiOp, m_comm);
         return res;
     }
 
-    template<class InputIt, class T, class BinaryOperation>
-    T accumulate( InputIt first, InputIt last, T init, BinaryOperation op, MPI_Op mpiOp)
+    /**
+     * @brief Reduce [#first, #last) to #root into the caller's buffer #out, which is only written at #root
+     * and must hold last-first elements there.
+     * @see Manager::setReduceSegmentation()
+     */
+    template<typename T>
+    void reduce(const T* first, const T* last, T* out, MPI_Op mpiOp, int root)
     {
-        T intermediate = std::accumulate(first, last, init, op);
-        T res;
-        MPI_Allreduce(&intermediate, &res, 1, mpiType<T>(), mpiOp, m_comm);
-        return res;
+        reduceInto(first, out, last-first, mpiOp, root);
     }
 
-    template<class InputIt>
-    typename std::iterator_traits<InputIt>::value_type
-    accumulate( InputIt first, InputIt last)
+    /**
+     * @brief Allreduce [#first, #last) into the caller's buffer #out, which must hold last-first elements.
+     * @see Manager::setReduceSegmentation()
+     */
+    template<typename T>
+    void allreduce(const T* first, const T* last, T* out, MPI_Op mpiOp)
     {
-        typename std::iterator_traits<InputIt>::value_type intermediate = std::accumulate(first, last, static_cast<typename std::iterator_traits<InputIt>::value_type>(0));
-        typename std::iterator_traits<InputIt>::value_type res;
-        MPI_Allreduce(&intermediate, &res, 1, mpiType<typename std::iterator_traits<InputIt>::value_type>(), MPI_SUM, m_comm);
-        return res;
+        reduceInto(first, out, last-first, mpiOp, -1);
     }
 
     /**
-     * @brief Get an object's wrapper, given it's id.
-     * @param id The id of the object
-     * @return The object wrapper
+     * @brief Reduce #vec to #root into #out, which is resized to the size of #vec if necessary.
      */
-    ObjectWrapperBase* getObjectWrapper(int rank, TypeId tid, ObjectId oid) const;
+    template<typename T>
+    void reduce(const std::vector<T>& vec, std::vector<T>& out, MPI_Op op, int root)
+    {
+        out.resize(vec.size());
+        reduceInto(vec.data(), out.data(), vec.size(), op, root);
+    }
 
     /**
-     * @brief Register a custom message handler to be invoked when an MPI message has been probed with tag #tag.
-     * @param tag The tag identifying this type of message.
-     * @param callback A void(*)(MPI_Status&&) function pointer. This function should handle the MPI_Recv.
+     * @brief Allreduce #vec into #out, which is resized to the size of #vec if necessary.
      */
-    void registerUserMessageHandler(int tag, UserMessageHandler callback);
+    template<typename T>
+    void allreduce(const std::vector<T>& vec, std::vector<T>& out, MPI_Op op)
+    {
+        out.resize(vec.size());
+        reduceInto(vec.data(), out.data(), vec.size(), op, -1);
+    }
 
     /**
-     * @brief Send a buffer to rank #rank with tag #tag
+     * @brief Reduce [#first, #last) to #root using MPI_IN_PLACE. At #root the input is replaced by the result.
+     * Elsewhere it is left unchanged.
      */
-    void sendRawMessage(int rank, const std::vector<char> *data, int tag = 0);
+    template<typename T>
+    void reduceInPlace(T* first, T* last, MPI_Op mpiOp, int root)
+    {
+        reduceInto(first, first, last-first, mpiOp, root);
+    }
 
     /**
-     * @brief Send a buffer to every other rank with tag #tag
-     *
-     * Does not send to self.
+     * @brief Allreduce [#first, #last) using MPI_IN_PLACE, replacing the input with the result.
      */
-    void sendRawMessageToAll(const std::vector<char> *data, int tag = 0);
+    template<typename T>
+    void allreduceInPlace(T* first, T* last, MPI_Op mpiOp)
+    {
+        reduceInto(first, first, last-first, mpiOp, -1);
+    }
+
+    template<typename T>
+    void reduceInPlace(std::vector<T>& vec, MPI_Op op, int root)
+    {
+        reduceInto(vec.data(), vec.data(), vec.size(), op, root);
+    }
+
+    template<typename T>
+    void allreduceInPlace(std::vector<T>& vec, MPI_Op op)
+    {
+        reduceInto(vec.data(), vec.data(), vec.size(), op, -1);
+    }
+
+    template<class InputIt, class T, class BinaryOperation>
+    T accumulate( InputIt first, InputIt last, T init, BinaryOperation op, MPI_Op mpiOp)
+    {
+        auto type = reduceType<T>(mpiOp);
+        T intermediate = mpirpc::accumulate(first, last, init, op, m_accumulateThreads);
+        T res;
+        MPI_Allreduce(&intermediate, &res, type.second, type.first, mpiOp, m_comm);
+        return res;
+    }
+
+    template<class InputIt>
+    typename std::iterator_traits<InputIt>::value_type
+    accumulate( InputIt first, InputIt last)
+    {
+        using T = typename std::iterator_traits<InputIt>::value_type;
+        T intermediate = mpirpc::accumulate(first, last, static_cast<T>(0), std::plus<T>(), m_accumulateThreads);
+        T res;
+        MPI_Allreduce(&intermediate, &res, 1, datatype<T>(), MPI_SUM, m_comm);
+        return res;
+    }
+
+    /**
+     * @brief Start a reduction of #vec to #root without blocking.
+     *
+     * The reduction completes while this rank continues to service invocations from checkMessages(). Like all
+     * collectives, non-blocking reductions must be started in the same order on every rank.
+     *
+     * @return A future for the result, which is only meaningful at #root
+     */
+    template<typename T>
+    ReduceFuture<std::vector<T>> ireduce(std::vector<T> vec, MPI_Op op, int root)
+    {
+        auto type = reduceType<T>(op);
+        auto state = std::make_shared<ReduceState<std::vector<T>>>();
+        state->input = std::move(vec);
+        state->result.resize(state->input.size());
+        MPI_Ireduce(state->input.data(), state->result.data(), state->input.size()*type.second, type.first, op, root, m_comm, state->begin());
+        return trackReduction(state);
+    }
+
+    /**
+     * @brief Start an allreduce of #vec without blocking.
+     * @see Manager::ireduce()
+     */
+    template<typename T>
+    ReduceFuture<std::vector<T>> iallreduce(std::vector<T> vec, MPI_Op op)
+    {
+        auto type = reduceType<T>(op);
+        auto state = std::make_shared<ReduceState<std::vector<T>>>();
+        state->input = std::move(vec);
+        state->result.resize(state->input.size());
+        MPI_Iallreduce(state->input.data(), state->result.data(), state->input.size()*type.second, type.first, op, m_comm, state->begin());
+        return trackReduction(state);
+    }
+
+    /**
+     * @brief Accumulate [#first, #last) locally with #op, then start an allreduce of the result with #mpiOp without blocking.
+     * @see Manager::ireduce()
+     */
+    template<class InputIt, class T, class BinaryOperation>
+    ReduceFuture<T> iaccumulate(InputIt first, InputIt last, T init, BinaryOperation op, MPI_Op mpiOp)
+    {
+        auto type = reduceType<T>(mpiOp);
+        auto state = std::make_shared<ReduceState<T>>();
+        state->input = mpirpc::accumulate(first, last, init, op, m_accumulateThreads);
+        MPI_Iallreduce(&state->input, &state->result, type.second, type.first, mpiOp, m_comm, state->begin());
+        return trackReduction(state);
+    }
+
+    /**
+     * @brief Create a reduction of #size elements to #root which can be started repeatedly without reallocating its buffers.
+     * Collective over the communicator.
+     */
+    template<typename T>
+    std::shared_ptr<PersistentReduce<T>> persistentReduce(std::size_t size, MPI_Op op, int root)
+    {
+        auto type = reduceType<T>(op);
+        return std::make_shared<PersistentReduce<T>>(size, type.first, type.second, op, root, m_comm,
+                                                     [this]() { progressReduction(); },
+                                                     [this](std::shared_ptr<PendingReduce> p) { m_pendingReductions.push_back(p); });
+    }
+
+    /**
+     * @brief Create an allreduce of #size elements which can be started repeatedly without reallocating its buffers.
+     * @see Manager::persistentReduce()
+     */
+    template<typename T>
+    std::shared_ptr<PersistentReduce<T>> persistentAllreduce(std::size_t size, MPI_Op op)
+    {
+        return persistentReduce<T>(size, op, -1);
+    }
+
+    /**
+     * @brief Create an array of #size elements block-distributed over the communicator, accessed with one-sided
+     * MPI operations using datatype<T>(). Collective over the communicator.
+     */
+    template<typename T>
+    std::shared_ptr<DistributedArray<T>> distributedArray(std::size_t size)
+    {
+        return std::make_shared<DistributedArray<T>>(m_comm, size, datatype<T>());
+    }
+
+    /**
+     * @brief The inclusive scan of #value over the ranks, using MPI_Scan.
+     */
+    template<typename T>
+    T scan(const T& value, MPI_Op op)
+    {
+        auto type = reduceType<T>(op);
+        T res;
+        MPI_Scan(&value, &res, type.second, type.first, op, m_comm);
+        return res;
+    }
+
+    /**
+     * @brief The exclusive scan of #value over the ranks, using MPI_Exscan. Rank 0, where the result of
+     * MPI_Exscan is undefined, gets #first.
+     */
+    template<typename T>
+    T exscan(const T& value, MPI_Op op, const T& first = T())
+    {
+        auto type = reduceType<T>(op);
+        T res = first;
+        MPI_Exscan(&value, &res, type.second, type.first, op, m_comm);
+        if (m_rank == 0)
+            res = first;
+        return res;
+    }
+
+    /**
+     * @brief Replace #vec with the inclusive scan under #op of the sequence formed by #vec on every rank, in rank order.
+     *
+     * The local total is accumulated and the totals of the preceding ranks are combined with exscan() under #mpiOp,
+     * which must match #op. #vec is then scanned locally, starting from that offset. Both local passes use the
+     * threads set with setAccumulateThreads(). Collective over the communicator.
+     *
+     * @param identity The identity of #op, which is the offset of rank 0
+     */
+    template<typename T, class BinaryOperation>
+    void scan(std::vector<T>& vec, T identity, BinaryOperation op, MPI_Op mpiOp)
+    {
+        T total = mpirpc::accumulate(vec.begin(), vec.end(), identity, op, m_accumulateThreads);
+        T offset = exscan(total, mpiOp, identity);
+        mpirpc::inclusiveScan(vec.begin(), vec.end(), offset, op, m_accumulateThreads);
+    }
+
+    /**
+     * @brief Replace #vec with the prefix sums of the sequence formed by #vec on every rank, in rank order.
+     */
+    template<typename T>
+    void scan(std::vector<T>& vec)
+    {
+        scan(vec, static_cast<T>(0), std::plus<T>(), MPI_SUM);
+    }
+
+    /**
+     * @brief Replace #vec with the exclusive scan under #op of the sequence formed by #vec on every rank, in rank order.
+     * The first element on rank 0 becomes #identity.
+     * @see Manager::scan()
+     */
+    template<typename T, class BinaryOperation>
+    void exscan(std::vector<T>& vec, T identity, BinaryOperation op, MPI_Op mpiOp)
+    {
+        T total = mpirpc::accumulate(vec.begin(), vec.end(), identity, op, m_accumulateThreads);
+        T offset = exscan(total, mpiOp, identity);
+        mpirpc::exclusiveScan(vec.begin(), vec.end(), offset, op, m_accumulateThreads);
+    }
+
+    /**
+     * @brief Replace #vec with the exclusive prefix sums of the sequence formed by #vec on every rank, in rank order.
+     */
+    template<typename T>
+    void exscan(std::vector<T>& vec)
+    {
+        exscan(vec, static_cast<T>(0), std::plus<T>(), MPI_SUM);
+    }
+
+    /**
+     * @brief Sort the elements of #vec on every rank together with a parallel sample sort.
+     *
+     * Each rank sorts its elements and contributes numProcs()-1 evenly spaced samples. Every rank picks the same
+     * splitters from the sorted samples, and the elements are exchanged so that rank r holds the r-th range of the
+     * global order. The sorted runs received from each rank are then merged. The number of elements held by each rank
+     * changes. Collective over the communicator.
+     *
+     * Types with an MPI datatype, see datatype(), are exchanged directly. Others are serialized with their
+     * ParameterStream operators.
+     */
+    template<typename T, class Compare = std::less<T>>
+    void sort(std::vector<T>& vec, Compare comp = Compare())
+    {
+        std::sort(vec.begin(), vec.end(), comp);
+        int procs = numProcs();
+        if (procs == 1)
+            return;
+        std::vector<T> samples;
+        int sampleCount = vec.empty() ? 0 : procs - 1;
+        samples.reserve(procs*sampleCount);
+        for (int r = 0; r < procs; ++r)
+            for (int i = 1; i <= sampleCount; ++i)
+                samples.push_back(vec[i*vec.size()/procs]);
+        samples = exchange(samples, std::vector<int>(procs, sampleCount));
+        if (samples.empty())
+            return;
+        std::sort(samples.begin(), samples.end(), comp);
+        std::vector<int> counts(procs);
+        auto begin = vec.begin();
+        for (int r = 0; r < procs - 1; ++r) {
+            auto end = std::upper_bound(begin, vec.end(), samples[(r+1)*samples.size()/procs], comp);
+            counts[r] = end - begin;
+            begin = end;
+        }
+        counts[procs-1] = vec.end() - begin;
+        std::vector<int> received;
+        vec = exchange(vec, counts, &received);
+        std::vector<std::size_t> bounds(procs + 1, 0);
+        for (int r = 0; r < procs; ++r)
+            bounds[r+1] = bounds[r] + received[r];
+        for (int w = 1; w < procs; w *= 2)
+            for (int r = 0; r + w < procs; r += 2*w)
+                std::inplace_merge(vec.begin() + bounds[r], vec.begin() + bounds[r+w], vec.begin() + bounds[std::min(r + 2*w, procs)], comp);
+    }
+
+    /**
+     * @brief Send each element of #vec to the rank returned by #keyToRank for it and replace #vec with the elements
+     * received, grouped by source rank in rank order. Each group keeps the order it had on its source rank.
+     * Collective over the communicator.
+     *
+     * @see Manager::sort() for how elements are exchanged
+     * @throws std::out_of_range if #keyToRank returns a rank outside the communicator. Other ranks are not notified.
+     */
+    template<typename T, class KeyToRank>
+    void partition(std::vector<T>& vec, KeyToRank keyToRank)
+    {
+        int procs = numProcs();
+        std::vector<int> dest(vec.size());
+        std::vector<int> counts(procs, 0);
+        for (std::size_t i = 0; i < vec.size(); ++i) {
+            int r = keyToRank(static_cast<const T&>(vec[i]));
+            if (r < 0 || r >= procs)
+                throw std::out_of_range("partition: rank outside the communicator");
+            dest[i] = r;
+            ++counts[r];
+        }
+        std::vector<std::size_t> offsets(procs, 0);
+        for (int r = 1; r < procs; ++r)
+            offsets[r] = offsets[r-1] + counts[r-1];
+        std::vector<T> grouped(vec.size());
+        for (std::size_t i = 0; i < vec.size(); ++i)
+            grouped[offsets[dest[i]]++] = std::move(vec[i]);
+        vec = exchange(grouped, counts);
+    }
+
+    /**
+     * @brief Get an object's wrapper, given it's id.
+     * @param id The id of the object
+     * @return The object wrapper
+     */
+    ObjectWrapperBase* getObjectWrapper(int rank, TypeId tid, ObjectId oid) const;
+
+    /**
+     * @brief Register a custom message handler to be invoked when an MPI message has been probed with tag #tag.
+     * @param tag The tag identifying this type of message.
+     * @param callback A void(*)(MPI_Status&&) function pointer. This function should handle the MPI_Recv.
+     */
+    void registerUserMessageHandler(int tag, UserMessageHandler callback);
+
+    /**
+     * @brief Send a buffer to rank #rank with tag #tag
+     */
+    void sendRawMessage(int rank, const std::vector<char> *data, int tag = 0);
+
+    /**
+     * @brief Send a buffer to rank #rank with tag #tag on the communicator #comm
+     */
+    void sendRawMessage(int rank, const std::vector<char> *data, int tag, MPI_Comm comm);
+
+    /**
+     * @brief Send a buffer to every other rank with tag #tag
+     *
+     * Does not send to self.
+     */
+    void sendRawMessageToAll(const std::vector<char> *data, int tag = 0);
 
     /**
      * @brief Executes an MPI_Barrier, then checks messages to ensure the state of all Managers are in a valid state.
@@ -888,20 +1730,11 @@ public:
 protected:
 
     /**
-     * @brief Send the result of executing a function back to the sending rank.
+     * @brief Send the serialized result of executing a function back to the sending rank.
      * @param rank The rank which invoked the function
-     * @param r The invoked functions return value
+     * @param buffer The invoked function's serialized return value. Ownership is taken.
      */
-    template<typename R>
-    void functionReturn(int rank, R r)
-    {
-        MPI_Status status;
-        std::vector<char>* buffer = new std::vector<char>();
-        ParameterStream stream(buffer);
-        stream << r;
-        MPI_Send((void*) stream.dataVector()->data(), stream.size(), MPI_CHAR, rank, MPIRPC_TAG_RETURN, m_comm);
-        delete buffer;
-    }
+    void sendReturn(int rank, std::vector<char>* buffer);
 
     /**
      * @brief Invoke a function on a remote process
@@ -918,11 +1751,25 @@ protected:
     template<typename... Args>
     void sendFunctionInvocation(int rank, FunctionHandle functionHandle, bool getReturn, Args... args)
     {
+        MPIRPC_METRIC(auto start = Metrics::now());
         std::vector<char>* buffer = new std::vector<char>();
         ParameterStream stream(buffer);
-        stream << functionHandle << getReturn;
+        OutgoingStream outgoing(rank, MPIRPC_TAG_INVOKE);
+        beginOutgoingStream(stream, outgoing);
+        std::vector<MPI_Request> attachments;
+        beginAttachments(stream, rank, attachments);
+        InvocationHeader header;
+        header.flags = getReturn ? MPIRPC_FLAG_RETURN : 0;
+        header.functionHandle = functionHandle;
+        stream << header;
+        std::size_t headerLength = buffer->size();
         Passer p{(stream << args, 0)...};
-        sendRawMessage(rank, stream.dataVector(), MPIRPC_TAG_INVOKE);
+        if (!endOutgoingStream(stream, outgoing)) {
+            std::vector<char>* message = compressMessage(stream.dataVector(), headerLength);
+            MPIRPC_METRIC(recordSend(functionHandle, rank, message->size(), Metrics::since(start)));
+            sendInvocationMessage(rank, message, MPIRPC_TAG_INVOKE, lane(functionHandle, message->size()));
+        }
+        waitForAttachments(attachments);
     }
 
     /**
@@ -933,41 +1780,526 @@ protected:
     template<typename... Args>
     void sendMemberFunctionInvocation(ObjectWrapperBase *a, FunctionHandle functionHandle, bool getReturn, Args... args)
     {
+        MPIRPC_METRIC(auto start = Metrics::now());
         std::vector<char>* buffer = new std::vector<char>();
         ParameterStream stream(buffer);
-        stream << a->type() << a->id();
-        stream << functionHandle << getReturn;
+        OutgoingStream outgoing(a->rank(), MPIRPC_TAG_INVOKE_MEMBER);
+        beginOutgoingStream(stream, outgoing);
+        std::vector<MPI_Request> attachments;
+        beginAttachments(stream, a->rank(), attachments);
+        InvocationHeader header;
+        header.flags = MPIRPC_FLAG_MEMBER | (getReturn ? MPIRPC_FLAG_RETURN : 0);
+        header.functionHandle = functionHandle;
+        header.typeId = a->type();
+        header.objectId = a->id();
+        stream << header;
+        std::size_t headerLength = buffer->size();
+        Passer p{(stream << args, 0)...};
+        if (!endOutgoingStream(stream, outgoing)) {
+            std::vector<char>* message = compressMessage(stream.dataVector(), headerLength);
+            MPIRPC_METRIC(recordSend(functionHandle, a->rank(), message->size(), Metrics::since(start)));
+            sendInvocationMessage(a->rank(), message, MPIRPC_TAG_INVOKE_MEMBER, lane(functionHandle, message->size()));
+        }
+        waitForAttachments(attachments);
+    }
+
+    /**
+     * @brief Send the arrays of POD parameters written to #stream to #rank straight from the caller's memory,
+     * using their registered datatypes, as they are serialized. The requests are appended to #requests.
+     */
+    void beginAttachments(ParameterStream& stream, int rank, std::vector<MPI_Request>& requests);
+
+    /**
+     * @brief Make progress until the attachments sent by beginAttachments() have been received, after which
+     * the caller's arrays may be modified again.
+     */
+    void waitForAttachments(std::vector<MPI_Request>& requests);
+
+    /**
+     * @brief Reduce #size elements of #in into #out at #root, or at every rank if #root is negative. The reduction
+     * is done in place if #in is #out. Large arrays are reduced in segments. See: setReduceSegmentation().
+     */
+    template<typename T>
+    void reduceInto(const T* in, T* out, std::size_t size, MPI_Op op, int root)
+    {
+        auto type = reduceType<T>(op);
+        bool inPlace = in == out && (root < 0 || root == m_rank);
+        //The receive buffer is only significant at the root. Elsewhere it must not alias the send buffer.
+        T* recvbuf = (root >= 0 && root != m_rank) ? nullptr : out;
+        std::size_t segment = m_reduceSegmentSize ? std::max<std::size_t>(1, m_reduceSegmentSize/sizeof(T)) : size;
+        if (size <= segment) {
+            const void* sendbuf = inPlace ? MPI_IN_PLACE : in;
+            if (root < 0)
+                MPI_Allreduce(sendbuf, out, size*type.second, type.first, op, m_comm);
+            else
+                MPI_Reduce(sendbuf, recvbuf, size*type.second, type.first, op, root, m_comm);
+            return;
+        }
+        std::deque<MPI_Request> inFlight;
+        for (std::size_t offset = 0; offset < size; offset += segment) {
+            if (inFlight.size() >= static_cast<std::size_t>(m_reduceWindow)) {
+                waitForReduction(inFlight.front());
+                inFlight.pop_front();
+            }
+            std::size_t n = std::min(segment, size - offset);
+            const void* sendbuf = inPlace ? MPI_IN_PLACE : in + offset;
+            MPI_Request req;
+            if (root < 0)
+                MPI_Iallreduce(sendbuf, out + offset, n*type.second, type.first, op, m_comm, &req);
+            else
+                MPI_Ireduce(sendbuf, recvbuf ? recvbuf + offset : nullptr, n*type.second, type.first, op, root, m_comm, &req);
+            inFlight.push_back(req);
+        }
+        for (MPI_Request& req : inFlight)
+            waitForReduction(req);
+    }
+
+    /**
+     * @brief The handle with which the member function #f was registered
+     * @throws UnregisteredFunctionException
+     */
+    template<typename R, class Class, typename... FArgs>
+    FunctionHandle memberFunctionHandle(R(Class::*f)(FArgs...)) const
+    {
+        for (const auto &i : m_registeredFunctions)
+        {
+            Function<R(Class::*)(FArgs...)>* func = dynamic_cast<Function<R(Class::*)(FArgs...)>*>(i.second);
+            if (func && func->func == f)
+                return func->id();
+        }
+        throw UnregisteredFunctionException();
+    }
+
+    template<typename... Args>
+    std::map<int, std::vector<char>> marshalScatter(const std::map<int, std::tuple<Args...>>& perRankArgs)
+    {
+        std::map<int, std::vector<char>> payloads;
+        for (const auto& i : perRankArgs) {
+            if (i.first < 0 || i.first >= m_numProcs)
+                throw std::out_of_range("invokeScatter: no such rank");
+            ParameterStream stream(&payloads[i.first]);
+            mpirpc::apply([&stream](const Args&... args) { Passer p{(stream << args, 0)...}; }, i.second);
+        }
+        return payloads;
+    }
+
+    /**
+     * @brief Exchange the scatter #payloads by destination, execute the invocations received and, if
+     * #gatherResults is set, send their serialized return values back.
+     * @return The serialized return values by the rank which returned them
+     */
+    std::map<int, std::vector<char>> scatterInvocations(FunctionHandle functionHandle, const std::map<int, std::vector<char>>& payloads, bool gatherResults);
+
+    /**
+     * @brief Send #payloads[rank] to each rank and receive the payloads sent to this rank, by source
+     */
+    std::map<int, std::vector<char>> exchangePayloads(const std::map<int, std::vector<char>>& payloads, bool sparse);
+    std::map<int, std::vector<char>> exchangeDense(const std::map<int, std::vector<char>>& payloads);
+    std::map<int, std::vector<char>> exchangeSparse(const std::map<int, std::vector<char>>& payloads);
+
+    /**
+     * @brief Process messages until #request completes
+     */
+    void waitProcessing(MPI_Request& request);
+
+    /**
+     * @brief Serialize #args into a buffer which can itself be sent as an argument
+     */
+    template<typename... Args>
+    static std::vector<uint8_t> marshalArguments(Args... args)
+    {
+        std::vector<char> buffer;
+        ParameterStream stream(&buffer);
         Passer p{(stream << args, 0)...};
-        sendRawMessage(a->rank(), stream.dataVector(), MPIRPC_TAG_INVOKE_MEMBER);
+        return std::vector<uint8_t>(buffer.begin(), buffer.end());
     }
 
+    /**
+     * @brief Register the functions through which mutations of #replicated reach the primary and the replicas
+     */
+    void registerReplicaHandlers(ReplicatedObjectBase* replicated);
+
+    /**
+     * @brief Send a mutation of #replicated to its primary, or apply it if this rank is the primary
+     */
+    void submitReplicaMutation(ReplicatedObjectBase* replicated, FunctionHandle functionHandle, std::vector<uint8_t>&& arguments);
+
+    /**
+     * @brief At the primary, apply a mutation as the next version and send it to the replicas
+     */
+    void applyReplicaMutation(ReplicatedObjectBase* replicated, ReplicatedObjectBase::Delta&& delta);
+
+    /**
+     * @brief At a replica, apply #delta if it is the next version, otherwise hold it until it is
+     */
+    void receiveReplicaDelta(ReplicatedObjectBase* replicated, uint64_t version, ReplicatedObjectBase::Delta&& delta);
+
+    /**
+     * @brief Execute #delta on the local copy of #replicated, which becomes #version
+     */
+    void applyReplicaDelta(ReplicatedObjectBase* replicated, uint64_t version, const ReplicatedObjectBase::Delta& delta);
+
+    /**
+     * @brief Send #counts[r] consecutive elements of #data to each rank r with MPI_Alltoallv and return the elements
+     * received, in rank order. The number of elements received from each rank is stored in #recvCounts if given.
+     */
+    template<typename T>
+    std::vector<T> exchange(const std::vector<T>& data, const std::vector<int>& counts, std::vector<int>* recvCounts = nullptr)
+    {
+        std::vector<int> received(numProcs());
+        MPI_Alltoall(counts.data(), 1, MPI_INT, received.data(), 1, MPI_INT, m_comm);
+        using typed = std::integral_constant<bool, MpiTypeTraits<T>::supported || is_pod_parameter<T>::value>;
+        std::vector<T> result = exchange(data, counts, received, typed());
+        if (recvCounts)
+            *recvCounts = std::move(received);
+        return result;
+    }
+
+    template<typename T>
+    std::vector<T> exchange(const std::vector<T>& data, const std::vector<int>& counts, const std::vector<int>& received, std::true_type)
+    {
+        std::vector<int> sendDispls = displacements(counts);
+        std::vector<int> recvDispls = displacements(received);
+        std::vector<T> result(recvDispls.back() + received.back());
+        MPI_Datatype type = datatype<T>();
+        MPI_Alltoallv(data.data(), counts.data(), sendDispls.data(), type,
+                      result.data(), received.data(), recvDispls.data(), type, m_comm);
+        return result;
+    }
+
+    template<typename T>
+    std::vector<T> exchange(const std::vector<T>& data, const std::vector<int>& counts, const std::vector<int>& received, std::false_type)
+    {
+        int procs = numProcs();
+        std::vector<char> sendBuffer;
+        ParameterStream out(&sendBuffer);
+        std::vector<int> sendBytes(procs);
+        std::size_t i = 0;
+        for (int r = 0; r < procs; ++r) {
+            std::size_t start = sendBuffer.size();
+            for (int c = 0; c < counts[r]; ++c)
+                out << data[i++];
+            sendBytes[r] = sendBuffer.size() - start;
+        }
+        std::vector<int> recvBytes(procs);
+        MPI_Alltoall(sendBytes.data(), 1, MPI_INT, recvBytes.data(), 1, MPI_INT, m_comm);
+        std::vector<int> sendDispls = displacements(sendBytes);
+        std::vector<int> recvDispls = displacements(recvBytes);
+        std::vector<char> recvBuffer(recvDispls.back() + recvBytes.back());
+        MPI_Alltoallv(sendBuffer.data(), sendBytes.data(), sendDispls.data(), MPI_CHAR,
+                      recvBuffer.data(), recvBytes.data(), recvDispls.data(), MPI_CHAR, m_comm);
+        ParameterStream in(&recvBuffer);
+        std::vector<T> result(std::accumulate(received.begin(), received.end(), std::size_t(0)));
+        for (T& element : result)
+            in >> element;
+        return result;
+    }
+
+    /**
+     * @brief The offset of each block, given the size of each block
+     */
+    static std::vector<int> displacements(const std::vector<int>& counts);
+
+    /**
+     * @brief Service messages until #req has completed
+     * @throws ShutdownException if the Manager has been shut down
+     */
+    void waitForReduction(MPI_Request& req);
+
+    template<typename R>
+    ReduceFuture<R> trackReduction(std::shared_ptr<ReduceState<R>> state)
+    {
+        m_pendingReductions.push_back(state);
+        return ReduceFuture<R>(state, [this]() { progressReduction(); });
+    }
+
+    /**
+     * @brief Service messages while waiting for a reduction
+     * @throws ShutdownException if the Manager has been shut down
+     */
+    void progressReduction();
+
+    /**
+     * @brief Test the pending non-blocking reductions and forget those which have completed
+     */
+    void processReductions();
+
+    /**
+     * @brief Send an invocation message using the transport selected at construction
+     *
+     * Messages too large for the one-sided rings are sent with MPI_Issend, preceded by a
+     * redirect record in the ring so that per-source ordering is preserved. With the TwoSided transport the
+     * message is sent on the lane for #priority.
+     */
+    void sendInvocationMessage(int rank, std::vector<char> *data, int tag, Priority priority = Priority::Normal);
+
+    /**
+     * @brief Run the invocations waiting on #lane, up to its budget
+     */
+    void processLane(Priority lane);
+
+    /**
+     * @brief Start streaming #stream to #state.rank once it grows past the streaming threshold, if streaming
+     * to that rank is allowed.
+     */
+    void beginOutgoingStream(ParameterStream& stream, OutgoingStream& state);
+
+    /**
+     * @brief Send a full chunk of #stream. The first chunk is sent as a normal message with tag #state.tag.
+     */
+    void flushOutgoingStream(ParameterStream& stream, OutgoingStream& state);
+
+    /**
+     * @brief Send the remainder of #stream as the final chunk.
+     * @return False if the stream never started, in which case the caller still owns the buffer and must
+     * send it as a normal message. Otherwise the buffer has been consumed.
+     */
+    bool endOutgoingStream(ParameterStream& stream, OutgoingStream& state);
+
+    /**
+     * @brief Send a chunk on the stream communicator once #rank has granted a credit. Takes ownership of #chunk.
+     */
+    void sendStreamChunk(int rank, std::vector<char>* chunk, bool last);
+
+    /**
+     * @brief Pull the chunks following a streamed message from #state.rank into #stream as it is read.
+     */
+    void beginIncomingStream(ParameterStream& stream, IncomingStream& state);
+
+    /**
+     * @brief Append the next chunk from #state.rank to #stream and grant the sender another credit.
+     * @return False if the last chunk has already been received.
+     */
+    bool receiveStreamChunk(ParameterStream& stream, IncomingStream& state);
+
+    /**
+     * @brief Discard any chunks of the stream which were not consumed.
+     */
+    void endIncomingStream(ParameterStream& stream, IncomingStream& state);
+
+    /**
+     * @brief Read the flags byte of a return message and set up #state if the return value is streamed.
+     */
+    void beginReturnStream(ParameterStream& stream, IncomingStream& state);
+
+    /**
+     * @brief Compress the part of a message following its header if compression is enabled and worthwhile.
+     *
+     * The compressed message is [header][uint8_t codec id][uint64_t payload length][compressed payload], with
+     * MPIRPC_FLAG_COMPRESSED set in the flags byte which starts the header. The header ends at #headerLength.
+     *
+     * @return The message to send. If this is not #data, #data has been deleted.
+     */
+    std::vector<char>* compressMessage(std::vector<char>* data, std::size_t headerLength);
+
+    /**
+     * @brief Restore a message compressed by compressMessage() in place. The header, which ends at #headerLength,
+     * is kept so that a stream positioned after the header can carry on reading.
+     */
+    void decompressMessage(std::vector<char>* data, std::size_t headerLength);
+
+    /**
+     * @brief The number of chunks which may currently be sent to #rank
+     */
+    int& streamCredits(int rank);
+
+    /**
+     * @brief Receive any credits granted by stream receivers.
+     */
+    void processStreamCredits();
+
+    /**
+     * @brief Make progress until an invocation of #size bytes may be sent to #rank under flow control, then
+     * account for it
+     * @return False if the Manager was shut down while waiting
+     */
+    bool acquireFlowCredit(int rank, std::size_t size);
+
+    /**
+     * @brief Owe #source a credit for an invocation of #size bytes which has been run. Credits are returned
+     * by processFlowCredits().
+     */
+    void returnFlowCredit(int source, std::size_t size);
+
+    /**
+     * @brief Add an invocation of #functionHandle on #rank of #bytes bytes, which took #serializeTime seconds to
+     * serialize, to the metrics
+     */
+    void recordSend(FunctionHandle functionHandle, int rank, std::size_t bytes, double serializeTime);
+
+    /**
+     * @brief Add the execution of #functionHandle for #source, which has just finished, to the metrics
+     */
+    void recordExecution(FunctionHandle functionHandle, int source, std::size_t bytesIn, std::size_t bytesOut);
+
+    /**
+     * @brief The offset in nanoseconds from the steady clock of this rank to that of rank 0. Collective.
+     */
+    int64_t estimateClockOffset();
+
+    /**
+     * @brief Return the credits owed to other ranks and receive the credits returned to this rank
+     */
+    void processFlowCredits();
+
+    /**
+     * @brief Drain the one-sided rings, executing each invocation found.
+     * @return True if any message was processed.
+     */
+    bool processRmaMessages();
+
+    /**
+     * Wait for the remote process to run an invocation and send that function's return value back to this process.
+     * @param done Stop waiting once this becomes true, because a nested call received the return value instead
+     * @return The serialized return value, or nullptr if this Manager shut down first or #done became true.
+     * The caller takes ownership.
+     */
+    std::vector<char>* receiveReturn(int rank, const bool* done = nullptr);
+
     /**
      * Wait for the remote process to run an invocation and send that function's return value back to this process.
      * Unserialize the result and return it.
+     *
+     * The result is constructed directly from the receive buffer. Types which are not default constructible
+     * can be returned by specializing Unmarshaller<T>.
      */
     template<typename R>
     R processReturn(int rank) {
-        MPI_Status status;
-        int len;
-        int flag;
-        bool shutdown;
-        do {
-            shutdown = !checkMessages();
-            MPI_Iprobe(rank, MPIRPC_TAG_RETURN, m_comm, &flag, &status);
-        } while (!flag && !shutdown);
-        if (!shutdown)
-            MPI_Get_count(&status, MPI_CHAR, &len);
-        R ret;
-        if (!shutdown && len != MPI_UNDEFINED) {
-            std::vector<char>* buffer = new std::vector<char>(len);
-            ParameterStream stream(buffer);
-            MPI_Recv((void*) buffer->data(), len, MPI_CHAR, rank, MPIRPC_TAG_RETURN, m_comm, &status);
-            ret = unmarshal<R>(stream);
-            delete buffer;
+        std::unique_ptr<std::vector<char>> buffer(receiveReturn(rank));
+        if (!buffer)
+            return noReturn<R>();
+        return parseReturn<R>(rank, buffer.get());
+    }
+
+    /**
+     * @brief Invoke #functionHandle on #rank and wait for its return value, which is cached if the function is pure
+     */
+    template<typename R, typename... Args>
+    R callFunction(int rank, FunctionHandle functionHandle, Args&&... args)
+    {
+        MPIRPC_METRIC(RoundTripTimer timer(m_metrics.sent(functionHandle, rank)));
+        if (!m_pureFunctions.count(functionHandle)) {
+            sendFunctionInvocation(rank, functionHandle, true, std::forward<Args>(args)...);
+            return processReturn<R>(rank);
+        }
+        ResultCache::Key key{functionHandle, rank, std::vector<char>()};
+        {
+            ParameterStream stream(&key.arguments);
+            Passer p{(stream << args, 0)...};
         }
+        if (const std::vector<char>* cached = m_resultCache.find(key))
+            return unmarshalResult<R>(*cached);
+        std::shared_ptr<ResultCache::PendingCall> call = m_resultCache.pendingCall(key);
+        if (call && call->depth == m_returnWaits[rank] && m_returnsOwed == 0) {
+            //The identical call further up the stack is the latest waiting for #rank, so the next return value
+            //from #rank is its result. No rank can be waiting for this one, so that result cannot depend on
+            //this call returning.
+            ++m_resultCache.stats().coalesced;
+            return awaitPureResult<R>(key, call);
+        }
+        bool owner = !call;
+        call = std::make_shared<ResultCache::PendingCall>(rank, m_returnWaits[rank] + 1, m_resultCache.generation());
+        if (owner)
+            m_resultCache.beginCall(key, call);
+        sendFunctionInvocation(rank, functionHandle, true, std::forward<Args>(args)...);
+        try {
+            R ret = awaitPureResult<R>(key, call);
+            if (owner)
+                m_resultCache.endCall(key);
+            return ret;
+        } catch (...) {
+            if (owner)
+                m_resultCache.endCall(key);
+            throw;
+        }
+    }
+
+    /**
+     * @brief Wait for the result of #call, unless a nested call has already received it, and cache it
+     */
+    template<typename R>
+    R awaitPureResult(const ResultCache::Key& key, std::shared_ptr<ResultCache::PendingCall> call)
+    {
+        std::unique_ptr<std::vector<char>> buffer(receiveReturn(call->rank, &call->done));
+        if (call->done)
+            return unmarshalResult<R>(call->result);
+        if (!buffer)
+            return noReturn<R>();
+        R ret = parseReturn<R>(call->rank, buffer.get());
+        ParameterStream stream(&call->result);
+        stream << ret;
+        call->done = true;
+        m_resultCache.insert(key, call->result, call->generation);
         return ret;
     }
 
+    template<typename R>
+    static R unmarshalResult(const std::vector<char>& result)
+    {
+        std::vector<char> buffer(result);
+        ParameterStream stream(&buffer);
+        ArgumentArena::Suspend arena;
+        return unmarshal<R>(stream);
+    }
+
+    /**
+     * @brief Deserialize the return value in #buffer, received from rank #rank, and the chunks following it if the
+     * return value is streamed.
+     */
+    template<typename R>
+    R parseReturn(int rank, std::vector<char>* buffer) {
+        ParameterStream stream(buffer);
+        IncomingStream incoming(rank);
+        beginReturnStream(stream, incoming);
+        //The return value belongs to the caller, not to the invocation this call may be nested in
+        ArgumentArena::Suspend arena;
+        R ret(unmarshal<R>(stream));
+        endIncomingStream(stream, incoming);
+        return ret;
+    }
+
+    /**
+     * Wait for the return value of an invocation on rank #rank and unserialize it into #result, reusing any
+     * storage #result already owns.
+     */
+    template<typename R>
+    void processReturnInto(int rank, R& result) {
+        std::unique_ptr<std::vector<char>> buffer(receiveReturn(rank));
+        if (!buffer)
+            throw ShutdownException();
+        ParameterStream stream(buffer.get());
+        IncomingStream incoming(rank);
+        beginReturnStream(stream, incoming);
+        ArgumentArena::Suspend arena;
+        stream >> result;
+        endIncomingStream(stream, incoming);
+    }
+
+    /**
+     * Wait for the return value of an invocation on rank #rank, which must be a serialized sequence such as a
+     * std::vector<T> or CArrayWrapper<T>, and unserialize its elements into #out.
+     * @return The number of elements written
+     */
+    template<typename T>
+    std::size_t processReturnIntoArray(int rank, T* out, std::size_t capacity) {
+        std::unique_ptr<std::vector<char>> buffer(receiveReturn(rank));
+        if (!buffer)
+            throw ShutdownException();
+        ParameterStream stream(buffer.get());
+        IncomingStream incoming(rank);
+        beginReturnStream(stream, incoming);
+        ArgumentArena::Suspend arena;
+        std::size_t count = unmarshalArray(stream, out, capacity);
+        endIncomingStream(stream, incoming);
+        return count;
+    }
+
+    template<typename R, typename std::enable_if<std::is_default_constructible<R>::value>::type* = nullptr>
+    static R noReturn() { return R(); }
+
+    template<typename R, typename std::enable_if<!std::is_default_constructible<R>::value>::type* = nullptr>
+    static R noReturn() { throw ShutdownException(); }
+
     /**
      * @brief Handle a message indicating a remote process is registering a new object.
      */
@@ -981,12 +2313,42 @@ protected:
     /**
      * @brief Handle a message to execute a function
      */
-    void receivedInvocationCommand(MPI_Status &&);
+    void receivedInvocationCommand(MPI_Status &&, MPI_Comm comm);
 
     /**
      * @brief Handle a message to execute a member function
      */
-    void receivedMemberInvocationCommand(MPI_Status &&);
+    void receivedMemberInvocationCommand(MPI_Status &&, MPI_Comm comm);
+
+    /**
+     * @brief Execute an invocation with tag #tag received from rank #source, or defer it. Takes ownership of #buffer.
+     *
+     * While this rank is waiting for credits to stream a message, a streamed invocation from a higher
+     * rank is deferred until the outgoing stream completes. Otherwise two ranks streaming to each other
+     * could each block reading the other's chunks. Later invocations from the same source are deferred
+     * behind it to preserve ordering.
+     */
+    void dispatchInvocation(int source, int tag, std::vector<char>* buffer);
+
+    /**
+     * @brief Execute deferred invocations once no outgoing stream is active.
+     */
+    void runDeferredInvocations();
+
+    /**
+     * @brief Execute a serialized function invocation received from rank #source. Takes ownership of #buffer.
+     */
+    void executeInvocation(int source, std::vector<char>* buffer);
+
+    /**
+     * @brief Execute a serialized member function invocation received from rank #source. Takes ownership of #buffer.
+     */
+    void executeMemberInvocation(int source, std::vector<char>* buffer);
+
+    /**
+     * @brief Execute #f with the arguments remaining in #stream and send back its return value if requested in #flags.
+     */
+    void executeFunction(FunctionBase* f, int source, uint8_t flags, ParameterStream& stream, void* object);
 
     /**
      * @brief Handle a message indicating this Manager should shut down.
@@ -1002,7 +2364,15 @@ protected:
 
     std::map<FunctionHandle, FunctionBase*> m_registeredFunctions;
     std::unordered_map<std::type_index, FunctionHandle> m_registeredFunctionTIs;
+    std::unordered_set<FunctionHandle> m_pureFunctions;
+    ResultCache m_resultCache;
+    Metrics m_metrics;
+    Tracer m_tracer;
+    std::string m_tracePath;
+    ArgumentArena m_argumentArena;
+    std::unordered_map<int, int> m_returnWaits;
     std::vector<ObjectWrapperBase*> m_registeredObjects;
+    std::vector<ReplicatedObjectBase*> m_replicatedObjects;
 
     std::unordered_map<MPI_Request, const std::vector<char>*> m_mpiMessages;
     std::unordered_map<MPI_Request, std::shared_ptr<ObjectInfo>> m_mpiObjectMessages;
@@ -1016,6 +2386,37 @@ protected:
     unsigned long long m_count;
     bool m_shutdown;
     MPI_Datatype MpiObjectInfo;
+    RmaQueue *m_rmaQueue;
+    int m_callDepth;
+
+    MPI_Comm m_streamComm;
+    std::size_t m_streamThreshold;
+    std::size_t m_streamChunkSize;
+    int m_streamWindow;
+    std::unordered_map<int, int> m_streamCredits;
+    std::unordered_set<int> m_outgoingStreams;
+    std::deque<DeferredInvocation> m_deferredInvocations;
+
+    MPI_Comm m_laneComms[3]; //Indexed by Priority. The Normal lane is m_comm.
+    int m_laneBudgets[3];
+    std::unordered_map<FunctionHandle, Priority> m_priorities;
+    std::size_t m_bulkThreshold;
+
+    int m_flowMessages;
+    std::size_t m_flowBytes;
+    std::unordered_map<int, FlowControlStats> m_flowControl;
+    std::unordered_map<int, std::pair<uint64_t, uint64_t>> m_flowCreditsOwed; //Messages and bytes run per source since credits were last returned
+
+    std::unordered_map<std::type_index, MPI_Datatype> m_podTypes;
+    std::vector<std::shared_ptr<PendingReduce>> m_pendingReductions;
+    std::size_t m_reduceSegmentSize;
+    int m_reduceWindow;
+    int m_accumulateThreads;
+    int m_returnsOwed;
+
+    std::unordered_map<uint8_t, Codec*> m_codecs;
+    Codec* m_compressionCodec;
+    std::size_t m_compressionThreshold;
 };
 
 }
@@ -0,0 +1,178 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace mpirpc {
+
+namespace {
+
+struct ExecutionFrame
+{
+    Metrics::Clock::time_point start;
+    Metrics::Clock::time_point unmarshalled;
+};
+
+std::vector<ExecutionFrame>& executionFrames()
+{
+    static thread_local std::vector<ExecutionFrame> frames;
+    return frames;
+}
+
+void writeCalls(std::ostream& out, const char* name, const std::map<Metrics::Key, CallMetrics>& calls)
+{
+    out << "\"" << name << "\":[";
+    bool first = true;
+    for (const auto& i : calls) {
+        const CallMetrics& m = i.second;
+        out << (first ? "" : ",") << "\n{\"function\":" << i.first.first << ",\"rank\":" << i.first.second
+            << ",\"calls\":" << m.calls << ",\"bytesIn\":" << m.bytesIn << ",\"bytesOut\":" << m.bytesOut
+            << ",\"serializeTime\":" << m.serializeTime << ",\"deserializeTime\":" << m.deserializeTime
+            << ",\"latency\":{\"count\":" << m.latency.count() << ",\"total\":" << m.latency.total()
+            << ",\"min\":" << m.latency.min() << ",\"max\":" << m.latency.max()
+            << ",\"p50\":" << m.latency.quantile(0.5) << ",\"p99\":" << m.latency.quantile(0.99) << ",\"buckets\":[";
+        bool firstBucket = true;
+        for (int b = 0; b < MPIRPC_HISTOGRAM_BUCKETS; ++b) {
+            if (m.latency.bucket(b) == 0)
+                continue;
+            out << (firstBucket ? "" : ",") << "[" << LatencyHistogram::bucketLimit(b) << "," << m.latency.bucket(b) << "]";
+            firstBucket = false;
+        }
+        out << "]}}";
+        first = false;
+    }
+    out << "]";
+}
+
+}
+
+LatencyHistogram::LatencyHistogram()
+    : m_count(0), m_total(0), m_min(0), m_max(0)
+{
+    std::fill(m_buckets, m_buckets + MPIRPC_HISTOGRAM_BUCKETS, 0);
+}
+
+void LatencyHistogram::add(double seconds)
+{
+    double ns = seconds*1e9;
+    int b = ns < 1.0 ? 0 : std::min(static_cast<int>(std::log2(ns)), MPIRPC_HISTOGRAM_BUCKETS - 1);
+    ++m_buckets[b];
+    m_min = m_count ? std::min(m_min, seconds) : seconds;
+    m_max = std::max(m_max, seconds);
+    m_total += seconds;
+    ++m_count;
+}
+
+double LatencyHistogram::bucketLimit(int i)
+{
+    return std::ldexp(1.0, i + 1)*1e-9;
+}
+
+double LatencyHistogram::quantile(double q) const
+{
+    if (m_count == 0)
+        return 0.0;
+    unsigned long long rank = static_cast<unsigned long long>(std::ceil(q*m_count));
+    unsigned long long seen = 0;
+    for (int b = 0; b < MPIRPC_HISTOGRAM_BUCKETS; ++b) {
+        seen += m_buckets[b];
+        if (seen >= rank && seen > 0)
+            return std::min(bucketLimit(b), m_max);
+    }
+    return m_max;
+}
+
+Metrics::Metrics()
+{
+    clear();
+}
+
+void Metrics::sampleQueueDepth(std::size_t depth)
+{
+    m_peakQueueDepth = std::max(m_peakQueueDepth, depth);
+    double t = since(m_start);
+    if (!m_queueDepth.empty() && t - m_lastSample < m_sampleInterval)
+        return;
+    if (m_queueDepth.size() == MPIRPC_QUEUE_DEPTH_SAMPLES) {
+        for (std::size_t i = 0; i < m_queueDepth.size()/2; ++i)
+            m_queueDepth[i] = m_queueDepth[2*i];
+        m_queueDepth.resize(m_queueDepth.size()/2);
+        m_sampleInterval *= 2;
+    }
+    m_queueDepth.emplace_back(t, depth);
+    m_lastSample = t;
+}
+
+void Metrics::beginExecution()
+{
+    Clock::time_point t = now();
+    executionFrames().push_back(ExecutionFrame{t, t});
+}
+
+void Metrics::markUnmarshalled()
+{
+    if (!executionFrames().empty())
+        executionFrames().back().unmarshalled = now();
+}
+
+void Metrics::endExecution(double& unmarshal, double& execution)
+{
+    ExecutionFrame frame = executionFrames().back();
+    executionFrames().pop_back();
+    unmarshal = std::chrono::duration<double>(frame.unmarshalled - frame.start).count();
+    execution = since(frame.unmarshalled);
+}
+
+void Metrics::clear()
+{
+    m_sent.clear();
+    m_executed.clear();
+    m_start = now();
+    m_sampleInterval = MPIRPC_QUEUE_DEPTH_INTERVAL;
+    m_lastSample = 0;
+    m_queueDepth.clear();
+    m_peakQueueDepth = 0;
+}
+
+void Metrics::writeJson(std::ostream& out, int rank) const
+{
+    out << "{\"rank\":" << rank << ",\"duration\":" << since(m_start) << ",\n";
+    writeCalls(out, "sent", m_sent);
+    out << ",\n";
+    writeCalls(out, "executed", m_executed);
+    out << ",\n\"peakQueueDepth\":" << m_peakQueueDepth << ",\"queueDepth\":[";
+    for (std::size_t i = 0; i < m_queueDepth.size(); ++i)
+        out << (i ? "," : "") << "[" << m_queueDepth[i].first << "," << m_queueDepth[i].second << "]";
+    out << "]}\n";
+}
+
+bool Metrics::writeJson(const std::string& path, int rank) const
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    writeJson(out, rank);
+    return static_cast<bool>(out);
+}
+
+}
@@ -0,0 +1,193 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+
+//Statements which only collect metrics. Compiled out unless USE_METRICS is defined.
+#ifdef USE_METRICS
+#define MPIRPC_METRIC(statement) statement
+#else
+#define MPIRPC_METRIC(statement)
+#endif
+
+#define MPIRPC_HISTOGRAM_BUCKETS 40
+#define MPIRPC_QUEUE_DEPTH_SAMPLES 4096
+#define MPIRPC_QUEUE_DEPTH_INTERVAL 0.001
+
+namespace mpirpc {
+
+/**
+ * @brief A histogram of durations with power of two buckets: bucket i counts durations of [2^i, 2^(i+1)) nanoseconds
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void add(double seconds);
+
+    unsigned long long count() const { return m_count; }
+    double total() const { return m_total; }
+    double min() const { return m_count ? m_min : 0.0; }
+    double max() const { return m_max; }
+    unsigned long long bucket(int i) const { return m_buckets[i]; }
+
+    /**
+     * @brief The upper bound in seconds of bucket #i
+     */
+    static double bucketLimit(int i);
+
+    /**
+     * @brief An upper bound of the #q quantile, 0 <= q <= 1, accurate to a factor of two
+     */
+    double quantile(double q) const;
+
+protected:
+    unsigned long long m_buckets[MPIRPC_HISTOGRAM_BUCKETS];
+    unsigned long long m_count;
+    double m_total;
+    double m_min;
+    double m_max;
+};
+
+/**
+ * @brief Counters for the calls of one function between this rank and one peer
+ */
+struct CallMetrics
+{
+    CallMetrics() : calls(0), bytesIn(0), bytesOut(0), serializeTime(0), deserializeTime(0) {}
+
+    unsigned long long calls;
+    unsigned long long bytesIn;  ///< Serialized arguments received
+    unsigned long long bytesOut; ///< Serialized arguments sent, or return values sent for executed calls
+    double serializeTime;        ///< Seconds spent serializing and compressing arguments
+    double deserializeTime;      ///< Seconds spent unmarshalling arguments
+    LatencyHistogram latency;    ///< The round trip of invokeFunctionR() for sent calls, the execution for executed calls
+};
+
+/**
+ * @brief Per function and peer invocation metrics and the depth of the send queue over time
+ *
+ * The Manager only records metrics when built with USE_METRICS defined, otherwise all collection is compiled out.
+ * See: Manager::metrics()
+ */
+class Metrics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Key = std::pair<FunctionHandle, int>; //The function and the peer rank
+
+    Metrics();
+
+    static Clock::time_point now() { return Clock::now(); }
+    static double since(Clock::time_point start) { return std::chrono::duration<double>(now() - start).count(); }
+
+    /**
+     * @brief The metrics of the calls of #functionHandle made from this rank on #rank
+     */
+    CallMetrics& sent(FunctionHandle functionHandle, int rank) { return m_sent[Key(functionHandle, rank)]; }
+
+    /**
+     * @brief The metrics of the calls of #functionHandle made from #rank and executed on this rank
+     */
+    CallMetrics& executed(FunctionHandle functionHandle, int rank) { return m_executed[Key(functionHandle, rank)]; }
+
+    const std::map<Key, CallMetrics>& sent() const { return m_sent; }
+    const std::map<Key, CallMetrics>& executed() const { return m_executed; }
+
+    /**
+     * @brief Record #depth if at least the sampling interval has passed since the last sample. Once the samples
+     * are full every other one is dropped and the interval doubles, so the whole run stays covered.
+     */
+    void sampleQueueDepth(std::size_t depth);
+
+    /**
+     * @brief Pairs of seconds since the metrics were started and the queue depth then
+     */
+    const std::vector<std::pair<double, std::size_t>>& queueDepth() const { return m_queueDepth; }
+    std::size_t peakQueueDepth() const { return m_peakQueueDepth; }
+
+    /**
+     * @brief Start timing an executed call. Calls nest, so each begin is matched by an endExecution().
+     */
+    static void beginExecution();
+
+    /**
+     * @brief Mark the arguments of the innermost executing call as unmarshalled
+     */
+    static void markUnmarshalled();
+
+    /**
+     * @brief Finish timing the innermost executing call
+     * @param unmarshal Set to the seconds spent unmarshalling the arguments
+     * @param execution Set to the seconds spent in the call after unmarshalling
+     */
+    static void endExecution(double& unmarshal, double& execution);
+
+    void clear();
+
+    /**
+     * @brief Write the metrics as a JSON object
+     */
+    void writeJson(std::ostream& out, int rank) const;
+
+    /**
+     * @brief Write the metrics as JSON to the file #path
+     * @return False if the file could not be written
+     */
+    bool writeJson(const std::string& path, int rank) const;
+
+protected:
+    std::map<Key, CallMetrics> m_sent;
+    std::map<Key, CallMetrics> m_executed;
+    Clock::time_point m_start;
+    double m_sampleInterval;
+    double m_lastSample;
+    std::vector<std::pair<double, std::size_t>> m_queueDepth;
+    std::size_t m_peakQueueDepth;
+};
+
+/**
+ * @brief Records the round trip of a call to the sent metrics of its function when it goes out of scope
+ */
+class RoundTripTimer
+{
+public:
+    RoundTripTimer(CallMetrics& metrics) : m_metrics(metrics), m_start(Metrics::now()) {}
+    ~RoundTripTimer() { m_metrics.latency.add(Metrics::since(m_start)); }
+
+protected:
+    CallMetrics& m_metrics;
+    Metrics::Clock::time_point m_start;
+};
+
+}
+
+#endif // METRICS_HPP
@@ -18,42 +18,36 @@
  */
 
 #include "mpitype.hpp"
-
-template<>
-MPI_Datatype mpiType<double>() { return MPI_DOUBLE; }
-
-template<>
-MPI_Datatype mpiType<long double>() { return MPI_LONG_DOUBLE; }
-
-template<>
-MPI_Datatype mpiType<float>() { return MPI_FLOAT; }
-
-template<>
-MPI_Datatype mpiType<char>() { return MPI_CHAR; }
-
-template<>
-MPI_Datatype mpiType<unsigned char>() { return MPI_UNSIGNED_CHAR; }
-
-template<>
-MPI_Datatype mpiType<short>() { return MPI_SHORT; }
-
-template<>
-MPI_Datatype mpiType<unsigned short>() { return MPI_UNSIGNED_SHORT; }
-
-template<>
-MPI_Datatype mpiType<int>() { return MPI_INT; }
-
-template<>
-MPI_Datatype mpiType<unsigned int>() { return MPI_UNSIGNED; }
-
-template<>
-MPI_Datatype mpiType<long>() { return MPI_LONG; }
-
-template<>
-MPI_Datatype mpiType<unsigned long>() { return MPI_UNSIGNED_LONG; }
-
-template<>
-MPI_Datatype mpiType<long long>() { return MPI_LONG_LONG; }
-
-template<>
-MPI_Datatype mpiType<unsigned long long>() { return MPI_UNSIGNED_LONG_LONG; }
+#include <vector>
+
+namespace
+{
+
+std::vector<MPI_Datatype>& cachedTypes()
+{
+    static std::vector<MPI_Datatype> types;
+    return types;
+}
+
+int freeCachedTypes(MPI_Comm, int, void*, void*)
+{
+    for (MPI_Datatype& type : cachedTypes())
+        MPI_Type_free(&type);
+    cachedTypes().clear();
+    return MPI_SUCCESS;
+}
+
+}
+
+MPI_Datatype commitCachedType(MPI_Datatype type)
+{
+    //Attributes of MPI_COMM_SELF are deleted at the start of MPI_Finalize, while MPI calls are still allowed
+    static int keyval = MPI_KEYVAL_INVALID;
+    if (keyval == MPI_KEYVAL_INVALID) {
+        MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, freeCachedTypes, &keyval, nullptr);
+        MPI_Comm_set_attr(MPI_COMM_SELF, keyval, nullptr);
+    }
+    MPI_Type_commit(&type);
+    cachedTypes().push_back(type);
+    return type;
+}
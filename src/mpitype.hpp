@@ -22,47 +22,203 @@
 
 #include <mpi.h>
 #include <cstdint>
+#include <cstddef>
+#include <complex>
+#include <utility>
+#include <array>
+#include <type_traits>
+
+/**
+ * @brief Maps T to an MPI datatype at compile time
+ *
+ * Specializations provide `static constexpr bool supported = true` and `static MPI_Datatype get()`.
+ * Arithmetic types, bool, enums and std::complex map to predefined datatypes. std::pair, std::array
+ * and C arrays of supported types map to derived datatypes which are created and committed on first
+ * use and freed when MPI is finalized. Pairs of an arithmetic type and int map to the predefined pair
+ * types, such as MPI_DOUBLE_INT, so that they work with MPI_MINLOC and MPI_MAXLOC.
+ *
+ * Specialize this for other types, or register trivially copyable structs with
+ * mpirpc::Manager::registerPodType().
+ */
+template<typename T, typename Enable = void>
+struct MpiTypeTraits
+{
+    static constexpr bool supported = false;
+};
+
+/**
+ * @brief Commit #type and free it when MPI is finalized
+ */
+MPI_Datatype commitCachedType(MPI_Datatype type);
+
+#define MPIRPC_PREDEFINED_MPI_TYPE(T, DT) \
+    template<> \
+    struct MpiTypeTraits<T> \
+    { \
+        static constexpr bool supported = true; \
+        static MPI_Datatype get() { return DT; } \
+    };
+
+MPIRPC_PREDEFINED_MPI_TYPE(bool, MPI_CXX_BOOL)
+MPIRPC_PREDEFINED_MPI_TYPE(char, MPI_CHAR)
+MPIRPC_PREDEFINED_MPI_TYPE(signed char, MPI_SIGNED_CHAR)
+MPIRPC_PREDEFINED_MPI_TYPE(unsigned char, MPI_UNSIGNED_CHAR)
+MPIRPC_PREDEFINED_MPI_TYPE(wchar_t, MPI_WCHAR)
+MPIRPC_PREDEFINED_MPI_TYPE(short, MPI_SHORT)
+MPIRPC_PREDEFINED_MPI_TYPE(unsigned short, MPI_UNSIGNED_SHORT)
+MPIRPC_PREDEFINED_MPI_TYPE(int, MPI_INT)
+MPIRPC_PREDEFINED_MPI_TYPE(unsigned int, MPI_UNSIGNED)
+MPIRPC_PREDEFINED_MPI_TYPE(long, MPI_LONG)
+MPIRPC_PREDEFINED_MPI_TYPE(unsigned long, MPI_UNSIGNED_LONG)
+MPIRPC_PREDEFINED_MPI_TYPE(long long, MPI_LONG_LONG)
+MPIRPC_PREDEFINED_MPI_TYPE(unsigned long long, MPI_UNSIGNED_LONG_LONG)
+MPIRPC_PREDEFINED_MPI_TYPE(float, MPI_FLOAT)
+MPIRPC_PREDEFINED_MPI_TYPE(double, MPI_DOUBLE)
+MPIRPC_PREDEFINED_MPI_TYPE(long double, MPI_LONG_DOUBLE)
+MPIRPC_PREDEFINED_MPI_TYPE(std::complex<float>, MPI_C_FLOAT_COMPLEX)
+MPIRPC_PREDEFINED_MPI_TYPE(std::complex<double>, MPI_C_DOUBLE_COMPLEX)
+MPIRPC_PREDEFINED_MPI_TYPE(std::complex<long double>, MPI_C_LONG_DOUBLE_COMPLEX)
 
 template<typename T>
-MPI_Datatype mpiType();
-
-template<>
-MPI_Datatype mpiType<double>();
-
-template<>
-MPI_Datatype mpiType<long double>();
-
-template<>
-MPI_Datatype mpiType<float>();
-
-template<>
-MPI_Datatype mpiType<char>();
-
-template<>
-MPI_Datatype mpiType<unsigned char>();
-
-template<>
-MPI_Datatype mpiType<short>();
-
-template<>
-MPI_Datatype mpiType<unsigned short>();
+struct MpiTypeTraits<T, typename std::enable_if<(std::is_const<T>::value || std::is_volatile<T>::value) && !std::is_array<T>::value>::type>
+    : MpiTypeTraits<typename std::remove_cv<T>::type> {};
 
-template<>
-MPI_Datatype mpiType<int>();
-
-template<>
-MPI_Datatype mpiType<unsigned int>();
-
-template<>
-MPI_Datatype mpiType<long>();
-
-template<>
-MPI_Datatype mpiType<unsigned long>();
-
-template<>
-MPI_Datatype mpiType<long long>();
+template<typename T>
+struct MpiTypeTraits<T, typename std::enable_if<std::is_enum<T>::value && !std::is_const<T>::value && !std::is_volatile<T>::value>::type>
+    : MpiTypeTraits<typename std::underlying_type<T>::type> {};
 
-template<>
-MPI_Datatype mpiType<unsigned long long>();
+template<typename T>
+inline MPI_Datatype mpiType()
+{
+    static_assert(MpiTypeTraits<T>::supported, "mpiType<T>: no MPI datatype is known for T");
+    return MpiTypeTraits<T>::get();
+}
+
+/**
+ * Pairs of an arithmetic type and int use the predefined pair types, which are required by MPI_MINLOC and MPI_MAXLOC
+ */
+template<typename T>
+struct MpiPairType
+{
+    static constexpr bool predefined = false;
+};
+
+#define MPIRPC_PREDEFINED_MPI_PAIR_TYPE(T, DT) \
+    template<> \
+    struct MpiPairType<std::pair<T, int>> \
+    { \
+        static constexpr bool predefined = true; \
+        static MPI_Datatype get() { return DT; } \
+    };
+
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(float, MPI_FLOAT_INT)
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(double, MPI_DOUBLE_INT)
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(long double, MPI_LONG_DOUBLE_INT)
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(short, MPI_SHORT_INT)
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(int, MPI_2INT)
+MPIRPC_PREDEFINED_MPI_PAIR_TYPE(long, MPI_LONG_INT)
+
+template<typename T1, typename T2>
+struct MpiTypeTraits<std::pair<T1, T2>, typename std::enable_if<MpiTypeTraits<T1>::supported && MpiTypeTraits<T2>::supported>::type>
+{
+    static constexpr bool supported = true;
+
+    static MPI_Datatype get()
+    {
+        static MPI_Datatype type = create(std::integral_constant<bool, MpiPairType<std::pair<T1, T2>>::predefined>());
+        return type;
+    }
+
+private:
+    static MPI_Datatype create(std::true_type)
+    {
+        return MpiPairType<std::pair<T1, T2>>::get();
+    }
+
+    static MPI_Datatype create(std::false_type)
+    {
+        using P = std::pair<T1, T2>;
+        typename std::aligned_storage<sizeof(P), alignof(P)>::type storage;
+        const P& p = reinterpret_cast<const P&>(storage);
+        const char* base = reinterpret_cast<const char*>(&p);
+        int blocklengths[2] = {1, 1};
+        MPI_Aint offsets[2] = {reinterpret_cast<const char*>(&p.first) - base, reinterpret_cast<const char*>(&p.second) - base};
+        MPI_Datatype types[2] = {mpiType<T1>(), mpiType<T2>()};
+        MPI_Datatype structType, type;
+        MPI_Type_create_struct(2, blocklengths, offsets, types, &structType);
+        MPI_Type_create_resized(structType, 0, sizeof(P), &type);
+        MPI_Type_free(&structType);
+        return commitCachedType(type);
+    }
+};
+
+template<typename T, std::size_t N>
+struct MpiTypeTraits<std::array<T, N>, typename std::enable_if<MpiTypeTraits<T>::supported>::type>
+{
+    static constexpr bool supported = true;
+
+    static MPI_Datatype get()
+    {
+        static MPI_Datatype type = create();
+        return type;
+    }
+
+private:
+    static MPI_Datatype create()
+    {
+        MPI_Datatype contiguous, type;
+        MPI_Type_contiguous(N, mpiType<T>(), &contiguous);
+        MPI_Type_create_resized(contiguous, 0, sizeof(std::array<T, N>), &type);
+        MPI_Type_free(&contiguous);
+        return commitCachedType(type);
+    }
+};
+
+template<typename T, std::size_t N>
+struct MpiTypeTraits<T[N], typename std::enable_if<MpiTypeTraits<T>::supported>::type>
+{
+    static constexpr bool supported = true;
+
+    static MPI_Datatype get()
+    {
+        static MPI_Datatype type = create();
+        return type;
+    }
+
+private:
+    static MPI_Datatype create()
+    {
+        MPI_Datatype type;
+        MPI_Type_contiguous(N, mpiType<T>(), &type);
+        return commitCachedType(type);
+    }
+};
+
+/**
+ * @brief The innermost element type of nested std::arrays and C arrays, and how many of them T holds
+ *
+ * Arrays are reduced as #count elements of the element type, as the predefined reduction operations
+ * only accept predefined datatypes.
+ */
+template<typename T>
+struct MpiElementType
+{
+    using type = T;
+    static constexpr std::size_t count = 1;
+};
+
+template<typename T, std::size_t N>
+struct MpiElementType<std::array<T, N>>
+{
+    using type = typename MpiElementType<T>::type;
+    static constexpr std::size_t count = N*MpiElementType<T>::count;
+};
+
+template<typename T, std::size_t N>
+struct MpiElementType<T[N]>
+{
+    using type = typename MpiElementType<T>::type;
+    static constexpr std::size_t count = N*MpiElementType<T>::count;
+};
 
 #endif /* MPITYPE_H */
@@ -20,9 +20,11 @@
 #ifndef ORDEREDCALL_HPP
 #define ORDEREDCALL_HPP
 
+#include "arena.hpp"
 #include "common.hpp"
 
 #include <tuple>
+#include <memory>
 #include <iostream>
 
 namespace mpirpc {
@@ -40,30 +42,33 @@ decltype(auto) apply(F&& f, Tuple&& t)
     return apply_impl(std::forward<F>(f), std::forward<Tuple>(t), Indices{});
 }
 
+/**
+ * Frees the storage which operator>> allocated for a parameter once the call has been made. Parameters allocated in
+ * the current ArgumentArena are left for the arena to release.
+ */
 template<typename T>
 struct arg_cleanup
 {
-    static void apply(typename std::decay<T>::type& t) { std::cout << "blank clean up for " << typeid(t).name() << std::endl; }
-    static void apply(typename std::decay<T>::type&& t) { std::cout << "generic rvalue " << typeid(t).name() << std::endl; }
+    static void apply(typename std::decay<T>::type&) {}
+    static void apply(typename std::decay<T>::type&&) {}
 };
 
 template<typename T>
 struct arg_cleanup<PointerParameter<T>&>
 {
-    static void apply(PointerParameter<T>& t) { std::cout << "cleaned up pointer" << std::endl; delete t.pointer; }
+    static void apply(PointerParameter<T>& t) { deleteArgument(t.pointer); }
 };
 
 template<typename T>
 struct arg_cleanup<PointerParameter<T>&&>
 {
-
-    static void apply(PointerParameter<T>&& t) { std::cout << "not cleaning up pointer rvalue" << std::endl; delete t.pointer; }
+    static void apply(PointerParameter<T>&& t) { deleteArgument(t.pointer); }
 };
 
 template<typename T, std::size_t N>
 struct arg_cleanup<CArrayWrapper<T,N>&>
 {
-    static void apply(CArrayWrapper<T,N>& t) { std::cout << "cleaned up C Array" << std::endl; t.del(); }
+    static void apply(CArrayWrapper<T,N>& t) { deleteArgumentArray(t.data()); }
 };
 
 /*template<typename T, std::size_t N>
@@ -76,7 +81,7 @@ struct arg_cleanup<CArrayWrapper<T,N>>
 template<>
 struct arg_cleanup<char*>
 {
-    static void apply(char*& s) { delete[] s; /*std::cout << "deleted s" << std::endl;*/ }
+    static void apply(char* s) { deleteArgumentArray(s); }
 };
 
 template<typename... Args>
@@ -109,8 +114,14 @@ struct OrderedCall<R(*)(FArgs...)>
     OrderedCall(R(*function)(FArgs...), Args&&... args)
     {
         func = function;
-        bound = std::bind([&](){ return function(forward_parameter_type_local<typename std::remove_cv<FArgs>::type,Args>(args)...);});
-        post = std::bind([&](){ do_post_exec(forward_parameter_cleanup<typename std::remove_cv<FArgs>::type,Args>(args)...);}); // do_post_exec(forward_parameter_type<typename std::::remove_cv<FArgs>::type,Args>(args)...);}); //do_post_exec(static_cast<FArgs>(args)...);}); //forward_parameter_type_local<typename std::remove_cv<FArgs>::type,Args>(args)...);});
+        //The arguments are usually temporaries which do not outlive this constructor, so they are stored by value
+        auto stored = std::make_shared<std::tuple<std::decay_t<Args>...>>(std::forward<Args>(args)...);
+        bound = [function, stored]() {
+            return mpirpc::apply([function](std::decay_t<Args>&... a) { return function(forward_parameter_type_local<typename std::remove_cv<FArgs>::type,Args>(a)...); }, *stored);
+        };
+        post = [stored]() {
+            mpirpc::apply([](std::decay_t<Args>&... a) { do_post_exec(forward_parameter_cleanup<typename std::remove_cv<FArgs>::type,Args>(a)...); }, *stored);
+        };
     }
 
     template<typename T = R, typename std::enable_if<!std::is_same<T,void>::value,T>::type* = nullptr>
@@ -19,11 +19,13 @@
 
 #include "parameterstream.hpp"
 #include <cstring>
+#include <algorithm>
+#include <stdexcept>
 
 namespace mpirpc {
 
 ParameterStream::ParameterStream(std::vector<char>* buffer)
-    : m_data(buffer), m_pos(0)
+    : m_data(buffer), m_pos(0), m_flushed(0), m_chunkSize(0)
 {
 }
 
@@ -38,6 +40,89 @@ void ParameterStream::seek(std::size_t pos)
     m_pos = pos;
 }
 
+void ParameterStream::setSink(Sink sink, std::size_t chunkSize)
+{
+    m_sink = sink;
+    m_chunkSize = chunkSize;
+}
+
+void ParameterStream::setChunkSize(std::size_t chunkSize)
+{
+    m_chunkSize = chunkSize;
+}
+
+void ParameterStream::setSource(Source source)
+{
+    m_source = source;
+}
+
+void ParameterStream::setAttachmentSink(AttachmentSink sink)
+{
+    m_attachmentSink = sink;
+}
+
+void ParameterStream::setAttachmentSource(AttachmentSource source)
+{
+    m_attachmentSource = source;
+}
+
+void ParameterStream::writeAttachment(const void* data, std::size_t count, std::size_t size, std::type_index type)
+{
+    if (m_attachmentSink)
+        m_attachmentSink(data, count, type);
+    else
+        write(static_cast<const char*>(data), count*size);
+}
+
+void ParameterStream::readAttachment(void* data, std::size_t count, std::size_t size, std::type_index type)
+{
+    if (m_attachmentSource)
+        m_attachmentSource(data, count, type);
+    else
+        read(static_cast<char*>(data), count*size);
+}
+
+void ParameterStream::writeAligned(const char* b, std::size_t length, std::size_t alignment)
+{
+    static const char zeros[256] = {};
+    std::size_t offset = m_flushed + m_data->size() + 1;
+    uint8_t padding = (alignment - offset % alignment) % alignment;
+    *this << padding;
+    write(zeros, padding);
+    write(b, length);
+}
+
+void ParameterStream::readAligned(char* b, std::size_t length)
+{
+    skipPadding();
+    read(b, length);
+}
+
+const char* ParameterStream::viewAligned(std::size_t length, std::size_t alignment)
+{
+    skipPadding();
+    if (reinterpret_cast<std::uintptr_t>(m_data->data() + m_pos) % alignment != 0)
+        return nullptr;
+    return viewBytes(length);
+}
+
+const char* ParameterStream::viewBytes(std::size_t length)
+{
+    if (m_source || m_pos + length > m_data->size())
+        return nullptr;
+    const char* p = m_data->data() + m_pos;
+    m_pos += length;
+    return p;
+}
+
+void ParameterStream::skipPadding()
+{
+    uint8_t padding;
+    *this >> padding;
+    char skipped[256];
+    read(skipped, padding);
+}
+
 char* ParameterStream::data()
 {
     return m_data->data();
@@ -58,201 +143,235 @@ size_t ParameterStream::size() const
     return m_data->size();
 }
 
+void ParameterStream::write(const char* p, std::size_t length)
+{
+    if (!m_sink)
+    {
+        m_data->insert(m_data->end(), p, p+length);
+        return;
+    }
+    while (length > 0)
+    {
+        std::size_t n = std::min(length, m_chunkSize - std::min(m_chunkSize, m_data->size()));
+        m_data->insert(m_data->end(), p, p+n);
+        p += n;
+        length -= n;
+        if (m_data->size() >= m_chunkSize) {
+            std::size_t size = m_data->size();
+            m_sink(*this);
+            m_flushed += size - m_data->size();
+        }
+    }
+}
+
+bool ParameterStream::underflow()
+{
+    if (!m_source)
+        return false;
+    m_data->erase(m_data->begin(), m_data->begin() + m_pos);
+    m_pos = 0;
+    return m_source(*this);
+}
+
+void ParameterStream::read(char* p, std::size_t length)
+{
+    while (m_pos + length > m_data->size())
+    {
+        std::size_t n = m_data->size() - m_pos;
+        std::copy(m_data->data() + m_pos, m_data->data() + m_data->size(), p);
+        m_pos += n;
+        p += n;
+        length -= n;
+        if (!underflow())
+            throw std::out_of_range("ParameterStream: read past the end of the data");
+    }
+    std::copy(m_data->data() + m_pos, m_data->data() + m_pos + length, p);
+    m_pos += length;
+}
+
 ParameterStream& ParameterStream::operator<<(int8_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(int16_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(int32_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(int64_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(uint8_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(uint16_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(uint32_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(uint64_t val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(long long unsigned int val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(long long int val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(int8_t& val)
 {
-    val = *reinterpret_cast<int8_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(int8_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(int16_t& val)
 {
-    val = *reinterpret_cast<int16_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(int16_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(int32_t& val)
 {
-    val = *reinterpret_cast<int32_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(int32_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(int64_t& val)
 {
-    val = *reinterpret_cast<int64_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(int64_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(uint8_t& val)
 {
-    val = *reinterpret_cast<int8_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(uint8_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(uint16_t& val)
 {
-    val = *reinterpret_cast<uint16_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(uint16_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(uint32_t& val)
 {
-    val = *reinterpret_cast<uint32_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(uint32_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(uint64_t& val)
 {
-    val = *reinterpret_cast<uint64_t*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(uint64_t);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(long long unsigned int& val)
 {
-    val = *reinterpret_cast<long long unsigned int*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(long long unsigned int);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(long long int& val)
 {
-    val = *reinterpret_cast<long long int*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(long long int);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(float val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(double val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(float& val)
 {
-    val = *reinterpret_cast<float*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(float);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(double& val)
 {
-    val = *reinterpret_cast<double*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(double);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(bool val)
 {
-    const char* p = reinterpret_cast<const char*>(&val);
-    m_data->insert(m_data->end(), p, p+sizeof(val));
+    write(reinterpret_cast<const char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(bool& val)
 {
-    val = *reinterpret_cast<bool*>(&(*m_data)[m_pos]);
-    m_pos += sizeof(bool);
+    read(reinterpret_cast<char*>(&val), sizeof(val));
     return *this;
 }
 
 ParameterStream& ParameterStream::operator<<(const char* s)
 {
     size_t length = strlen(s)+1;
-    m_data->insert(m_data->end(), s, s+length);
+    write(s, length);
     return *this;
 }
 
 ParameterStream& ParameterStream::operator>>(char *& s)
 {
-    size_t length = strlen(&(*m_data)[m_pos])+1;
-    s = new char[length];
-    std::copy(&(*m_data)[m_pos], &(*m_data)[m_pos+length], s);
-    m_pos += length;
+    const char* begin = m_data->data() + m_pos;
+    const char* end = static_cast<const char*>(memchr(begin, 0, m_data->size() - m_pos));
+    if (end)
+    {
+        size_t length = end - begin + 1;
+        s = newArgumentArray<char>(length);
+        read(s, length);
+        return *this;
+    }
+    //The terminator is in a chunk which has not arrived yet
+    std::string str;
+    char c;
+    do {
+        read(&c, 1);
+        str.push_back(c);
+    } while (c != 0);
+    s = newArgumentArray<char>(str.size());
+    std::copy(str.begin(), str.end(), s);
     return *this;
 }
 
@@ -260,7 +379,7 @@ ParameterStream& ParameterStream::operator<<(const std::string& val)
 {
     uint64_t length = val.size();
     *this << length;
-    m_data->insert(m_data->end(), val.c_str(), val.c_str()+length);
+    write(val.c_str(), length);
     return *this;
 }
 
@@ -268,8 +387,16 @@ ParameterStream& ParameterStream::operator>>(std::string& val)
 {
     uint64_t length;
     *this >> length;
-    val.assign(&(*m_data)[m_pos], length);
-    m_pos += length;
+    if (m_pos + length <= m_data->size())
+    {
+        val.assign(&(*m_data)[m_pos], length);
+        m_pos += length;
+    }
+    else
+    {
+        val.resize(length);
+        read(&val[0], length);
+    }
     return *this;
 }
 
@@ -288,7 +415,7 @@ ParameterStream& ParameterStream::operator>>(char **& sa)
 {
     size_t elems;
     *this >> elems;
-    sa = new char*[elems];
+    sa = newArgumentArray<char*>(elems);
     for (size_t i = 0; i < elems; ++i)
     {
         *this >> sa[i];
@@ -298,14 +425,12 @@ ParameterStream& ParameterStream::operator>>(char **& sa)
 
 void ParameterStream::writeBytes(const char* b, size_t length)
 {
-    m_data->insert(m_data->end(), b, b+length);
+    write(b, length);
 }
 
 void ParameterStream::readBytes(char *& b, size_t length)
 {
-    std::copy(&(*m_data)[m_pos], &(*m_data)[m_pos+length], b);
-    m_pos += length;
+    read(b, length);
 }
 
 }
-
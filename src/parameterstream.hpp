@@ -20,6 +20,7 @@
 #ifndef PARAMETERSTREAM_H
 #define PARAMETERSTREAM_H
 
+#include "arena.hpp"
 #include "common.hpp"
 
 #include<vector>
@@ -29,12 +30,40 @@
 #include<sstream>
 #include<iostream>
 #include<map>
+#include<memory>
+#include<functional>
+#include<stdexcept>
+#include<typeindex>
 
 namespace mpirpc {
 
 class ParameterStream
 {
 public:
+    /**
+     * Called when the buffer of a writing stream reaches the chunk size. The sink is expected to
+     * send and clear the contents of dataVector().
+     */
+    using Sink = std::function<void(ParameterStream&)>;
+
+    /**
+     * Called when a read runs past the end of the buffer. The source should append the next chunk
+     * of data to dataVector() and return false if there is no more data.
+     */
+    using Source = std::function<bool(ParameterStream&)>;
+
+    /**
+     * Called for each array of POD parameters written with writeAttachment(). The sink is expected to send the
+     * #count elements at #data out of band, so they are not copied into the buffer.
+     */
+    using AttachmentSink = std::function<void(const void* data, std::size_t count, std::type_index type)>;
+
+    /**
+     * Called for each array of POD parameters read with readAttachment(). The source should fill #data with the
+     * #count elements sent out of band by the matching AttachmentSink.
+     */
+    using AttachmentSource = std::function<void(void* data, std::size_t count, std::type_index type)>;
+
     ParameterStream() = delete;
     ParameterStream(std::vector<char>* buffer);
     //ParameterStream(const char* data, size_t length);
@@ -42,6 +71,66 @@ public:
     void seek(std::size_t pos);
     std::size_t pos() const { return m_pos; }
 
+    /**
+     * @brief Stream the written data in chunks of #chunkSize bytes through #sink instead of
+     * accumulating it all in the buffer.
+     */
+    void setSink(Sink sink, std::size_t chunkSize);
+    void setChunkSize(std::size_t chunkSize);
+
+    /**
+     * @brief Pull more data from #source when reads run past the end of the buffer. Data which has
+     * already been read is discarded from the buffer when more is pulled.
+     */
+    void setSource(Source source);
+
+    /**
+     * @brief Hand arrays written with writeAttachment() to #sink instead of copying them into the buffer.
+     */
+    void setAttachmentSink(AttachmentSink sink);
+
+    /**
+     * @brief Fill arrays read with readAttachment() from #source instead of the buffer.
+     */
+    void setAttachmentSource(AttachmentSource source);
+
+    /**
+     * @brief Write #count elements of #size bytes of type #type, through the attachment sink if there is one.
+     */
+    void writeAttachment(const void* data, std::size_t count, std::size_t size, std::type_index type);
+
+    /**
+     * @brief Read #count elements of #size bytes of type #type, from the attachment source if there is one.
+     */
+    void readAttachment(void* data, std::size_t count, std::size_t size, std::type_index type);
+
+    /**
+     * @brief Write #length bytes preceded by enough padding that they start at a multiple of #alignment bytes
+     * from the start of the stream. The amount of padding is written too, so reading does not depend on it.
+     */
+    void writeAligned(const char* b, std::size_t length, std::size_t alignment);
+
+    /**
+     * @brief Read #length bytes written by writeAligned()
+     */
+    void readAligned(char* b, std::size_t length);
+
+    /**
+     * @brief Point at the #length bytes written by writeAligned() in place, if they are in the buffer and the
+     * pointer is a multiple of #alignment.
+     * @return nullptr if the bytes have to be copied, in which case only the padding has been read and the bytes
+     * must be read with readBytes().
+     */
+    const char* viewAligned(std::size_t length, std::size_t alignment);
+
+    /**
+     * @brief Point at the next #length bytes in place and skip past them. The pointer is valid until the buffer
+     * is modified.
+     * @return nullptr without reading anything if the bytes are not all in the buffer or a source is set, as a
+     * source may discard them when pulling more data.
+     */
+    const char* viewBytes(std::size_t length);
+
     void writeBytes(const char* b, size_t length);
     void readBytes(char*& b, size_t length);
     char* data();
@@ -89,24 +178,113 @@ public:
     ParameterStream& operator>>(std::string& val);
 
 protected:
+    void write(const char* p, std::size_t length);
+    void read(char* p, std::size_t length);
+    bool underflow();
+    void skipPadding();
+
     std::vector<char> *m_data;
     std::size_t  m_pos;
+    std::size_t m_flushed; //Bytes written which the sink has removed from the buffer
+    std::size_t m_chunkSize;
+    Sink m_sink;
+    Source m_source;
+    AttachmentSink m_attachmentSink;
+    AttachmentSource m_attachmentSource;
 };
 
+template<typename T, typename std::enable_if<is_pod_parameter<T>::value>::type* = nullptr>
+ParameterStream& operator<<(ParameterStream& out, const T& t)
+{
+    out.writeBytes(reinterpret_cast<const char*>(&t), sizeof(T));
+    return out;
+}
+
+template<typename T, typename std::enable_if<is_pod_parameter<T>::value>::type* = nullptr>
+ParameterStream& operator>>(ParameterStream& in, T& t)
+{
+    char* p = reinterpret_cast<char*>(&t);
+    in.readBytes(p, sizeof(T));
+    return in;
+}
+
+/**
+ * Write the elements of an array. Arrays of arithmetic types are written as one aligned block, so that an
+ * ArrayView<T> can point at them in the receive buffer. Arrays of POD parameters are written as a single attachment.
+ */
+template<typename T, typename std::enable_if<!is_pod_parameter<T>::value && !std::is_arithmetic<T>::value>::type* = nullptr>
+inline void marshalArray(ParameterStream& out, const T* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        out << data[i];
+}
+
+template<typename T, typename std::enable_if<std::is_arithmetic<T>::value>::type* = nullptr>
+inline void marshalArray(ParameterStream& out, const T* data, std::size_t size)
+{
+    if (size > 0)
+        out.writeAligned(reinterpret_cast<const char*>(data), size*sizeof(T), alignof(T));
+}
+
+template<typename T, typename std::enable_if<is_pod_parameter<T>::value>::type* = nullptr>
+inline void marshalArray(ParameterStream& out, const T* data, std::size_t size)
+{
+    if (size > 0)
+        out.writeAttachment(data, size, sizeof(T), std::type_index(typeid(T)));
+}
+
+/**
+ * Read the elements of an array written by marshalArray() into #data, which must hold #size elements.
+ */
+template<typename T, typename std::enable_if<!is_pod_parameter<T>::value && !std::is_arithmetic<T>::value>::type* = nullptr>
+inline void unmarshalArrayElements(ParameterStream& in, T* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        in >> data[i];
+}
+
+template<typename T, typename std::enable_if<std::is_arithmetic<T>::value>::type* = nullptr>
+inline void unmarshalArrayElements(ParameterStream& in, T* data, std::size_t size)
+{
+    if (size > 0)
+        in.readAligned(reinterpret_cast<char*>(data), size*sizeof(T));
+}
+
+template<typename T, typename std::enable_if<is_pod_parameter<T>::value>::type* = nullptr>
+inline void unmarshalArrayElements(ParameterStream& in, T* data, std::size_t size)
+{
+    if (size > 0)
+        in.readAttachment(data, size, sizeof(T), std::type_index(typeid(T)));
+}
+
 template<typename T>
 inline void marshal(ParameterStream& s, T&& val) {
     s << val;
 }
 
+/**
+ * Constructs a T from a ParameterStream. The default implementation default constructs a T and
+ * unserializes into it. Specialize this for types which are not default constructible so that they
+ * can be used as parameters and return values.
+ */
+template<typename T>
+struct Unmarshaller
+{
+    static T unmarshal(ParameterStream& s)
+    {
+        T ret;
+        s >> ret;
+        return ret;
+    }
+};
+
 //template<typename T, typename R, typename std::enable_if<
 
 // if T, P*, if T*, P*
 template<typename T, typename R = typename std::decay<T>::type, typename B = typename std::remove_pointer<R>::type,
          typename P = B*, typename std::enable_if<!std::is_same<R,P>::value || std::is_same<R,char*>::value>::type* = nullptr>
 inline R unmarshal(ParameterStream& s) {
-    typename std::decay<T>::type ret;
-    s >> ret;
-    return ret;
+    return Unmarshaller<R>::unmarshal(s);
 }
 
 template<typename T, typename R = typename std::decay<T>::type, typename B = typename std::remove_pointer<R>::type,
@@ -119,30 +297,61 @@ inline CArrayWrapper<B> unmarshal(ParameterStream& s) {
 
 template<typename T>
 ParameterStream& operator<<(ParameterStream& out, const std::vector<T>& vector)
+{
+    out << vector.size();
+    marshalArray(out, vector.data(), vector.size());
+    return out;
+}
+
+template <typename T>
+ParameterStream& operator>>(ParameterStream& in, std::vector<T>& vector)
+{
+    std::size_t size;
+    in >> size;
+    vector.resize(size);
+    unmarshalArrayElements(in, vector.data(), size);
+    return in;
+}
+
+inline ParameterStream& operator<<(ParameterStream& out, const std::vector<bool>& vector)
 {
     out << vector.size();
     for (std::size_t i = 0; i < vector.size(); ++i)
     {
-        out << vector[i];
+        out << static_cast<bool>(vector[i]);
     }
     return out;
 }
 
-template <typename T>
-ParameterStream& operator>>(ParameterStream& in, std::vector<T>& vector)
+inline ParameterStream& operator>>(ParameterStream& in, std::vector<bool>& vector)
 {
     std::size_t size;
     in >> size;
     vector.resize(size);
     for (std::size_t i = 0; i < size; ++i)
     {
-        T val;
+        bool val;
         in >> val;
         vector[i] = val;
     }
     return in;
 }
 
+/**
+ * Unserialize a sequence written as a std::vector<T> or CArrayWrapper<T> directly into #out.
+ * @return The number of elements written
+ */
+template<typename T>
+std::size_t unmarshalArray(ParameterStream& in, T* out, std::size_t capacity)
+{
+    std::size_t size;
+    in >> size;
+    if (size > capacity)
+        throw std::length_error("unmarshalArray: output buffer too small");
+    unmarshalArrayElements(in, out, size);
+    return size;
+}
+
 template<typename T, typename U>
 ParameterStream& operator<<(ParameterStream& out, const std::map<T, U>& map)
 {
@@ -150,7 +359,6 @@ ParameterStream& operator<<(ParameterStream& out, const std::map<T, U>& map)
     for (auto& pair : map)
     {
         out << pair.first << pair.second;
-        std::cout << "streaming map: " << pair.first << " " << pair.second << std::endl;
     }
     return out;
 }
@@ -165,7 +373,6 @@ ParameterStream& operator>>(ParameterStream& in, std::map<T, U>& map)
         T first;
         U second;
         in >> first >> second;
-        std::cout << "making map: " << first << " " << second << std::endl;
         map.insert(std::make_pair(first, second));
     }
     return in;
@@ -200,12 +407,38 @@ ParameterStream& operator>>(ParameterStream& in, PointerParameter<T>& p)
 {
     std::size_t num;
     in >> num;
-    T* t = new T();
+    T* t = newArgument<T>();
     in >> (*t);
     p.pointer = t;
     return in;
 }
 
+template<typename T>
+ParameterStream& operator<<(ParameterStream& out, const std::unique_ptr<T>& p)
+{
+    if (p) {
+        out << (std::size_t) 1;
+        out << *p;
+    } else {
+        out << (std::size_t) 0;
+    }
+    return out;
+}
+
+template<typename T>
+ParameterStream& operator>>(ParameterStream& in, std::unique_ptr<T>& p)
+{
+    std::size_t num;
+    in >> num;
+    if (num) {
+        p.reset(new T());
+        in >> *p;
+    } else {
+        p.reset();
+    }
+    return in;
+}
+
 template<typename T>
 ParameterStream& operator>>(ParameterStream& in, T*& p)
 {
@@ -214,7 +447,7 @@ ParameterStream& operator>>(ParameterStream& in, T*& p)
     //p = new T[num]();
     //for (std::size_t i = 0; i < num; ++i)
     //    in >> p[i];
-    p = new T();
+    p = newArgument<T>();
     //T ret;
     in >> (*p);
     return in;
@@ -225,8 +458,7 @@ ParameterStream& operator<<(ParameterStream& out, const CArrayWrapper<T,N>& wrap
 {
     if (N == 0)
         out << wrapper.size();
-    for (std::size_t i = 0; i < wrapper.size(); ++i)
-        out << wrapper[i];
+    marshalArray(out, wrapper.data(), wrapper.size());
     return out;
 }
 
@@ -238,9 +470,65 @@ ParameterStream& operator>>(ParameterStream& in, CArrayWrapper<T,N>& wrapper)
         in >> size;
         wrapper.setSize(size);
     }
-    wrapper.setData(new T[size]());
-    for (std::size_t i = 0; i < size; ++i)
-        in >> wrapper[i];
+    wrapper.setData(newArgumentArray<T>(size));
+    unmarshalArrayElements(in, wrapper.data(), size);
+    return in;
+}
+
+template<typename T>
+ParameterStream& operator<<(ParameterStream& out, const ArrayView<T>& view)
+{
+    out << view.size();
+    marshalArray(out, view.data(), view.size());
+    return out;
+}
+
+template<typename T, typename std::enable_if<std::is_arithmetic<T>::value>::type* = nullptr>
+ParameterStream& operator>>(ParameterStream& in, ArrayView<T>& view)
+{
+    std::size_t size;
+    in >> size;
+    if (size == 0) {
+        view = ArrayView<T>();
+        return in;
+    }
+    if (const char* p = in.viewAligned(size*sizeof(T), alignof(T))) {
+        view = ArrayView<T>(reinterpret_cast<const T*>(p), size);
+    } else {
+        char* data = reinterpret_cast<char*>(view.allocate(size));
+        in.readBytes(data, size*sizeof(T));
+    }
+    return in;
+}
+
+template<typename T, typename std::enable_if<is_pod_parameter<T>::value>::type* = nullptr>
+ParameterStream& operator>>(ParameterStream& in, ArrayView<T>& view)
+{
+    std::size_t size;
+    in >> size;
+    unmarshalArrayElements(in, view.allocate(size), size);
+    return in;
+}
+
+inline ParameterStream& operator<<(ParameterStream& out, const StringView& view)
+{
+    out << static_cast<uint64_t>(view.size());
+    out.writeBytes(view.data(), view.size());
+    return out;
+}
+
+inline ParameterStream& operator>>(ParameterStream& in, StringView& view)
+{
+    uint64_t length;
+    in >> length;
+    if (const char* p = in.viewBytes(length)) {
+        view = StringView(p, length);
+    } else {
+        std::string s(length, '\0');
+        char* data = &s[0];
+        in.readBytes(data, length);
+        view.assign(std::move(s));
+    }
     return in;
 }
 
@@ -21,6 +21,16 @@
 
 namespace mpirpc {
 
+bool isPredefinedOp(MPI_Op op)
+{
+    static const MPI_Op predefined[] = {MPI_MAX, MPI_MIN, MPI_SUM, MPI_PROD, MPI_LAND, MPI_BAND, MPI_LOR, MPI_BOR,
+                                        MPI_LXOR, MPI_BXOR, MPI_MINLOC, MPI_MAXLOC, MPI_REPLACE, MPI_NO_OP};
+    for (MPI_Op p : predefined)
+        if (op == p)
+            return true;
+    return false;
+}
+
 char reduce(char value, MPI_Op op, int count, int root, MPI_Comm comm)
 {
     char ret = 0;
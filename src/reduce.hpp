@@ -21,6 +21,10 @@
 #define REDUCE_HPP
 
 #include <type_traits>
+#include <utility>
+#include <array>
+#include <memory>
+#include <cstddef>
 #include <mpi.h>
 
 namespace mpirpc
@@ -46,6 +50,153 @@ unsigned long allreduce(unsigned long value, MPI_Op op, int count, MPI_Comm comm
 float allreduce(float value, MPI_Op op, int count, MPI_Comm comm);
 double allreduce(double value, MPI_Op op, int count, MPI_Comm comm);
 
+/**
+ * @brief True if #op is one of the operations predefined by MPI, such as MPI_SUM or MPI_MINLOC
+ */
+bool isPredefinedOp(MPI_Op op);
+
+/**
+ * @brief Applies a callable of type F over the arrays MPI hands to a user-defined operation on T
+ *
+ * F either combines two values, T f(const T& in, const T& inout), or updates inout in place,
+ * void f(const T& in, T& inout). The loop over the array is generated for each F, so the call is inlined
+ * and the loop can be vectorized.
+ *
+ * MPI_Op_create() takes a plain function pointer, so the callable is held in static storage shared by every
+ * operation created from F. F must therefore be stateless, such as a lambda without captures, so that creating
+ * another operation cannot change the behaviour of the ones already created.
+ */
+template<typename T, typename F>
+struct OpTrampoline
+{
+    static_assert(std::is_empty<F>::value, "the callable of a reduction operation must be stateless");
+
+    static std::unique_ptr<F>& callable()
+    {
+        static std::unique_ptr<F> f;
+        return f;
+    }
+
+    static void apply(void* in, void* inout, int* len, MPI_Datatype*)
+    {
+        apply(static_cast<const T*>(in), static_cast<T*>(inout), *len, *callable(), std::is_void<decltype(std::declval<F&>()(std::declval<const T&>(), std::declval<T&>()))>());
+    }
+
+    static void apply(const T* __restrict__ in, T* __restrict__ inout, int len, F& f, std::true_type)
+    {
+        for (int i = 0; i < len; ++i)
+            f(in[i], inout[i]);
+    }
+
+    static void apply(const T* __restrict__ in, T* __restrict__ inout, int len, F& f, std::false_type)
+    {
+        for (int i = 0; i < len; ++i)
+            inout[i] = f(in[i], inout[i]);
+    }
+};
+
+/**
+ * @brief Create a user-defined reduction operation on T from the callable #f
+ *
+ * Use the operation with Manager::reduce() and the other reductions on T. T is then reduced whole, with the
+ * datatype given by mpiType<T>() or Manager::registerPodType<T>(). Free the operation with MPI_Op_free().
+ *
+ * @see OpTrampoline for the forms #f may take. #f must be stateless.
+ * @param commutative Whether #f is commutative, which allows MPI to reorder the reduction
+ */
+template<typename T, typename F>
+MPI_Op makeOp(F f, bool commutative)
+{
+    OpTrampoline<T, F>::callable().reset(new F(f));
+    MPI_Op op;
+    MPI_Op_create(&OpTrampoline<T, F>::apply, commutative, &op);
+    return op;
+}
+
+/**
+ * @brief Keep the pair with the smallest first value, and the smallest second value among equal first values,
+ * like MPI_MINLOC. Unlike MPI_MINLOC, any value and index types may be used.
+ */
+template<typename V, typename I>
+struct MinLoc
+{
+    void operator()(const std::pair<V, I>& in, std::pair<V, I>& inout) const
+    {
+        bool take = in.first < inout.first || (in.first == inout.first && in.second < inout.second);
+        inout.first = take ? in.first : inout.first;
+        inout.second = take ? in.second : inout.second;
+    }
+};
+
+/**
+ * @brief Keep the pair with the largest first value, and the smallest second value among equal first values,
+ * like MPI_MAXLOC
+ */
+template<typename V, typename I>
+struct MaxLoc
+{
+    void operator()(const std::pair<V, I>& in, std::pair<V, I>& inout) const
+    {
+        bool take = inout.first < in.first || (in.first == inout.first && in.second < inout.second);
+        inout.first = take ? in.first : inout.first;
+        inout.second = take ? in.second : inout.second;
+    }
+};
+
+/**
+ * @brief Elementwise sum of fixed-size arrays, for example histograms
+ */
+template<typename T, std::size_t N>
+struct ArraySum
+{
+    void operator()(const std::array<T, N>& in, std::array<T, N>& inout) const
+    {
+        for (std::size_t i = 0; i < N; ++i)
+            inout[i] += in[i];
+    }
+};
+
+/**
+ * @brief Elementwise minimum of fixed-size arrays
+ */
+template<typename T, std::size_t N>
+struct ArrayMin
+{
+    void operator()(const std::array<T, N>& in, std::array<T, N>& inout) const
+    {
+        for (std::size_t i = 0; i < N; ++i)
+            inout[i] = in[i] < inout[i] ? in[i] : inout[i];
+    }
+};
+
+/**
+ * @brief Elementwise maximum of fixed-size arrays
+ */
+template<typename T, std::size_t N>
+struct ArrayMax
+{
+    void operator()(const std::array<T, N>& in, std::array<T, N>& inout) const
+    {
+        for (std::size_t i = 0; i < N; ++i)
+            inout[i] = inout[i] < in[i] ? in[i] : inout[i];
+    }
+};
+
+/**
+ * @brief Merge axis-aligned bounding boxes stored as {min_0..min_D-1, max_0..max_D-1}
+ */
+template<typename T, std::size_t D>
+struct BoundingBoxUnion
+{
+    void operator()(const std::array<T, 2*D>& in, std::array<T, 2*D>& inout) const
+    {
+        for (std::size_t i = 0; i < D; ++i) {
+            inout[i] = in[i] < inout[i] ? in[i] : inout[i];
+            inout[D+i] = inout[D+i] < in[D+i] ? in[D+i] : inout[D+i];
+        }
+    }
+};
+
 }
 
 #endif // REDUCE_HPP
@@ -0,0 +1,231 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REDUCEFUTURE_HPP
+#define REDUCEFUTURE_HPP
+
+#include <mpi.h>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <stdexcept>
+
+namespace mpirpc {
+
+/**
+ * @brief A non-blocking reduction in progress
+ *
+ * The Manager tests its pending reductions from checkMessages(), so they complete while the rank keeps
+ * servicing invocations.
+ */
+class PendingReduce : public std::enable_shared_from_this<PendingReduce>
+{
+public:
+    PendingReduce() : m_request(MPI_REQUEST_NULL), m_done(true) {}
+    PendingReduce(const PendingReduce&) = delete;
+    PendingReduce& operator=(const PendingReduce&) = delete;
+    virtual ~PendingReduce() {}
+
+    /**
+     * @brief Test for completion without blocking
+     * @return True once the reduction has completed
+     */
+    bool test()
+    {
+        if (!m_done) {
+            int flag;
+            MPI_Test(&m_request, &flag, MPI_STATUS_IGNORE);
+            m_done = flag;
+        }
+        return m_done;
+    }
+
+    /**
+     * @brief Mark the reduction as started. The returned request must be passed to the non-blocking MPI call.
+     */
+    MPI_Request* begin()
+    {
+        m_done = false;
+        return &m_request;
+    }
+
+protected:
+    MPI_Request m_request;
+    bool m_done;
+};
+
+/**
+ * @brief The buffers of a reduction started by Manager::ireduce(), Manager::iallreduce() or Manager::iaccumulate()
+ */
+template<typename R>
+struct ReduceState : PendingReduce
+{
+    R input;
+    R result;
+};
+
+/**
+ * @brief The result of a non-blocking reduction
+ *
+ * Waiting for the result makes progress through the Manager, so invocations from other ranks continue to be
+ * serviced. Like std::future, get() may only be called once.
+ */
+template<typename R>
+class ReduceFuture
+{
+public:
+    using Progress = std::function<void()>;
+
+    ReduceFuture() {}
+    ReduceFuture(std::shared_ptr<ReduceState<R>> state, Progress progress) : m_state(state), m_progress(progress) {}
+
+    /**
+     * @brief False if default constructed or get() has been called
+     */
+    bool valid() const { return static_cast<bool>(m_state); }
+
+    /**
+     * @brief Test for completion without blocking
+     */
+    bool ready() const { return m_state->test(); }
+
+    /**
+     * @brief Make progress until the reduction has completed
+     * @throws ShutdownException if the Manager is shut down first
+     */
+    void wait() const
+    {
+        while (!m_state->test())
+            m_progress();
+    }
+
+    /**
+     * @brief Wait for and take the result. At ranks other than the root of a reduce, the result is unspecified.
+     * @throws std::logic_error if the result has already been taken
+     */
+    R get()
+    {
+        if (!m_state)
+            throw std::logic_error("ReduceFuture: the result has already been taken");
+        wait();
+        R result = std::move(m_state->result);
+        m_state.reset();
+        return result;
+    }
+
+protected:
+    std::shared_ptr<ReduceState<R>> m_state;
+    Progress m_progress;
+};
+
+/**
+ * @brief A reduction repeated over the same buffers, for example every timestep
+ *
+ * Fill input() and call start(), then wait() for the result. The buffers are allocated once. Where MPI 4
+ * persistent collectives are available, the reduction is also only set up once.
+ *
+ * start() is collective: it must be called in the same order with respect to other reductions on every rank.
+ * Create with Manager::persistentReduce() or Manager::persistentAllreduce().
+ */
+template<typename T>
+class PersistentReduce : public PendingReduce
+{
+public:
+    using Progress = std::function<void()>;
+    using Tracker = std::function<void(std::shared_ptr<PendingReduce>)>;
+
+    /**
+     * @param size The number of elements of T reduced
+     * @param count The number of #type elements in each T
+     * @param root The root rank, or -1 for an allreduce
+     */
+    PersistentReduce(std::size_t size, MPI_Datatype type, int count, MPI_Op op, int root, MPI_Comm comm, Progress progress, Tracker track)
+        : m_input(size), m_result(size), m_type(type), m_count(size*count), m_op(op), m_root(root), m_comm(comm),
+          m_progress(progress), m_track(track)
+    {
+#if MPI_VERSION >= 4
+        if (m_root < 0)
+            MPI_Allreduce_init(m_input.data(), m_result.data(), m_count, m_type, m_op, m_comm, MPI_INFO_NULL, &m_request);
+        else
+            MPI_Reduce_init(m_input.data(), m_result.data(), m_count, m_type, m_op, m_root, m_comm, MPI_INFO_NULL, &m_request);
+#endif
+    }
+
+    ~PersistentReduce()
+    {
+#if MPI_VERSION >= 4
+        MPI_Request_free(&m_request);
+#endif
+    }
+
+    /**
+     * @brief The values contributed by this rank. Must not be resized or modified while the reduction is running.
+     */
+    std::vector<T>& input() { return m_input; }
+
+    /**
+     * @brief The result of the last completed reduction. At ranks other than the root of a reduce, it is unspecified.
+     */
+    const std::vector<T>& result() const { return m_result; }
+
+    /**
+     * @brief Start the reduction of the current input()
+     * @throws std::logic_error if the previous reduction has not completed
+     */
+    void start()
+    {
+        if (!test())
+            throw std::logic_error("PersistentReduce: started while the previous reduction is running");
+#if MPI_VERSION >= 4
+        MPI_Start(begin());
+#else
+        if (m_root < 0)
+            MPI_Iallreduce(m_input.data(), m_result.data(), m_count, m_type, m_op, m_comm, begin());
+        else
+            MPI_Ireduce(m_input.data(), m_result.data(), m_count, m_type, m_op, m_root, m_comm, begin());
+#endif
+        m_track(shared_from_this());
+    }
+
+    /**
+     * @brief Make progress until the reduction has completed
+     * @return The result
+     */
+    const std::vector<T>& wait()
+    {
+        while (!test())
+            m_progress();
+        return m_result;
+    }
+
+protected:
+    std::vector<T> m_input;
+    std::vector<T> m_result;
+    MPI_Datatype m_type;
+    int m_count;
+    MPI_Op m_op;
+    int m_root;
+    MPI_Comm m_comm;
+    Progress m_progress;
+    Tracker m_track;
+};
+
+}
+
+#endif // REDUCEFUTURE_HPP
@@ -0,0 +1,120 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REPLICATED_HPP
+#define REPLICATED_HPP
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "common.hpp"
+
+namespace mpirpc {
+
+/**
+ * @brief The replication state of an object registered with Manager::registerReplicatedObject()
+ *
+ * The primary rank applies every mutation first and numbers it with the next version. The mutation is then sent to
+ * the other ranks as a delta: the handle of the member function and its serialized arguments. Replicas apply the
+ * deltas in version order, so every copy passes through the same sequence of states.
+ */
+class ReplicatedObjectBase
+{
+    friend class Manager;
+public:
+    using Progress = std::function<void()>;
+
+    ReplicatedObjectBase(void* object, int primary, Progress progress)
+        : m_object(object), m_primary(primary), m_version(0), m_submitted(0), m_ownApplied(0), m_progress(progress) {}
+    virtual ~ReplicatedObjectBase() {}
+
+    int primary() const { return m_primary; }
+
+    /**
+     * @brief The number of mutations applied to the local copy
+     */
+    uint64_t version() const { return m_version; }
+
+    /**
+     * @brief Make progress until the local copy has reached #minVersion
+     * @throws ShutdownException if the Manager is shut down first
+     */
+    void waitForVersion(uint64_t minVersion) const
+    {
+        while (m_version < minVersion)
+            m_progress();
+    }
+
+    /**
+     * @brief Make progress until every mutation invoked from this rank has been applied to the local copy
+     * @throws ShutdownException if the Manager is shut down first
+     */
+    void waitForOwnWrites() const
+    {
+        while (m_ownApplied < m_submitted)
+            m_progress();
+    }
+
+protected:
+    struct Delta
+    {
+        int origin;
+        uint64_t sequence;
+        FunctionHandle functionHandle;
+        std::vector<uint8_t> arguments;
+    };
+
+    void* m_object;
+    int m_primary;
+    uint64_t m_version;
+    uint64_t m_submitted;
+    uint64_t m_ownApplied;
+    std::map<uint64_t, Delta> m_pendingDeltas; //Deltas received ahead of their version
+    Progress m_progress;
+    FunctionHandle m_mutateHandle;
+    FunctionHandle m_deltaHandle;
+};
+
+/**
+ * @brief A full copy of a Class object on every rank. Reads are served from the local copy. Mutations are made
+ * through Manager::invokeReplicated().
+ */
+template<class Class>
+class ReplicatedObject : public ReplicatedObjectBase
+{
+public:
+    ReplicatedObject(Class* object, int primary, Progress progress) : ReplicatedObjectBase(object, primary, progress) {}
+
+    /**
+     * @brief The local copy, once it has reached #minVersion
+     */
+    const Class& read(uint64_t minVersion = 0) const
+    {
+        waitForVersion(minVersion);
+        return *static_cast<const Class*>(m_object);
+    }
+
+    const Class* operator->() const { return static_cast<const Class*>(m_object); }
+};
+
+}
+
+#endif // REPLICATED_HPP
@@ -0,0 +1,135 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "resultcache.hpp"
+
+#include <cstdint>
+#include <iterator>
+
+namespace mpirpc {
+
+std::size_t ResultCache::KeyHash::operator()(const Key& key) const
+{
+    //FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](unsigned char c) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    };
+    for (std::size_t i = 0; i < sizeof(key.functionHandle); ++i)
+        mix(key.functionHandle >> (8*i));
+    for (std::size_t i = 0; i < sizeof(key.rank); ++i)
+        mix(static_cast<unsigned int>(key.rank) >> (8*i));
+    for (char c : key.arguments)
+        mix(c);
+    return h;
+}
+
+ResultCache::ResultCache(std::size_t capacity)
+    : m_capacity(capacity), m_generation(0)
+{
+}
+
+void ResultCache::setCapacity(std::size_t capacity)
+{
+    m_capacity = capacity;
+    while (m_stats.bytes > m_capacity) {
+        evict(std::prev(m_entries.end()));
+        ++m_stats.evictions;
+    }
+}
+
+const std::vector<char>* ResultCache::find(const Key& key)
+{
+    if (m_capacity == 0)
+        return nullptr;
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        ++m_stats.misses;
+        return nullptr;
+    }
+    ++m_stats.hits;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return &it->second->result;
+}
+
+void ResultCache::insert(const Key& key, const std::vector<char>& result, unsigned long long generation)
+{
+    if (generation != m_generation)
+        return;
+    auto existing = m_index.find(key);
+    if (existing != m_index.end())
+        evict(existing->second);
+    std::size_t size = key.arguments.size() + result.size();
+    if (size > m_capacity)
+        return;
+    while (m_stats.bytes + size > m_capacity) {
+        evict(std::prev(m_entries.end()));
+        ++m_stats.evictions;
+    }
+    auto indexed = m_index.emplace(key, m_entries.end()).first;
+    m_entries.push_front(Entry{&indexed->first, result});
+    indexed->second = m_entries.begin();
+    m_stats.bytes += size;
+    ++m_stats.entries;
+}
+
+void ResultCache::invalidate(FunctionHandle functionHandle, int rank)
+{
+    ++m_generation;
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        auto next = std::next(it);
+        if ((functionHandle == 0 || it->key->functionHandle == functionHandle) && (rank < 0 || it->key->rank == rank)) {
+            evict(it);
+            ++m_stats.invalidations;
+        }
+        it = next;
+    }
+}
+
+std::shared_ptr<ResultCache::PendingCall> ResultCache::pendingCall(const Key& key) const
+{
+    auto it = m_pending.find(key);
+    return it == m_pending.end() ? nullptr : it->second;
+}
+
+void ResultCache::beginCall(const Key& key, std::shared_ptr<PendingCall> call)
+{
+    m_pending[key] = call;
+}
+
+void ResultCache::endCall(const Key& key)
+{
+    m_pending.erase(key);
+}
+
+void ResultCache::evict(std::list<Entry>::iterator entry)
+{
+    m_stats.bytes -= entrySize(*entry);
+    --m_stats.entries;
+    m_index.erase(m_index.find(*entry->key));
+    m_entries.erase(entry);
+}
+
+std::size_t ResultCache::entrySize(const Entry& entry)
+{
+    return entry.key->arguments.size() + entry.result.size();
+}
+
+}
@@ -0,0 +1,151 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RESULTCACHE_HPP
+#define RESULTCACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+#define MPIRPC_RESULT_CACHE_SIZE (16*1024*1024)
+
+namespace mpirpc {
+
+/**
+ * @brief Counters showing whether caching the results of pure functions pays off
+ */
+struct ResultCacheStats
+{
+    ResultCacheStats() : hits(0), misses(0), coalesced(0), evictions(0), invalidations(0), entries(0), bytes(0) {}
+
+    double hitRate() const { return hits + misses ? static_cast<double>(hits)/(hits + misses) : 0.0; }
+
+    unsigned long long hits;          ///< Calls answered from the cache
+    unsigned long long misses;        ///< Calls not found in the cache
+    unsigned long long coalesced;     ///< Calls answered by an identical call already in flight
+    unsigned long long evictions;     ///< Entries evicted to stay within the capacity
+    unsigned long long invalidations; ///< Entries removed by invalidate()
+    std::size_t entries;              ///< Entries currently cached
+    std::size_t bytes;                ///< Bytes of arguments and results currently cached
+};
+
+/**
+ * @brief A least recently used cache of the serialized results of pure functions
+ *
+ * Entries are keyed by the function handle, the rank the function ran on and the serialized arguments. The keys and
+ * results are kept serialized, so the capacity bounds the memory used. The cache also tracks the calls which are
+ * waiting for their results, so identical calls made meanwhile can share them. See: Manager::registerFunction()
+ */
+class ResultCache
+{
+public:
+    struct Key
+    {
+        FunctionHandle functionHandle;
+        int rank;
+        std::vector<char> arguments;
+
+        bool operator==(const Key& other) const
+        {
+            return functionHandle == other.functionHandle && rank == other.rank && arguments == other.arguments;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const;
+    };
+
+    /**
+     * @brief A call waiting for its result. Whoever receives the result stores it here.
+     */
+    struct PendingCall
+    {
+        PendingCall(int r, int d, unsigned long long g) : rank(r), depth(d), generation(g), done(false) {}
+
+        int rank;
+        int depth;                    ///< The number of nested waits for returns from #rank, including this one
+        unsigned long long generation;
+        bool done;
+        std::vector<char> result;
+    };
+
+    ResultCache(std::size_t capacity = 0);
+
+    /**
+     * @brief The maximum number of bytes of arguments and results to keep. 0 disables caching.
+     */
+    void setCapacity(std::size_t capacity);
+    std::size_t capacity() const { return m_capacity; }
+
+    /**
+     * @brief The cached result for #key, which becomes the most recently used entry, or nullptr
+     */
+    const std::vector<char>* find(const Key& key);
+
+    /**
+     * @brief Cache #result for #key, evicting the least recently used entries to make room. Results of calls
+     * started before the last invalidation are not cached.
+     */
+    void insert(const Key& key, const std::vector<char>& result, unsigned long long generation);
+
+    /**
+     * @brief Remove the results of #functionHandle, or of every function if it is 0, called on #rank, or on
+     * every rank if it is negative
+     */
+    void invalidate(FunctionHandle functionHandle = 0, int rank = -1);
+
+    /**
+     * @brief Increases with each invalidation
+     */
+    unsigned long long generation() const { return m_generation; }
+
+    std::shared_ptr<PendingCall> pendingCall(const Key& key) const;
+    void beginCall(const Key& key, std::shared_ptr<PendingCall> call);
+    void endCall(const Key& key);
+
+    ResultCacheStats& stats() { return m_stats; }
+    const ResultCacheStats& stats() const { return m_stats; }
+
+protected:
+    struct Entry
+    {
+        const Key* key; //Owned by m_index, whose keys do not move
+        std::vector<char> result;
+    };
+
+    void evict(std::list<Entry>::iterator entry);
+    static std::size_t entrySize(const Entry& entry);
+
+    std::size_t m_capacity;
+    unsigned long long m_generation;
+    std::list<Entry> m_entries; //Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    std::unordered_map<Key, std::shared_ptr<PendingCall>, KeyHash> m_pending;
+    ResultCacheStats m_stats;
+};
+
+}
+
+#endif // RESULTCACHE_HPP
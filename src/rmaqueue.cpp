@@ -0,0 +1,187 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rmaqueue.hpp"
+#include <atomic>
+#include <cstring>
+
+#define RMA_HEAD_OFFSET 0
+#define RMA_TAIL_OFFSET 8
+#define RMA_DATA_OFFSET 16
+#define RMA_WRAP_TAG 0xFFFF
+
+namespace mpirpc {
+
+constexpr int RmaQueue::RedirectTag;
+
+static inline std::size_t align8(std::size_t n)
+{
+    return (n + 7) & ~static_cast<std::size_t>(7);
+}
+
+RmaQueue::RmaQueue(MPI_Comm comm, std::size_t ringSize)
+    : m_comm(comm), m_base(nullptr), m_ringSize(align8(ringSize)), m_nextSource(0)
+{
+    MPI_Comm_rank(m_comm, &m_rank);
+    MPI_Comm_size(m_comm, &m_numProcs);
+    m_slotSize = RMA_DATA_OFFSET + m_ringSize;
+    m_tail.resize(m_numProcs, 0);
+    m_remoteHead.resize(m_numProcs, 0);
+    MPI_Win_allocate(m_slotSize*m_numProcs, 1, MPI_INFO_NULL, m_comm, &m_base, &m_win);
+    std::memset(m_base, 0, m_slotSize*m_numProcs);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, m_win);
+    MPI_Barrier(m_comm); //rings must be zeroed before any rank writes to them
+}
+
+RmaQueue::~RmaQueue()
+{
+    MPI_Win_unlock_all(m_win);
+    MPI_Win_free(&m_win);
+}
+
+bool RmaQueue::fits(std::size_t length) const
+{
+    return sizeof(uint64_t) + align8(length) <= m_ringSize;
+}
+
+bool RmaQueue::reserve(int rank, std::size_t needed, std::size_t& offset)
+{
+    MPI_Aint slot = static_cast<MPI_Aint>(m_rank)*m_slotSize;
+    uint64_t tail = m_tail[rank];
+    if (tail + needed - m_remoteHead[rank] > m_ringSize)
+    {
+        //Only refresh the consumer position when the cached one says the ring is full
+        uint64_t head, dummy = 0;
+        MPI_Fetch_and_op(&dummy, &head, MPI_UINT64_T, rank, slot + RMA_HEAD_OFFSET, MPI_NO_OP, m_win);
+        MPI_Win_flush(rank, m_win);
+        m_remoteHead[rank] = head;
+        if (tail + needed - head > m_ringSize)
+            return false;
+    }
+    uint64_t amount = needed, old;
+    MPI_Fetch_and_op(&amount, &old, MPI_UINT64_T, rank, slot + RMA_TAIL_OFFSET, MPI_SUM, m_win);
+    m_tail[rank] = tail + needed;
+    offset = tail % m_ringSize;
+    return true;
+}
+
+void RmaQueue::publish(int rank, std::size_t offset, uint64_t word)
+{
+    MPI_Aint disp = static_cast<MPI_Aint>(m_rank)*m_slotSize + RMA_DATA_OFFSET + offset;
+    MPI_Accumulate(&word, 1, MPI_UINT64_T, rank, disp, 1, MPI_UINT64_T, MPI_REPLACE, m_win);
+    MPI_Win_flush(rank, m_win);
+}
+
+bool RmaQueue::tryPush(int rank, const char* data, std::size_t length, int tag)
+{
+    std::size_t needed = sizeof(uint64_t) + align8(length);
+    std::size_t offset = m_tail[rank] % m_ringSize;
+    if (offset + needed > m_ringSize)
+    {
+        //Skip the remainder of the ring. This is reserved separately so that any record which fits can eventually be written.
+        std::size_t wrapOffset;
+        if (!reserve(rank, m_ringSize - offset, wrapOffset))
+            return false;
+        MPI_Win_flush(rank, m_win);
+        publish(rank, wrapOffset, RMA_WRAP_TAG);
+    }
+    if (!reserve(rank, needed, offset))
+        return false;
+    if (length > 0)
+    {
+        MPI_Aint disp = static_cast<MPI_Aint>(m_rank)*m_slotSize + RMA_DATA_OFFSET + offset + sizeof(uint64_t);
+        MPI_Put(data, length, MPI_BYTE, rank, disp, length, MPI_BYTE, m_win);
+    }
+    MPI_Win_flush(rank, m_win); //the payload must be complete before the header word is visible
+    publish(rank, offset, (static_cast<uint64_t>(length) << 16) | static_cast<uint64_t>(tag));
+    return true;
+}
+
+bool RmaQueue::tryPushRedirect(int rank, int tag)
+{
+    std::size_t offset = m_tail[rank] % m_ringSize;
+    if (offset + sizeof(uint64_t) > m_ringSize)
+    {
+        std::size_t wrapOffset;
+        if (!reserve(rank, m_ringSize - offset, wrapOffset))
+            return false;
+        MPI_Win_flush(rank, m_win);
+        publish(rank, wrapOffset, RMA_WRAP_TAG);
+    }
+    if (!reserve(rank, sizeof(uint64_t), offset))
+        return false;
+    MPI_Win_flush(rank, m_win);
+    publish(rank, offset, (static_cast<uint64_t>(tag) << 16) | static_cast<uint64_t>(RedirectTag));
+    return true;
+}
+
+bool RmaQueue::poll(int& source, int& tag, std::vector<char>*& data, std::size_t& length)
+{
+    MPI_Win_sync(m_win);
+    for (int i = 0; i < m_numProcs; ++i)
+    {
+        int s = (m_nextSource + i) % m_numProcs;
+        char* slot = m_base + static_cast<std::size_t>(s)*m_slotSize;
+        volatile uint64_t* headp = reinterpret_cast<volatile uint64_t*>(slot + RMA_HEAD_OFFSET);
+        volatile uint64_t* tailp = reinterpret_cast<volatile uint64_t*>(slot + RMA_TAIL_OFFSET);
+        uint64_t head = *headp;
+        while (*tailp != head)
+        {
+            std::size_t offset = head % m_ringSize;
+            char* record = slot + RMA_DATA_OFFSET + offset;
+            uint64_t word = *reinterpret_cast<volatile uint64_t*>(record);
+            if (word == 0)
+                break; //reserved, but not yet published
+            std::atomic_thread_fence(std::memory_order_acquire);
+            int t = static_cast<int>(word & 0xFFFF);
+            std::size_t len = static_cast<std::size_t>(word >> 16);
+            if (t == RMA_WRAP_TAG)
+            {
+                std::memset(record, 0, m_ringSize - offset);
+                head += m_ringSize - offset;
+                *headp = head;
+                continue;
+            }
+            std::size_t needed = sizeof(uint64_t);
+            if (t == RedirectTag)
+            {
+                data = nullptr;
+            }
+            else
+            {
+                needed += align8(len);
+                data = new std::vector<char>(record + sizeof(uint64_t), record + sizeof(uint64_t) + len);
+            }
+            //Zero the record before releasing it so that stale bytes are never mistaken for a header word
+            std::memset(record, 0, needed);
+            head += needed;
+            *headp = head;
+            MPI_Win_sync(m_win);
+            source = s;
+            tag = t;
+            length = len;
+            m_nextSource = (s + 1) % m_numProcs;
+            return true;
+        }
+        MPI_Win_sync(m_win);
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,110 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RMAQUEUE_HPP
+#define RMAQUEUE_HPP
+
+#include <mpi.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define MPIRPC_RMA_RING_SIZE (64*1024)
+
+namespace mpirpc {
+
+/**
+ * @brief The RmaQueue class
+ *
+ * One-sided active message transport. Each rank exposes an MPI window holding one ring
+ * buffer per source rank. A sender reserves space in its ring on the target with
+ * MPI_Fetch_and_op, writes the serialized message with MPI_Put and then publishes the
+ * record header word. The target drains its local rings without any MPI matching.
+ *
+ * Each ring has exactly one writer, so messages from a given source are read in the
+ * order in which they were pushed.
+ *
+ * Ring layout: [uint64_t head][uint64_t tail][ring data]. Records in the ring data are
+ * [uint64_t word][payload padded to 8 bytes], where word = (length << 16) | tag.
+ * A zero word marks a record which has not yet been published.
+ *
+ * Constructing and destroying an RmaQueue are collective over the communicator.
+ */
+class RmaQueue
+{
+public:
+    /**
+     * Tag returned by RmaQueue::poll() when the message did not fit in the ring and is
+     * instead being sent with a two-sided send. The original tag is returned in #length.
+     */
+    static constexpr int RedirectTag = 0xFFFE;
+
+    RmaQueue(MPI_Comm comm, std::size_t ringSize = MPIRPC_RMA_RING_SIZE);
+    ~RmaQueue();
+
+    /**
+     * @brief Check if a message of #length bytes can be sent through the ring.
+     */
+    bool fits(std::size_t length) const;
+
+    /**
+     * @brief Attempt to write a message into the ring of rank #rank
+     * @return False if the ring is currently full. The caller should make progress and retry.
+     */
+    bool tryPush(int rank, const char* data, std::size_t length, int tag);
+
+    /**
+     * @brief Attempt to write a redirect record indicating that a message with tag #tag
+     * follows as a two-sided send.
+     * @return False if the ring is currently full.
+     */
+    bool tryPushRedirect(int rank, int tag);
+
+    /**
+     * @brief Retrieve the next message from the local rings.
+     *
+     * Sources are visited round-robin. On success, #data is a newly allocated buffer which
+     * the caller owns. For redirect records, #tag is RedirectTag, #data is nullptr and
+     * #length holds the tag of the two-sided message that follows.
+     *
+     * @return True if a message was retrieved.
+     */
+    bool poll(int& source, int& tag, std::vector<char>*& data, std::size_t& length);
+
+    std::size_t ringSize() const { return m_ringSize; }
+
+protected:
+    bool reserve(int rank, std::size_t needed, std::size_t& offset);
+    void publish(int rank, std::size_t offset, uint64_t word);
+
+    MPI_Comm m_comm;
+    MPI_Win m_win;
+    char* m_base;
+    std::size_t m_ringSize;
+    std::size_t m_slotSize;
+    int m_rank;
+    int m_numProcs;
+    int m_nextSource;
+    std::vector<uint64_t> m_tail;
+    std::vector<uint64_t> m_remoteHead;
+};
+
+}
+
+#endif // RMAQUEUE_HPP
@@ -1,8 +1,42 @@
 #include "mpirpctest.hpp"
 
 #include "../parameterstream.hpp"
+#include "../codec.hpp"
+#include "../invocationheader.hpp"
+#include "../mpitype.hpp"
+#include "../reduce.hpp"
+#include "../accumulate.hpp"
+#include "../resultcache.hpp"
+#include "../metrics.hpp"
+#include "../tracer.hpp"
+#include "../arena.hpp"
+#include "../manager.hpp"
+#include "../distributedmap.hpp"
+#include "../rmaqueue.hpp"
 #include <QDebug>
 #include <type_traits>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+
+struct PodPoint
+{
+    double pos[3];
+    int id;
+};
+
+MPIRPC_POD_TYPE(PodPoint)
+
+void MpirpcTest::initTestCase()
+{
+    m_manager = new mpirpc::Manager(MPI_COMM_WORLD);
+}
+
+void MpirpcTest::cleanupTestCase()
+{
+    m_manager->sync();
+    delete m_manager;
+}
 
 template<typename T>
 T testParamStream(T t)
@@ -170,4 +204,1201 @@ void MpirpcTest::stream_combo() {
     QVERIFY(ok == true);
 }
 
-QTEST_APPLESS_MAIN(MpirpcTest)
+void MpirpcTest::stream_vector_test() {
+    std::vector<double> v{1.5, 2.5, 3.5};
+    QCOMPARE(testParamStream(v), v);
+    std::vector<bool> b{true, false, true};
+    QCOMPARE(testParamStream(b), b);
+}
+
+void MpirpcTest::stream_unique_ptr_test() {
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    std::unique_ptr<int> p(new int(42));
+    std::unique_ptr<int> n;
+    s << p << n;
+    s.seek(0);
+    std::unique_ptr<int> p2 = mpirpc::unmarshal<std::unique_ptr<int>>(s);
+    std::unique_ptr<int> n2(new int(1));
+    s >> n2;
+    QVERIFY(p2 && *p2 == 42);
+    QVERIFY(!n2);
+}
+
+void MpirpcTest::stream_array_into_test() {
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    std::vector<int> v{4, 5, 6};
+    s << v;
+    s.seek(0);
+    int out[3];
+    QCOMPARE(mpirpc::unmarshalArray(s, out, 3), (std::size_t) 3);
+    QCOMPARE(out[2], 6);
+}
+
+void MpirpcTest::stream_chunked_test() {
+    std::vector<std::vector<char>> chunks;
+    std::vector<char> out;
+    mpirpc::ParameterStream w(&out);
+    w.setSink([&chunks](mpirpc::ParameterStream& s) {
+        chunks.push_back(*s.dataVector());
+        s.dataVector()->clear();
+    }, 7);
+    std::vector<double> v{1.5, 2.5, 3.5, 4.5};
+    std::string str("chunked string");
+    w << v << str << "chars" << (uint32_t) 42;
+    chunks.push_back(out);
+    QVERIFY(chunks.size() > 4);
+    for (std::size_t i = 0; i + 1 < chunks.size(); ++i)
+        QCOMPARE(chunks[i].size(), (std::size_t) 7);
+
+    std::size_t next = 1;
+    std::vector<char> in(chunks[0]);
+    mpirpc::ParameterStream r(&in);
+    r.setSource([&chunks, &next](mpirpc::ParameterStream& s) {
+        if (next == chunks.size())
+            return false;
+        s.dataVector()->insert(s.dataVector()->end(), chunks[next].begin(), chunks[next].end());
+        ++next;
+        return true;
+    });
+    std::vector<double> v2;
+    std::string str2;
+    char* chars;
+    uint32_t i;
+    r >> v2 >> str2 >> chars >> i;
+    QCOMPARE(v2, v);
+    QCOMPARE(str2, str);
+    QCOMPARE(strcmp(chars, "chars"), 0);
+    QCOMPARE(i, (uint32_t) 42);
+    delete[] chars;
+    QVERIFY(in.size() <= 14);
+    QVERIFY_EXCEPTION_THROWN(r >> i, std::out_of_range);
+}
+
+void MpirpcTest::codec_lz_test() {
+    mpirpc::LzCodec codec;
+    std::vector<std::vector<char>> inputs;
+    inputs.push_back(std::vector<char>());
+    inputs.push_back(std::vector<char>{'a', 'b', 'c'});
+    inputs.push_back(std::vector<char>(100000, 'x'));
+    std::vector<char> mixed;
+    uint32_t x = 12345;
+    for (int i = 0; i < 200000; ++i)
+    {
+        x = x * 1103515245 + 12345;
+        mixed.push_back((i / 1000) % 2 ? static_cast<char>(x >> 16) : static_cast<char>(i % 7));
+    }
+    inputs.push_back(mixed);
+    for (const std::vector<char>& input : inputs)
+    {
+        std::vector<char> compressed;
+        codec.compress(input.data(), input.size(), compressed);
+        std::vector<char> output{'h'};
+        codec.decompress(compressed.data(), compressed.size(), output, input.size());
+        QCOMPARE(output.size(), input.size() + 1);
+        QVERIFY(std::equal(input.begin(), input.end(), output.begin() + 1));
+    }
+    std::vector<char> compressed;
+    codec.compress(inputs[2].data(), inputs[2].size(), compressed);
+    QVERIFY(compressed.size() < 1000);
+}
+
+void MpirpcTest::invocation_header_test() {
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    mpirpc::InvocationHeader h;
+    h.flags = MPIRPC_FLAG_RETURN;
+    h.functionHandle = 5;
+    s << h;
+    QCOMPARE(buffer.size(), (size_t) 2);
+    h.flags = MPIRPC_FLAG_MEMBER;
+    h.functionHandle = 300;
+    h.typeId = 1;
+    h.objectId = UINT64_MAX;
+    s << h;
+    QCOMPARE(buffer.size(), (size_t) (2 + 1 + 2 + 1 + 10));
+    s.seek(0);
+    mpirpc::InvocationHeader r1, r2;
+    s >> r1 >> r2;
+    QCOMPARE(r1.flags, (uint8_t) MPIRPC_FLAG_RETURN);
+    QCOMPARE(r1.functionHandle, (mpirpc::FunctionHandle) 5);
+    QCOMPARE(r2.flags, (uint8_t) MPIRPC_FLAG_MEMBER);
+    QCOMPARE(r2.functionHandle, (mpirpc::FunctionHandle) 300);
+    QCOMPARE(r2.typeId, (mpirpc::TypeId) 1);
+    QCOMPARE(r2.objectId, (mpirpc::ObjectId) UINT64_MAX);
+    buffer[0] = 0;
+    s.seek(0);
+    QVERIFY_EXCEPTION_THROWN(s >> r1, mpirpc::UnsupportedHeaderVersionException);
+}
+
+void MpirpcTest::stream_pod_test() {
+    std::vector<PodPoint> v{ {{1.0, 2.0, 3.0}, 1}, {{4.0, 5.0, 6.0}, 2} };
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    s << v[0] << v;
+    QCOMPARE(buffer.size(), sizeof(PodPoint) + sizeof(std::size_t) + 2*sizeof(PodPoint));
+    s.seek(0);
+    PodPoint p;
+    std::vector<PodPoint> v2;
+    s >> p >> v2;
+    QCOMPARE(p.id, 1);
+    QCOMPARE(p.pos[2], 3.0);
+    QCOMPARE(v2.size(), (size_t) 2);
+    QCOMPARE(v2[1].pos[0], 4.0);
+    QCOMPARE(v2[1].id, 2);
+
+    //Arrays go through the attachment callbacks when they are set
+    std::vector<char> out;
+    const void* attached = nullptr;
+    mpirpc::ParameterStream a(&out);
+    a.setAttachmentSink([&](const void* data, std::size_t count, std::type_index type) {
+        attached = data;
+        QCOMPARE(count, (size_t) 2);
+        QVERIFY(type == std::type_index(typeid(PodPoint)));
+    });
+    a << v;
+    QCOMPARE(attached, (const void*) v.data());
+    QCOMPARE(out.size(), sizeof(std::size_t));
+    std::vector<PodPoint> v3;
+    a.setAttachmentSource([&](void* data, std::size_t count, std::type_index) {
+        std::memcpy(data, attached, count*sizeof(PodPoint));
+    });
+    a >> v3;
+    QCOMPARE(v3[1].id, 2);
+}
+
+enum class TestEnum : short { A, B };
+
+void MpirpcTest::mpitype_test() {
+    static_assert(MpiTypeTraits<std::pair<int, double>>::supported, "pairs of supported types are supported");
+    static_assert(!MpiTypeTraits<std::string>::supported, "std::string has no MPI datatype");
+    static_assert(MpiElementType<std::array<std::array<float, 2>, 3>>::count == 6, "nested arrays are flattened");
+    static_assert(std::is_same<MpiElementType<double[4]>::type, double>::value, "C arrays are flattened");
+    QVERIFY(mpiType<bool>() == MPI_CXX_BOOL);
+    QVERIFY(mpiType<int8_t>() == MPI_SIGNED_CHAR);
+    QVERIFY(mpiType<uint8_t>() == MPI_UNSIGNED_CHAR);
+    QVERIFY(mpiType<const int>() == MPI_INT);
+    QVERIFY(mpiType<TestEnum>() == MPI_SHORT);
+    QVERIFY(mpiType<std::complex<double>>() == MPI_C_DOUBLE_COMPLEX);
+    QVERIFY((mpiType<std::pair<double, int>>() == MPI_DOUBLE_INT));
+}
+
+void MpirpcTest::op_trampoline_test() {
+    using Loc = std::pair<double, long>;
+    using LocOp = mpirpc::OpTrampoline<Loc, mpirpc::MinLoc<double, long>>;
+    LocOp::callable().reset(new mpirpc::MinLoc<double, long>());
+    Loc in[3] = {{1.0, 5}, {2.0, 1}, {3.0, 2}};
+    Loc inout[3] = {{2.0, 0}, {2.0, 3}, {1.0, 9}};
+    int len = 3;
+    LocOp::apply(in, inout, &len, nullptr);
+    QCOMPARE(inout[0], Loc(1.0, 5));
+    QCOMPARE(inout[1], Loc(2.0, 1));
+    QCOMPARE(inout[2], Loc(1.0, 9));
+
+    auto scale = [](const int& a, const int& b) { return 2*a + b; };
+    using ScaleOp = mpirpc::OpTrampoline<int, decltype(scale)>;
+    ScaleOp::callable().reset(new decltype(scale)(scale));
+    int a[2] = {1, 2};
+    int b[2] = {10, 20};
+    len = 2;
+    ScaleOp::apply(a, b, &len, nullptr);
+    QCOMPARE(b[0], 12);
+    QCOMPARE(b[1], 24);
+}
+
+void MpirpcTest::accumulate_test() {
+    std::vector<long> v(200000);
+    for (std::size_t i = 0; i < v.size(); ++i)
+        v[i] = i % 97;
+    long expected = std::accumulate(v.begin(), v.end(), 3L);
+    for (int threads : {1, 2, 3, 8})
+        QCOMPARE(mpirpc::accumulate(v.begin(), v.end(), 3L, std::plus<long>(), threads), expected);
+
+    //A single thread applies any operation in order, starting from the seed
+    std::vector<int> small{1, 2, 3, 4};
+    auto sumSquares = [](int a, int x) { return a + x*x; };
+    QCOMPARE(mpirpc::accumulate(small.begin(), small.end(), 1, sumSquares, 1), 31);
+    QCOMPARE(mpirpc::accumulate(small.begin(), small.end(), 1, sumSquares, 8), 31);
+    std::vector<double> d(1000);
+    for (std::size_t i = 0; i < d.size(); ++i)
+        d[i] = 1.0/(i + 1);
+    QCOMPARE(mpirpc::accumulate(d.begin(), d.end(), 0.0, std::plus<double>(), 1), std::accumulate(d.begin(), d.end(), 0.0));
+
+    std::vector<std::string> s{"a", "b", "c", "d"};
+    QCOMPARE(mpirpc::accumulate(s.begin(), s.end(), std::string(">"), std::plus<std::string>(), 4), std::string(">abcd"));
+}
+
+void MpirpcTest::scan_test() {
+    std::vector<long> v(100000);
+    for (std::size_t i = 0; i < v.size(); ++i)
+        v[i] = i % 13;
+    std::vector<long> expected(v.size());
+    std::partial_sum(v.begin(), v.end(), expected.begin());
+    for (int threads : {1, 3}) {
+        std::vector<long> in(v);
+        mpirpc::inclusiveScan(in.begin(), in.end(), 0L, std::plus<long>(), threads);
+        QCOMPARE(in, expected);
+        in = v;
+        mpirpc::exclusiveScan(in.begin(), in.end(), 5L, std::plus<long>(), threads);
+        QCOMPARE(in.front(), 5L);
+        QCOMPARE(in.back(), expected[expected.size()-2] + 5);
+    }
+}
+
+void MpirpcTest::result_cache_test() {
+    mpirpc::ResultCache cache(8);
+    mpirpc::ResultCache::Key a{1, 0, {'a'}};
+    mpirpc::ResultCache::Key b{1, 1, {'a'}};
+    mpirpc::ResultCache::Key c{2, 0, {'c'}};
+    cache.insert(a, {'1', '1'}, cache.generation());
+    cache.insert(b, {'2', '2'}, cache.generation());
+    QVERIFY(cache.find(a) != nullptr);
+    cache.insert(c, {'3', '3'}, cache.generation());
+    QVERIFY(cache.find(b) == nullptr);
+    QCOMPARE(*cache.find(a), std::vector<char>({'1', '1'}));
+    QCOMPARE(cache.stats().evictions, 1ULL);
+    QCOMPARE(cache.stats().bytes, std::size_t(6));
+
+    unsigned long long generation = cache.generation();
+    cache.invalidate(1);
+    QVERIFY(cache.find(a) == nullptr);
+    QVERIFY(cache.find(c) != nullptr);
+    cache.insert(a, {'1'}, generation);
+    QVERIFY(cache.find(a) == nullptr);
+    QCOMPARE(cache.stats().invalidations, 1ULL);
+    QCOMPARE(cache.stats().hits, 3ULL);
+
+    //Enough entries to rehash the index, and one replaced. Each key is counted once.
+    mpirpc::ResultCache many(1 << 20);
+    auto key = [](int i) { return mpirpc::ResultCache::Key{3, 0, {char(i), char(i >> 8)}}; };
+    for (int i = 0; i < 1000; ++i)
+        many.insert(key(i), {'r', char(i)}, many.generation());
+    many.insert(key(0), {'x'}, many.generation());
+    QCOMPARE(many.stats().entries, std::size_t(1000));
+    QCOMPARE(many.stats().bytes, std::size_t(999*4 + 3));
+    QCOMPARE(*many.find(key(0)), std::vector<char>({'x'}));
+    bool all = true;
+    for (int i = 1; i < 1000; ++i)
+        all = all && *many.find(key(i)) == std::vector<char>({'r', char(i)});
+    QVERIFY(all);
+    many.invalidate();
+    QCOMPARE(many.stats().entries, std::size_t(0));
+    QCOMPARE(many.stats().bytes, std::size_t(0));
+}
+
+void MpirpcTest::metrics_test() {
+    mpirpc::LatencyHistogram histogram;
+    for (int i = 0; i < 99; ++i)
+        histogram.add(1e-6);
+    histogram.add(1e-3);
+    QCOMPARE(histogram.count(), 100ULL);
+    QCOMPARE(histogram.min(), 1e-6);
+    QCOMPARE(histogram.max(), 1e-3);
+    QVERIFY(histogram.quantile(0.5) >= 1e-6 && histogram.quantile(0.5) <= 2e-6);
+    QCOMPARE(histogram.quantile(1.0), 1e-3);
+
+    mpirpc::Metrics metrics;
+    metrics.sent(3, 1).calls = 2;
+    metrics.executed(3, 1).latency.add(1e-6);
+    metrics.sampleQueueDepth(5);
+    QCOMPARE(metrics.peakQueueDepth(), std::size_t(5));
+    QCOMPARE(metrics.queueDepth().size(), std::size_t(1));
+    std::ostringstream out;
+    metrics.writeJson(out, 0);
+    QVERIFY(out.str().find("\"function\":3,\"rank\":1,\"calls\":2") != std::string::npos);
+    metrics.clear();
+    QVERIFY(metrics.sent().empty());
+}
+
+void MpirpcTest::tracer_test() {
+    mpirpc::Tracer tracer;
+    tracer.begin("ignored");
+    tracer.enable(4);
+    tracer.setClockOffset(1000);
+    {
+        mpirpc::TraceScope scope(tracer, "execute", "function", 7);
+    }
+    tracer.begin("send", "peer", 1);
+    tracer.end("send");
+    tracer.begin("wait");
+    auto events = tracer.events();
+    QCOMPARE(events.size(), std::size_t(1));
+    QCOMPARE(events[0].size(), std::size_t(4));
+    QCOMPARE(events[0][0].phase, 'E');
+    QCOMPARE(std::string(events[0][3].name), std::string("wait"));
+
+    std::ostringstream out;
+    tracer.writeJson(out, 2);
+    QVERIFY(out.str().find("\"name\":\"send\",\"ph\":\"B\"") != std::string::npos);
+    QVERIFY(out.str().find("\"args\":{\"peer\":1}") != std::string::npos);
+    QVERIFY(out.str().find("\"pid\":2") != std::string::npos);
+    QVERIFY(out.str().find("ignored") == std::string::npos);
+}
+
+void MpirpcTest::stream_array_view_test() {
+    std::vector<double> v{1.5, 2.5, 3.5};
+    double a[3] = {4.5, 5.5, 6.5};
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    s << (uint8_t) 7 << v << mpirpc::CArrayWrapper<double>(a, 3) << v;
+    //One byte, then each array's size, padding length and padding before 8 byte aligned elements
+    QCOMPARE(buffer.size(), (size_t) (1 + 8 + 1 + 6 + 24 + 8 + 1 + 7 + 24 + 8 + 1 + 7 + 24));
+    s.seek(0);
+    uint8_t b;
+    std::vector<double> v2;
+    mpirpc::CArrayWrapper<double> a2;
+    mpirpc::ArrayView<double> view;
+    s >> b >> v2 >> a2 >> view;
+    QCOMPARE(v2, v);
+    QCOMPARE(a2.size(), (size_t) 3);
+    QCOMPARE(a2[2], 6.5);
+    a2.del();
+    QVERIFY(!view.ownsData());
+    QCOMPARE((const char*) view.data(), buffer.data() + buffer.size() - 24);
+    QCOMPARE(view.toVector(), v);
+
+    //Shifting the data by a byte misaligns the elements, so they are copied
+    std::vector<char> shifted(1, 0);
+    shifted.insert(shifted.end(), buffer.begin(), buffer.end());
+    mpirpc::ParameterStream u(&shifted);
+    u.seek(1 + 1 + 8 + 1 + 6 + 24 + 8 + 1 + 7 + 24);
+    u >> view;
+    QVERIFY(view.ownsData());
+    QCOMPARE(view.toVector(), v);
+    QCOMPARE(u.pos(), shifted.size());
+
+    std::vector<char> empty;
+    mpirpc::ParameterStream e(&empty);
+    e << std::vector<double>();
+    e.seek(0);
+    e >> view;
+    QVERIFY(view.empty());
+    QCOMPARE(e.pos(), sizeof(std::size_t));
+}
+
+void MpirpcTest::stream_string_view_test() {
+    std::vector<char> buffer;
+    mpirpc::ParameterStream s(&buffer);
+    std::string str("a string which is not copied");
+    s << str << mpirpc::StringView("a view");
+    s.seek(0);
+    mpirpc::StringView view, view2;
+    s >> view >> view2;
+    QVERIFY(!view.ownsData());
+    QCOMPARE(view.str(), str);
+    QCOMPARE(view2.str(), std::string("a view"));
+
+    //A source may discard the buffer, so streamed strings are copied
+    std::vector<std::vector<char>> chunks;
+    std::vector<char> out;
+    mpirpc::ParameterStream w(&out);
+    w.setSink([&chunks](mpirpc::ParameterStream& s) {
+        chunks.push_back(*s.dataVector());
+        s.dataVector()->clear();
+    }, 5);
+    w << str;
+    chunks.push_back(out);
+    std::size_t next = 1;
+    std::vector<char> in(chunks[0]);
+    mpirpc::ParameterStream r(&in);
+    r.setSource([&chunks, &next](mpirpc::ParameterStream& s) {
+        if (next == chunks.size())
+            return false;
+        s.dataVector()->insert(s.dataVector()->end(), chunks[next].begin(), chunks[next].end());
+        ++next;
+        return true;
+    });
+    r >> view;
+    QVERIFY(view.ownsData());
+    QCOMPARE(view.str(), str);
+}
+
+void MpirpcTest::view_conversion_test() {
+    static_assert(mpirpc::is_view_conversion<const mpirpc::ArrayView<double>&, std::vector<double>&>::value, "vectors are converted to views");
+    static_assert(mpirpc::is_view_conversion<mpirpc::StringView, std::string>::value, "strings are converted to views");
+    static_assert(!mpirpc::is_view_conversion<mpirpc::StringView, mpirpc::StringView&>::value, "views are passed on");
+    static_assert(!mpirpc::is_view_conversion<const std::vector<double>&, std::vector<double>&>::value, "only views are converted");
+
+    //Remote calls send the vector itself, local calls get a view of it
+    std::vector<double> v{1.0, 2.0};
+    const std::vector<double>& sent = mpirpc::forward_parameter_type<mpirpc::ArrayView<double>, std::vector<double>&>(v);
+    QCOMPARE(&sent, (const std::vector<double>*) &v);
+    mpirpc::ArrayView<double> local = mpirpc::forward_parameter_type_local<const mpirpc::ArrayView<double>&, std::vector<double>&>(v);
+    QCOMPARE(local.data(), (const double*) v.data());
+    QCOMPARE(local.size(), v.size());
+    std::string str("local");
+    mpirpc::StringView localString = mpirpc::forward_parameter_type_local<mpirpc::StringView, std::string&>(str);
+    QCOMPARE(localString.data(), str.data());
+}
+
+struct ArenaCounted
+{
+    ArenaCounted() { ++alive; }
+    ~ArenaCounted() { --alive; }
+    static int alive;
+};
+
+int ArenaCounted::alive = 0;
+
+static mpirpc::Manager *nestedManager = nullptr;
+static char* nestedReturned = nullptr;
+
+char* nestedName()
+{
+    static char name[] = "nested";
+    return name;
+}
+
+void nestedCaller(int32_t target)
+{
+    nestedReturned = nestedManager->invokeFunctionR(target, &nestedName, 0);
+}
+
+void MpirpcTest::argument_arena_test() {
+    mpirpc::ArgumentArena arena(256);
+    QVERIFY(mpirpc::ArgumentArena::current() == nullptr);
+    {
+        mpirpc::ArgumentArena::Scope outer(arena);
+        QVERIFY(mpirpc::ArgumentArena::current() == &arena);
+        ArenaCounted* a = mpirpc::newArgument<ArenaCounted>();
+        QVERIFY(arena.owns(a));
+        double* d = mpirpc::newArgumentArray<double>(4);
+        QCOMPARE(reinterpret_cast<std::uintptr_t>(d) % alignof(double), (std::uintptr_t) 0);
+        QCOMPARE(d[3], 0.0);
+        {
+            mpirpc::ArgumentArena::Scope inner(arena);
+            mpirpc::newArgumentArray<ArenaCounted>(3);
+            char* big = mpirpc::newArgumentArray<char>(1000);
+            QVERIFY(arena.owns(big));
+            QCOMPARE(ArenaCounted::alive, 4);
+        }
+        //The inner scope only released its own arguments
+        QCOMPARE(ArenaCounted::alive, 1);
+        QVERIFY(mpirpc::ArgumentArena::current() == &arena);
+
+        std::vector<char> buffer;
+        mpirpc::ParameterStream s(&buffer);
+        std::string str("pointed to");
+        s << "in the arena" << mpirpc::PointerParameter<std::string>(&str);
+        char* c;
+        mpirpc::PointerParameter<std::string> p;
+        s >> c >> p;
+        QVERIFY(arena.owns(c));
+        QVERIFY(arena.owns(p.pointer));
+        QCOMPARE(*p.pointer, str);
+        mpirpc::deleteArgumentArray(c);
+        mpirpc::deleteArgument(p.pointer);
+        mpirpc::deleteArgument(a);
+        QCOMPARE(ArenaCounted::alive, 1);
+    }
+    QCOMPARE(ArenaCounted::alive, 0);
+    QVERIFY(mpirpc::ArgumentArena::current() == nullptr);
+
+    //Outside of a scope, arguments are allocated individually
+    ArenaCounted* a = mpirpc::newArgument<ArenaCounted>();
+    QVERIFY(!arena.owns(a));
+    mpirpc::deleteArgument(a);
+    QCOMPARE(ArenaCounted::alive, 0);
+
+    //The blocks are reused
+    std::size_t capacity = arena.capacity();
+    {
+        mpirpc::ArgumentArena::Scope scope(arena);
+        mpirpc::newArgumentArray<char>(1000);
+    }
+    QCOMPARE(arena.capacity(), capacity);
+
+    {
+        mpirpc::ArgumentArena::Scope scope(arena);
+        {
+            mpirpc::ArgumentArena::Suspend suspend;
+            QVERIFY(mpirpc::ArgumentArena::current() == nullptr);
+            char* c = mpirpc::newArgumentArray<char>(8);
+            QVERIFY(!arena.owns(c));
+            mpirpc::deleteArgumentArray(c);
+        }
+        QVERIFY(mpirpc::ArgumentArena::current() == &arena);
+    }
+
+    //The return value of a call nested in an invocation outlives the invocation's arena
+    mpirpc::Manager *m = m_manager;
+    nestedManager = m;
+    m->registerFunction<decltype(&nestedName), &nestedName>();
+    m->registerFunction<decltype(&nestedCaller), &nestedCaller>();
+    m->sync();
+    if (m->numProcs() < 2)
+        return;
+    nestedReturned = nullptr;
+    m->sync();
+    if (m->rank() == 0)
+        m->invokeFunction(1, &nestedCaller, 0, int32_t(0));
+    m->sync();
+    if (m->rank() == 1) {
+        QVERIFY(nestedReturned != nullptr);
+        QCOMPARE(std::string(nestedReturned), std::string("nested"));
+        delete[] nestedReturned;
+    }
+}
+
+static int scatterReceived = 0;
+
+int32_t scatterTarget(int32_t value, std::string tag)
+{
+    scatterReceived += value;
+    return value * 100 + tag.size();
+}
+
+void MpirpcTest::scatter_test()
+{
+    mpirpc::Manager *m = m_manager;
+    auto handle = m->registerFunction<decltype(&scatterTarget), &scatterTarget>();
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+
+    //Every rank to every rank, with the results gathered back
+    std::map<int, std::tuple<int32_t, std::string>> all;
+    for (int i = 0; i < numProcs; ++i)
+        all[i] = std::make_tuple(int32_t(rank + 1), std::string(i, 'x'));
+    std::map<int, int32_t> results = m->invokeScatterR<int32_t>(handle, all);
+    QCOMPARE((int) results.size(), numProcs);
+    for (auto& r : results)
+        QCOMPARE(r.second, (rank + 1) * 100 + r.first);
+    QCOMPARE(scatterReceived, numProcs * (numProcs + 1) / 2);
+
+    //One rank to one rank; the others take part without invoking anything
+    scatterReceived = 0;
+    std::map<int, std::tuple<int32_t, std::string>> one;
+    if (rank == 0)
+        one[numProcs - 1] = std::make_tuple(int32_t(7), std::string("last"));
+    results = m->invokeScatterR<int32_t>(handle, one);
+    QCOMPARE((int) results.size(), rank == 0 ? 1 : 0);
+    if (rank == 0)
+        QCOMPARE(results[numProcs - 1], 704);
+    QCOMPARE(scatterReceived, rank == numProcs - 1 ? 7 : 0);
+
+    scatterReceived = 0;
+    m->invokeScatter(handle, std::map<int, std::tuple<int32_t, std::string>>());
+    QCOMPARE(scatterReceived, 0);
+    QVERIFY_EXCEPTION_THROWN(m->invokeScatter(handle, std::map<int, std::tuple<int32_t, std::string>>{{numProcs, std::make_tuple(int32_t(1), std::string())}}), std::out_of_range);
+}
+
+static std::vector<int32_t> laneReceived;
+
+void laneTarget(int32_t sequence, const std::vector<char>&)
+{
+    laneReceived.push_back(sequence);
+}
+
+static int laneBulkRuns = 0;
+
+void laneBulk()
+{
+    ++laneBulkRuns;
+}
+
+void MpirpcTest::lane_test()
+{
+    mpirpc::Manager *m = m_manager;
+    auto ordered = m->registerFunction<decltype(&laneTarget), &laneTarget>();
+    auto bulk = m->registerFunction<decltype(&laneBulk), &laneBulk>();
+    m->setPriority(bulk, mpirpc::Priority::Bulk);
+    //Every rank must have registered the functions before they are invoked
+    m->sync();
+
+    QVERIFY(m->lane(ordered, 4096) == mpirpc::Priority::Normal);
+    m->setBulkThreshold(1024);
+    QVERIFY(m->lane(ordered, 64) == mpirpc::Priority::Normal);
+    QVERIFY(m->lane(ordered, 4096) == mpirpc::Priority::Bulk);
+    QVERIFY(m->lane(bulk, 0) == mpirpc::Priority::Bulk);
+    m->setPriority(ordered, mpirpc::Priority::Normal);
+    QVERIFY(m->lane(ordered, 4096) == mpirpc::Priority::Normal);
+
+    if (m->numProcs() > 1) {
+        //Pinned to one lane, small and large invocations run in the order they were sent
+        const int count = 8;
+        if (m->rank() == 0) {
+            for (int32_t i = 0; i < count; ++i)
+                m->invokeFunction(1, &laneTarget, ordered, i, std::vector<char>(i % 2 ? 4096 : 8));
+        }
+        //Let the invocations pile up so that a pass of checkMessages() sees both sizes. Fewer than MAX_MPI_QUEUE
+        //are sent, so the sender does not wait for them to be received.
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (m->rank() == 1) {
+            while ((int) laneReceived.size() < count)
+                m->checkMessages();
+        }
+        m->sync();
+        if (m->rank() == 1) {
+            std::vector<int32_t> expected(count);
+            std::iota(expected.begin(), expected.end(), 0);
+            QCOMPARE(laneReceived, expected);
+        }
+
+        //Each pass of checkMessages() runs at most the lane budget from the Bulk lane
+        m->setLaneBudget(mpirpc::Priority::Bulk, 2);
+        if (m->rank() == 0) {
+            for (int i = 0; i < 7; ++i)
+                m->invokeFunction(1, &laneBulk, bulk);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        int mostPerPass = 0;
+        if (m->rank() == 1) {
+            while (laneBulkRuns < 7) {
+                int before = laneBulkRuns;
+                m->checkMessages();
+                mostPerPass = std::max(mostPerPass, laneBulkRuns - before);
+            }
+        }
+        m->sync();
+        m->setLaneBudget(mpirpc::Priority::Bulk, MPIRPC_BULK_LANE_BUDGET);
+        QVERIFY(mostPerPass <= 2);
+    }
+    m->setBulkThreshold(0);
+}
+
+void MpirpcTest::reduce_in_place_test()
+{
+    mpirpc::Manager *m = m_manager;
+    int root = m->numProcs() - 1;
+    for (std::size_t segmentSize : {std::size_t(0), std::size_t(64)}) {
+        m->setReduceSegmentation(segmentSize, 2);
+        std::vector<int32_t> v(100);
+        std::iota(v.begin(), v.end(), m->rank());
+        std::vector<int32_t> original(v);
+        m->reduceInPlace(v, MPI_SUM, root);
+        if (m->rank() == root) {
+            int n = m->numProcs();
+            for (int i = 0; i < 100; ++i)
+                QCOMPARE(v[i], n*i + n*(n - 1)/2);
+        } else {
+            QCOMPARE(v, original);
+        }
+    }
+    m->setReduceSegmentation(0);
+}
+
+struct ReplicaLog
+{
+    std::vector<int32_t> values;
+
+    void append(int32_t value) { values.push_back(value); }
+    void clear() { values.clear(); }
+};
+
+mpirpc::ParameterStream& operator<<(mpirpc::ParameterStream& out, const ReplicaLog& log)
+{
+    return out << log.values;
+}
+
+mpirpc::ParameterStream& operator>>(mpirpc::ParameterStream& in, ReplicaLog& log)
+{
+    return in >> log.values;
+}
+
+//Exposes the handle on which a replica receives deltas, to deliver them out of order
+struct ReplicaProbe : mpirpc::ReplicatedObjectBase
+{
+    static mpirpc::FunctionHandle deltaHandle(mpirpc::ReplicatedObjectBase* replicated)
+    {
+        return replicated->*(&ReplicaProbe::m_deltaHandle);
+    }
+};
+
+void MpirpcTest::replicated_test()
+{
+    mpirpc::Manager *m = m_manager;
+    mpirpc::FunctionHandle append = m->registerFunction<decltype(&ReplicaLog::append), &ReplicaLog::append>();
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+
+    //Every rank mutates through the primary; each rank's calls are applied in order and every copy converges
+    //The Manager keeps replicated objects registered until it is destroyed
+    static ReplicaLog log;
+    if (rank == 0)
+        log.values = {-1};
+    mpirpc::ReplicatedObject<ReplicaLog>* replicated = m->registerReplicatedObject(&log, 0);
+    std::vector<int32_t> initial = log.values;
+    //Every rank must have registered the handlers before deltas arrive
+    m->sync();
+    QCOMPARE(initial, std::vector<int32_t>({-1}));
+    for (int32_t i = 0; i < 3; ++i)
+        m->invokeReplicated(replicated, &ReplicaLog::append, 0, rank*10 + i);
+    replicated->waitForOwnWrites();
+    replicated->waitForVersion(3*numProcs);
+    m->sync();
+    QCOMPARE(replicated->version(), uint64_t(3*numProcs));
+    QCOMPARE((int) log.values.size(), 3*numProcs + 1);
+    int32_t last = -1;
+    for (int32_t v : log.values) {
+        if (v/10 == rank && v >= 0) {
+            QVERIFY(v > last);
+            last = v;
+        }
+    }
+    QCOMPARE(last, rank*10 + 2);
+    //The member function is found by pointer; an unregistered one is refused
+    QVERIFY_EXCEPTION_THROWN(m->invokeReplicated(replicated, &ReplicaLog::clear, 0), mpirpc::UnregisteredFunctionException);
+
+    //Deltas which arrive ahead of their version are held back until the versions before them have been applied
+    static ReplicaLog held;
+    mpirpc::ReplicatedObject<ReplicaLog>* heldReplica = m->registerReplicatedObject(&held, numProcs - 1);
+    mpirpc::FunctionHandle delta = ReplicaProbe::deltaHandle(heldReplica);
+    for (uint64_t version : {3, 2, 1}) {
+        std::vector<char> buffer;
+        mpirpc::ParameterStream stream(&buffer);
+        stream << int32_t(version);
+        std::vector<uint8_t> arguments(buffer.begin(), buffer.end());
+        m->invokeFunction(rank, delta, version, numProcs, uint64_t(0), append, arguments);
+    }
+    heldReplica->waitForVersion(3);
+    QCOMPARE(held.values, std::vector<int32_t>({1, 2, 3}));
+    m->sync();
+}
+
+static mpirpc::Manager *reentrantManager = nullptr;
+static mpirpc::DistributedMap<int32_t, std::string> *reentrantMap = nullptr;
+static mpirpc::LookupFuture<std::string> reentrantLookup;
+static int32_t reentrantKey = 0;
+static bool reentrantReleased = false;
+
+void reentrantRelease()
+{
+    reentrantReleased = true;
+}
+
+void reentrantIssue()
+{
+    //Runs at rank 1 while its batch for rank 0 waits for a flow control credit
+    reentrantLookup = reentrantMap->lookup(reentrantKey);
+    reentrantManager->setFlowControl(0, 0);
+    reentrantManager->invokeFunction(0, &reentrantRelease, 0);
+}
+
+void reentrantHold()
+{
+    //Hold back the credit of this invocation until rank 1 has buffered its lookup
+    reentrantManager->invokeFunction(1, &reentrantIssue, 0);
+    while (!reentrantReleased)
+        reentrantManager->checkMessages();
+}
+
+void MpirpcTest::distributed_map_test()
+{
+    mpirpc::Manager *m = m_manager;
+    //Not associative, so the result shows which updates were merged before they were sent
+    auto combine = [](const std::string& a, const std::string& b) { return "(" + a + "+" + b + ")"; };
+    //The Manager keeps the map's functions registered until it is destroyed
+    static mpirpc::DistributedMap<int32_t, std::string> map(m, combine);
+    m->sync();
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+
+    //Keys of this rank owned by the next rank, so that operations on them are buffered
+    std::vector<int32_t> keys;
+    for (int32_t k = rank*1000; keys.size() < 4; ++k)
+        if (map.owner(k) == (rank + 1) % numProcs)
+            keys.push_back(k);
+
+    //Consecutive updates are merged into one
+    map.insert(keys[0], "x");
+    map.update(keys[0], "a");
+    map.update(keys[0], "b");
+    //A lookup ends the merge, and sees the updates before it
+    map.insert(keys[1], "x");
+    map.update(keys[1], "a");
+    mpirpc::LookupFuture<std::string> between = map.lookup(keys[1]);
+    map.update(keys[1], "b");
+    //So does an insert, which replaces the merged value
+    map.update(keys[2], "a");
+    map.insert(keys[2], "y");
+    map.update(keys[2], "b");
+    mpirpc::LookupFuture<std::string> missing = map.lookup(keys[3]);
+
+    QVERIFY(!missing.found());
+    QVERIFY_EXCEPTION_THROWN(missing.get(), std::out_of_range);
+    QCOMPARE(between.get(), std::string("(x+a)"));
+    QVERIFY(!between.valid());
+    map.sync();
+    bool remote = numProcs > 1;
+    QCOMPARE(map.lookup(keys[0]).get(), std::string(remote ? "(x+(a+b))" : "((x+a)+b)"));
+    QCOMPARE(map.lookup(keys[1]).get(), std::string("((x+a)+b)"));
+    QCOMPARE(map.lookup(keys[2]).get(), std::string("(y+b)"));
+    map.sync();
+    QCOMPARE(map.local().size(), std::size_t(3));
+
+    //An invocation run while a batch is being sent looks up a key of the same owner
+    m->registerFunction<decltype(&reentrantRelease), &reentrantRelease>();
+    m->registerFunction<decltype(&reentrantIssue), &reentrantIssue>();
+    m->registerFunction<decltype(&reentrantHold), &reentrantHold>();
+    m->sync();
+    if (numProcs < 2)
+        return;
+    reentrantManager = m;
+    reentrantMap = &map;
+    reentrantReleased = false;
+    std::vector<int32_t> owned;
+    for (int32_t k = 100000; owned.size() < 2; ++k)
+        if (map.owner(k) == 0)
+            owned.push_back(k);
+    reentrantKey = owned[1];
+    if (rank == 1) {
+        map.insert(owned[1], "r");
+        map.flush();
+    }
+    m->sync();
+    if (rank == 1) {
+        m->setFlowControl(1, 0);
+        m->invokeFunction(0, &reentrantHold, 0);
+        map.update(owned[0], "u");
+        map.flush();
+    }
+    map.sync();
+    std::string reentrantValue = rank == 1 ? reentrantLookup.get() : std::string();
+    std::string applied = rank == 1 ? map.lookup(owned[0]).get() : std::string();
+    map.sync();
+    if (rank == 1) {
+        QCOMPARE(reentrantValue, std::string("r"));
+        //Applied once, not again with the operations buffered during the send
+        QCOMPARE(applied, std::string("u"));
+    }
+}
+
+static int flowReceived = 0;
+
+void flowSink(const std::vector<char>&)
+{
+    ++flowReceived;
+}
+
+void MpirpcTest::flow_control_test()
+{
+    mpirpc::Manager *m = m_manager;
+    auto sink = m->registerFunction<decltype(&flowSink), &flowSink>();
+    if (m->numProcs() < 2)
+        return;
+    const int count = 5;
+    const std::vector<char> payload(8192, 'z');
+    for (bool compress : {false, true}) {
+        if (compress) {
+            //Registering the registered codec again keeps it
+            mpirpc::Codec* lz = new mpirpc::LzCodec();
+            m->registerCodec(lz);
+            m->registerCodec(lz);
+            m->setCompression(MPIRPC_CODEC_LZ, 1024);
+        }
+        unsigned long long compressedBefore = m->codecStats(MPIRPC_CODEC_LZ).compressed;
+        flowReceived = 0;
+        //Rank 1 may still be syncing, and running invocations, when rank 0 starts sending
+        m->sync();
+        if (m->rank() == 0) {
+            //A window of one invocation: every send after the first waits for the credit of the one before it
+            m->setFlowControl(1, 0);
+            for (int i = 0; i < count; ++i)
+                m->invokeFunction(1, &flowSink, sink, payload);
+            while (m->flowControlStats(1).outstandingMessages > 0)
+                m->checkMessages();
+            m->setFlowControl(0, 0);
+        } else if (m->rank() == 1) {
+            while (flowReceived < count)
+                m->checkMessages();
+        }
+        m->sync();
+        m->setCompression(0);
+        if (m->rank() == 0) {
+            mpirpc::FlowControlStats stats = m->flowControlStats(1);
+            QVERIFY(stats.stalls >= unsigned(count - 1));
+            QCOMPARE(stats.peakMessages, 1ULL);
+            //The credit returned is the size which was sent, not the decompressed size
+            QCOMPARE(stats.outstandingBytes, 0ULL);
+            if (compress) {
+                QCOMPARE(m->codecStats(MPIRPC_CODEC_LZ).compressed - compressedBefore, (unsigned long long) count);
+                QVERIFY(stats.bytes < 2*count*payload.size());
+            }
+        } else if (m->rank() == 1 && compress) {
+            const mpirpc::CodecStats& received = m->codecStats(MPIRPC_CODEC_LZ);
+            QCOMPARE(received.decompressed, (unsigned long long) count);
+            QVERIFY(received.bytesDecompressed > count*payload.size());
+            QVERIFY(received.bytesReceived < received.bytesDecompressed);
+        }
+    }
+}
+
+void MpirpcTest::distributed_array_test()
+{
+    mpirpc::Manager *m = m_manager;
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+    {
+        std::size_t size = 10*numProcs + 3;
+        auto array = m->distributedArray<int32_t>(size);
+        QCOMPARE(array->localOffset(), std::min(size, rank*array->blockSize()));
+        std::iota(array->begin(), array->end(), int32_t(array->localOffset()));
+        array->barrier();
+
+        //Ranges spanning the blocks of several ranks
+        std::vector<int32_t> all(size), expected(size);
+        std::iota(expected.begin(), expected.end(), 0);
+        array->get(0, size, all.data());
+        QCOMPARE(all, expected);
+        std::size_t first = array->blockSize() - 2;
+        std::vector<int32_t> span(size - first);
+        array->get(first, span.size(), span.data());
+        QCOMPARE(span, std::vector<int32_t>(expected.begin() + first, expected.end()));
+        QCOMPARE(array->get(size - 1), int32_t(size - 1));
+        QVERIFY_EXCEPTION_THROWN(array->get(size), std::out_of_range);
+        QVERIFY_EXCEPTION_THROWN(array->get(first, size, all.data()), std::out_of_range);
+        array->barrier();
+
+        if (rank == numProcs - 1) {
+            std::vector<int32_t> negated(size - first);
+            for (std::size_t i = 0; i < negated.size(); ++i)
+                negated[i] = -int32_t(first + i);
+            array->put(first, negated.size(), negated.data());
+        }
+        array->barrier();
+        for (std::size_t i = 0; i < array->localSize(); ++i) {
+            std::size_t index = array->localOffset() + i;
+            QCOMPARE(array->begin()[i], index >= first ? -int32_t(index) : int32_t(index));
+        }
+        array->barrier();
+    }
+    if (numProcs > 1) {
+        //Fewer elements than ranks: one element per rank, and none on the last rank
+        std::size_t size = numProcs - 1;
+        auto array = m->distributedArray<double>(size);
+        QCOMPARE(array->blockSize(), std::size_t(1));
+        QCOMPARE(array->localSize(), std::size_t(rank < numProcs - 1 ? 1 : 0));
+        QVERIFY(array->begin() == array->end() || array->localOffset() == std::size_t(rank));
+        if (array->localSize())
+            array->begin()[0] = rank + 0.5;
+        array->barrier();
+        std::vector<double> all(size);
+        array->get(0, size, all.data());
+        for (std::size_t i = 0; i < size; ++i)
+            QCOMPARE(all[i], i + 0.5);
+        QCOMPARE(array->owner(size - 1), numProcs - 2);
+        array->barrier();
+    }
+}
+
+static std::vector<std::size_t> rmaReceived;
+
+void rmaSink(const std::vector<char>& data)
+{
+    rmaReceived.push_back(data.size());
+}
+
+void MpirpcTest::rma_queue_test()
+{
+    int rank = m_manager->rank();
+    int numProcs = m_manager->numProcs();
+    {
+        mpirpc::RmaQueue queue(MPI_COMM_WORLD, 256);
+        int source, tag;
+        std::vector<char>* data;
+        std::size_t length;
+
+        //Records of 48 bytes wrap around the 256 byte ring several times
+        for (int i = 0; i < 20; ++i) {
+            std::vector<char> payload(40, char(i));
+            QVERIFY(queue.tryPush(rank, payload.data(), payload.size(), 7));
+            QVERIFY(queue.poll(source, tag, data, length));
+            QCOMPARE(source, rank);
+            QCOMPARE(tag, 7);
+            QCOMPARE(length, payload.size());
+            QCOMPARE(*data, payload);
+            delete data;
+        }
+        QVERIFY(!queue.poll(source, tag, data, length));
+
+        //A full ring refuses records until it is drained
+        int pushed = 0;
+        std::vector<char> payload(30, 'f');
+        while (queue.tryPush(rank, payload.data(), payload.size(), pushed))
+            ++pushed;
+        QVERIFY(pushed > 0 && pushed <= 256/40);
+        for (int i = 0; i < pushed; ++i) {
+            QVERIFY(queue.poll(source, tag, data, length));
+            QCOMPARE(tag, i);
+            QCOMPARE(*data, payload);
+            delete data;
+        }
+        QVERIFY(queue.tryPush(rank, payload.data(), payload.size(), 1));
+        QVERIFY(queue.poll(source, tag, data, length));
+        delete data;
+
+        //Messages which do not fit are announced by a redirect record carrying their tag
+        QVERIFY(!queue.fits(256));
+        QVERIFY(queue.tryPushRedirect(rank, MPIRPC_TAG_INVOKE));
+        QVERIFY(queue.poll(source, tag, data, length));
+        QCOMPARE(tag, int(mpirpc::RmaQueue::RedirectTag));
+        QVERIFY(data == nullptr);
+        QCOMPARE(length, std::size_t(MPIRPC_TAG_INVOKE));
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    //Through a Manager, an invocation too large for the ring overtakes neither the one before nor the one after it
+    m_manager->sync();
+    delete m_manager;
+    m_manager = new mpirpc::Manager(MPI_COMM_WORLD, mpirpc::Transport::OneSided);
+    mpirpc::Manager *m = m_manager;
+    auto sink = m->registerFunction<decltype(&rmaSink), &rmaSink>();
+    m->sync();
+    std::size_t large = 2*MPIRPC_RMA_RING_SIZE;
+    int target = (rank + 1) % numProcs;
+    m->invokeFunction(target, &rmaSink, sink, std::vector<char>(8));
+    m->invokeFunction(target, &rmaSink, sink, std::vector<char>(large));
+    m->invokeFunction(target, &rmaSink, sink, std::vector<char>(16));
+    while (rmaReceived.size() < 3)
+        m->checkMessages();
+    m->sync();
+    delete m_manager;
+    m_manager = new mpirpc::Manager(MPI_COMM_WORLD);
+    QCOMPARE(rmaReceived, std::vector<std::size_t>({8, large, 16}));
+}
+
+void MpirpcTest::reduce_future_test()
+{
+    mpirpc::Manager *m = m_manager;
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+    int32_t ranks = numProcs*(numProcs - 1)/2;
+
+    mpirpc::ReduceFuture<std::vector<int32_t>> future = m->iallreduce(std::vector<int32_t>{rank, 1}, MPI_SUM);
+    QVERIFY(future.valid());
+    future.wait();
+    //Waiting again, or testing, after completion changes nothing
+    future.wait();
+    QVERIFY(future.ready());
+    QCOMPARE(future.get(), std::vector<int32_t>({ranks, numProcs}));
+    QVERIFY(!future.valid());
+    QVERIFY_EXCEPTION_THROWN(future.get(), std::logic_error);
+
+    std::vector<int32_t> values(1000, 2);
+    mpirpc::ReduceFuture<int32_t> total = m->iaccumulate(values.begin(), values.end(), int32_t(0), std::plus<int32_t>(), MPI_SUM);
+    QCOMPARE(total.get(), 2000*numProcs);
+
+    //A persistent reduction restarts on its own buffers, and its result stays available until the next start()
+    auto persistent = m->persistentAllreduce<int32_t>(3, MPI_SUM);
+    const int32_t* buffer = persistent->result().data();
+    for (int32_t step = 0; step < 3; ++step) {
+        std::fill(persistent->input().begin(), persistent->input().end(), rank + step);
+        persistent->start();
+        std::vector<int32_t> expected(3, ranks + step*numProcs);
+        QCOMPARE(persistent->wait(), expected);
+        QCOMPARE(persistent->wait(), expected);
+        QCOMPARE(persistent->result(), expected);
+        QVERIFY(persistent->result().data() == buffer);
+    }
+    auto toRoot = m->persistentReduce<int32_t>(2, MPI_MAX, 0);
+    for (int32_t step = 0; step < 2; ++step) {
+        toRoot->input() = {rank, step};
+        toRoot->start();
+        toRoot->wait();
+        if (rank == 0)
+            QCOMPARE(toRoot->result(), std::vector<int32_t>({numProcs - 1, step}));
+    }
+}
+
+/**
+ * @brief The local elements of every rank, in rank order
+ */
+static std::vector<int32_t> gatherAll(const std::vector<int32_t>& local)
+{
+    int procs;
+    MPI_Comm_size(MPI_COMM_WORLD, &procs);
+    int count = local.size();
+    std::vector<int> counts(procs), displs(procs, 0);
+    MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (int r = 1; r < procs; ++r)
+        displs[r] = displs[r-1] + counts[r-1];
+    std::vector<int32_t> all(displs.back() + counts.back());
+    MPI_Allgatherv(local.data(), count, MPI_INT32_T, all.data(), counts.data(), displs.data(), MPI_INT32_T, MPI_COMM_WORLD);
+    return all;
+}
+
+/**
+ * @brief Uneven, duplicated keys, and none at all on rank 1
+ */
+static std::vector<int32_t> sortInput(int rank)
+{
+    std::vector<int32_t> input(rank == 1 ? 0 : 3 + 4*rank);
+    for (std::size_t i = 0; i < input.size(); ++i)
+        input[i] = (i*7 + rank*3) % 11;
+    return input;
+}
+
+void MpirpcTest::sort_test()
+{
+    mpirpc::Manager *m = m_manager;
+    int rank = m->rank();
+    int numProcs = m->numProcs();
+    std::vector<int32_t> unsorted;
+    for (int r = 0; r < numProcs; ++r) {
+        std::vector<int32_t> input = sortInput(r);
+        unsorted.insert(unsorted.end(), input.begin(), input.end());
+    }
+    std::vector<int32_t> expected(unsorted);
+    std::sort(expected.begin(), expected.end());
+
+    //With an MPI datatype
+    std::vector<int32_t> ints = sortInput(rank);
+    m->sort(ints);
+    std::vector<int32_t> sorted = gatherAll(ints);
+    std::vector<int32_t> descending = sortInput(rank);
+    m->sort(descending, std::greater<int32_t>());
+    descending = gatherAll(descending);
+
+    //Every key equal
+    std::vector<int32_t> same(rank + 2, 7);
+    m->sort(same);
+    same = gatherAll(same);
+
+    //Every rank empty
+    std::vector<int32_t> none;
+    m->sort(none);
+
+    //Serialized, zero padded so that the order of the strings is the order of the keys
+    std::vector<std::string> strings;
+    for (int32_t i : sortInput(rank)) {
+        char key[8];
+        snprintf(key, sizeof(key), "%04d", i);
+        strings.push_back(key);
+    }
+    m->sort(strings);
+    std::vector<int32_t> keys;
+    for (const std::string& key : strings)
+        keys.push_back(std::stoi(key));
+    keys = gatherAll(keys);
+
+    //Every element to the last rank, grouped by source in rank order, in the order of each source
+    std::vector<int32_t> routed = sortInput(rank);
+    m->partition(routed, [numProcs](int32_t) { return numProcs - 1; });
+    std::vector<std::string> words{std::string(rank + 1, 'w'), "x"};
+    m->partition(words, [](const std::string& w) { return int(w.size() - 1); });
+
+    QVERIFY(std::is_sorted(ints.begin(), ints.end()));
+    QCOMPARE(sorted, expected);
+    QCOMPARE(descending, std::vector<int32_t>(expected.rbegin(), expected.rend()));
+    QCOMPARE(same, std::vector<int32_t>((numProcs + 3)*numProcs/2, 7));
+    QVERIFY(none.empty());
+    QVERIFY(std::is_sorted(strings.begin(), strings.end()));
+    QCOMPARE(keys, expected);
+    QCOMPARE(routed, rank == numProcs - 1 ? unsorted : std::vector<int32_t>());
+    QCOMPARE(words.size(), rank == 0 ? std::size_t(numProcs + 1) : std::size_t(1));
+    QVERIFY(std::all_of(words.begin(), words.end(), [rank](const std::string& w) { return int(w.size()) == rank + 1; }));
+
+    //Every rank throws before exchanging anything
+    std::vector<int32_t> outside{1};
+    QVERIFY_EXCEPTION_THROWN(m->partition(outside, [numProcs](int32_t) { return numProcs; }), std::out_of_range);
+}
+
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+    MpirpcTest test;
+    int ret = QTest::qExec(&test, argc, argv);
+    MPI_Finalize();
+    return ret;
+}
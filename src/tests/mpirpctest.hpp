@@ -5,10 +5,17 @@
 #include <QtTest/QTest>
 #include <string>
 
+namespace mpirpc
+{
+class Manager;
+}
+
 class MpirpcTest : public QObject
 {
 Q_OBJECT
 private slots:
+    void initTestCase();
+
     void stream_uint8_t_test();
     void stream_uint8_t_test_data();
 
@@ -43,6 +50,40 @@ private slots:
     void stream_charp_test_data();
 
     void stream_combo();
+
+    void stream_vector_test();
+    void stream_unique_ptr_test();
+    void stream_array_into_test();
+    void stream_chunked_test();
+    void codec_lz_test();
+    void invocation_header_test();
+    void stream_pod_test();
+    void mpitype_test();
+    void op_trampoline_test();
+    void accumulate_test();
+    void scan_test();
+    void result_cache_test();
+    void metrics_test();
+    void tracer_test();
+    void stream_array_view_test();
+    void stream_string_view_test();
+    void view_conversion_test();
+    void argument_arena_test();
+    void scatter_test();
+    void lane_test();
+    void reduce_in_place_test();
+    void replicated_test();
+    void distributed_map_test();
+    void flow_control_test();
+    void distributed_array_test();
+    void rma_queue_test();
+    void reduce_future_test();
+    void sort_test();
+
+    void cleanupTestCase();
+
+private:
+    mpirpc::Manager *m_manager;
 };
 
 Q_DECLARE_METATYPE(std::string)
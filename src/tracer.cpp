@@ -0,0 +1,114 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tracer.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+
+namespace mpirpc {
+
+static std::atomic<uint64_t> nextTracerId(1);
+
+Tracer::Tracer()
+    : m_enabled(false), m_capacity(MPIRPC_TRACE_CAPACITY), m_clockOffset(0), m_id(nextTracerId++)
+{
+}
+
+void Tracer::enable(std::size_t capacity)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_buffers.empty())
+            m_capacity = capacity;
+    }
+    m_enabled = true;
+}
+
+uint64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const TraceEvent& event)
+{
+    ThreadBuffer* buffer = threadBuffer();
+    uint64_t next = buffer->next.load(std::memory_order_relaxed);
+    buffer->events[next % buffer->events.size()] = event;
+    buffer->next.store(next + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer* Tracer::threadBuffer()
+{
+    static thread_local std::unordered_map<uint64_t, ThreadBuffer*> buffers;
+    ThreadBuffer*& buffer = buffers[m_id];
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffers.emplace_back(new ThreadBuffer(m_capacity));
+        buffer = m_buffers.back().get();
+    }
+    return buffer;
+}
+
+std::vector<std::vector<TraceEvent>> Tracer::events() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::vector<TraceEvent>> result;
+    for (const auto& buffer : m_buffers) {
+        uint64_t next = buffer->next.load(std::memory_order_acquire);
+        uint64_t size = buffer->events.size();
+        uint64_t first = next > size ? next - size : 0;
+        result.emplace_back();
+        for (uint64_t i = first; i < next; ++i)
+            result.back().push_back(buffer->events[i % size]);
+    }
+    return result;
+}
+
+void Tracer::writeJson(std::ostream& out, int rank) const
+{
+    std::vector<std::vector<TraceEvent>> threads = events();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank << ",\"args\":{\"name\":\"rank " << rank << "\"}}";
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    for (std::size_t tid = 0; tid < threads.size(); ++tid) {
+        for (const TraceEvent& e : threads[tid]) {
+            double ts = (static_cast<int64_t>(e.time) + m_clockOffset)/1000.0;
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << ts
+                << ",\"pid\":" << rank << ",\"tid\":" << tid;
+            if (e.argName)
+                out << ",\"args\":{\"" << e.argName << "\":" << e.arg << "}";
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+bool Tracer::writeJson(const std::string& path, int rank) const
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    writeJson(out, rank);
+    return static_cast<bool>(out);
+}
+
+}
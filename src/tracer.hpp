@@ -0,0 +1,146 @@
+/*
+ * MPIRPC: MPI based invocation of functions on other ranks
+ * Copyright (C) 2014  Colin MacLean <s0838159@sms.ed.ac.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//Events kept per thread. Older events are overwritten once the buffer is full.
+#define MPIRPC_TRACE_CAPACITY (1 << 16)
+
+namespace mpirpc {
+
+struct TraceEvent
+{
+    const char* name;
+    const char* argName; ///< nullptr if the event has no argument
+    int64_t arg;
+    uint64_t time;       ///< Nanoseconds of the local steady clock
+    char phase;          ///< 'B' for begin, 'E' for end
+};
+
+/**
+ * @brief Records begin and end events into a ring buffer per thread and writes them in the Chrome trace event
+ * format, which chrome://tracing and Perfetto can open.
+ *
+ * Each thread only writes to its own buffer, so recording takes no locks. Times are shifted by the clock offset, so
+ * the traces of several ranks line up when the offsets are measured against a common reference.
+ * See: Manager::enableTracing()
+ */
+class Tracer
+{
+public:
+    Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * @brief Start recording, keeping the last #capacity events of each thread
+     */
+    void enable(std::size_t capacity = MPIRPC_TRACE_CAPACITY);
+    void disable() { m_enabled = false; }
+    bool enabled() const { return m_enabled; }
+
+    /**
+     * @brief Nanoseconds added to every timestamp when writing
+     */
+    void setClockOffset(int64_t offset) { m_clockOffset = offset; }
+    int64_t clockOffset() const { return m_clockOffset; }
+
+    void begin(const char* name, const char* argName = nullptr, int64_t arg = 0)
+    {
+        if (m_enabled)
+            record(TraceEvent{name, argName, arg, now(), 'B'});
+    }
+
+    void end(const char* name)
+    {
+        if (m_enabled)
+            record(TraceEvent{name, nullptr, 0, now(), 'E'});
+    }
+
+    static uint64_t now();
+
+    /**
+     * @brief The recorded events of every thread, oldest first per thread. Events recorded while this runs may
+     * be missed or torn, so call it once the traced threads are idle.
+     */
+    std::vector<std::vector<TraceEvent>> events() const;
+
+    /**
+     * @brief Write the events as a Chrome trace with #rank as the process id
+     */
+    void writeJson(std::ostream& out, int rank) const;
+
+    /**
+     * @return False if the file could not be written
+     */
+    bool writeJson(const std::string& path, int rank) const;
+
+protected:
+    struct ThreadBuffer
+    {
+        ThreadBuffer(std::size_t capacity) : events(capacity), next(0) {}
+
+        std::vector<TraceEvent> events;
+        std::atomic<uint64_t> next; //Only written by the owning thread
+    };
+
+    void record(const TraceEvent& event);
+    ThreadBuffer* threadBuffer();
+
+    std::atomic<bool> m_enabled;
+    std::size_t m_capacity;
+    int64_t m_clockOffset;
+    uint64_t m_id; //Distinguishes this tracer in the thread local buffer lookup
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+};
+
+/**
+ * @brief Records a begin event on construction and the matching end event on destruction
+ */
+class TraceScope
+{
+public:
+    TraceScope(Tracer& tracer, const char* name, const char* argName = nullptr, int64_t arg = 0)
+        : m_tracer(tracer), m_name(name)
+    {
+        m_tracer.begin(name, argName, arg);
+    }
+
+    ~TraceScope() { m_tracer.end(m_name); }
+
+protected:
+    Tracer& m_tracer;
+    const char* m_name;
+};
+
+}
+
+#endif // TRACER_HPP